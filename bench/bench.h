@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string_view>
+
+/* Minimal harness for microbenchmarks: every benchmark runs in batches
+ * until it has taken long enough to give a stable mean. */
+namespace bench {
+
+/* Keeps the compiler from dropping a computation whose result is unused. */
+template <typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/* Runs fn until min_time has passed and prints the mean time per call. */
+template <typename F>
+double run(std::string_view name, F&& fn,
+    std::chrono::nanoseconds min_time = std::chrono::milliseconds {200})
+{
+    using clock = std::chrono::steady_clock;
+    // warm up caches and whatever buffers fn reuses
+    for (int i = 0; i < 16; i++) {
+        fn();
+    }
+
+    size_t iterations {0};
+    size_t batch {1};
+    const auto start {clock::now()};
+    auto elapsed {clock::duration::zero()};
+    while (elapsed < min_time) {
+        for (size_t i = 0; i < batch; i++) {
+            fn();
+        }
+        iterations += batch;
+        batch *= 2;
+        elapsed = clock::now() - start;
+    }
+
+    const double ns {std::chrono::duration<double, std::nano>(elapsed).count() / iterations};
+    std::cout << std::left << std::setw(48) << name << std::right << std::setw(12)
+        << std::fixed << std::setprecision(1) << ns << " ns/op\n";
+    return ns;
+}
+
+}
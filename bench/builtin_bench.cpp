@@ -0,0 +1,53 @@
+#include "bench.h"
+#include "builtins/builtins.h"
+#include "builtins/test.h"
+#include <array>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/* Builtin dispatch before the perfect hash, kept as a baseline: a map
+ * keyed by std::string that signals a missing builtin by throwing. */
+namespace legacy {
+
+static const std::unordered_map<std::string, cmd_function_t> commands {
+    {"cd", com_true}, {"help", com_true}, {"clear", com_true}, {"exit", com_true},
+    {"set", com_true}, {"export", com_true}, {"unset", com_true}, {"hash", com_true},
+    {"test", com_test}, {"[", com_test}, {"true", com_true}, {"false", com_false},
+    {":", com_true},
+};
+
+static cmd_function_t find_builtin(std::string_view name) {
+    try {
+        return commands.at(std::string(name));
+    } catch (const std::out_of_range& e) {
+        return nullptr;
+    }
+}
+
+}
+
+static constexpr std::array<std::string_view, 4> BUILTIN_NAMES {"true", "[", "export", "cd"};
+static constexpr std::array<std::string_view, 4> EXTERNAL_NAMES {"ls", "grep", "/usr/bin/env", "make"};
+
+/* Benchmarks looking up names with both tables. */
+static void compare(std::string_view name, const std::array<std::string_view, 4>& names) {
+    const double before {bench::run(std::string(name) + " (legacy)", [&] {
+        for (std::string_view command : names) {
+            bench::do_not_optimize(legacy::find_builtin(command));
+        }
+    })};
+    const double after {bench::run(std::string(name) + " (perfect hash)", [&] {
+        for (std::string_view command : names) {
+            bench::do_not_optimize(find_builtin(command));
+        }
+    })};
+    std::cout << "  speedup: " << before / after << "x\n";
+}
+
+int main() {
+    compare("4 builtins", BUILTIN_NAMES);
+    compare("4 external commands", EXTERNAL_NAMES);
+}
@@ -0,0 +1,98 @@
+#include "bench.h"
+#include "cmd/expansion.h"
+#include "cmd/variable.h"
+#include "stringsep.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+/* The expansion algorithm before it became a single pass, kept as a
+ * baseline: escapes are erased in place and every variable is spliced in
+ * with replace. */
+namespace legacy {
+
+static std::string get_variable(const std::string& str) {
+    const char* env {getenv(str.data())};
+    if (!env) {
+        if (var::is_set(str))
+            return var::get_var(str);
+        return "";
+    }
+    return env;
+}
+
+static void expand_variable(std::string& str, size_t start_pos, size_t end_pos) {
+    const std::string varname {str.substr(start_pos + 1, end_pos - start_pos - 1)};
+    const auto expanded {get_variable(std::move(varname))};
+    str.replace(start_pos, end_pos - start_pos, expanded);
+}
+
+static void expand_word(std::string& str) {
+    if (!str.empty() && str.front() == '\'' && str.back() == '\'')
+        return;
+
+    bool escaped {false};
+    size_t i {};
+    while (i < str.size()) {
+        const char c {str[i]};
+        if (c == sep::ESCAPE_CHAR && !escaped) {
+            str.erase(i, 1);
+            escaped = true;
+            continue;
+        }
+        if (c == sep::VAR_PREFIX && !escaped) {
+            size_t varname_end {i + 1};
+            while (varname_end < str.size() &&
+                sep::WORD_SEPARATORS.find(str[varname_end]) == std::string::npos)
+            {
+                varname_end++;
+            }
+            expand_variable(str, i, varname_end);
+        }
+        escaped = false;
+        i++;
+    }
+}
+
+}
+
+static std::string repeat(std::string_view part, size_t n) {
+    std::string result {};
+    for (size_t i = 0; i < n; i++) {
+        result.append(part);
+    }
+    return result;
+}
+
+/* Benchmarks a word with both algorithms. */
+static void compare(std::string_view name, const std::string& word) {
+    std::string copy {};
+    const double before {bench::run(std::string(name) + " (legacy)", [&] {
+        copy = word;
+        legacy::expand_word(copy);
+        bench::do_not_optimize(copy);
+    })};
+
+    std::string out {};
+    const double after {bench::run(std::string(name) + " (single pass)", [&] {
+        const auto expanded {expand_word(word, out)};
+        bench::do_not_optimize(expanded);
+    })};
+    std::cout << "  speedup: " << before / after << "x\n";
+}
+
+int main() {
+    var::set_var("SHORT", "x");
+    var::set_var("LONGER_NAME", "some/longer/value");
+    setenv("STUSH_BENCH_ENV", "environment", 1);
+    var::set_var("STUSH_BENCH_ENV", "environment");
+    var::export_var("STUSH_BENCH_ENV");
+
+    compare("literal word", "just-a-plain-literal-word-without-expansions");
+    compare("one variable", "$LONGER_NAME/bin");
+    compare("200 shell variables", repeat("$SHORT/", 200));
+    compare("200 environment variables", repeat("$STUSH_BENCH_ENV:", 200));
+    compare("500 escapes", repeat("\\ a", 500));
+    compare("20000 escapes", repeat("\\ a", 20000));
+    compare("mixed, 1000 expansions", repeat("$LONGER_NAME\\ \\$x/", 500));
+}
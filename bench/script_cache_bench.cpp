@@ -0,0 +1,47 @@
+#include "bench.h"
+#include "cmd/variable.h"
+#include "parser.h"
+#include "script_cache.h"
+#include "source.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+/* Writes a script with a mix of pipelines, loops and functions. */
+static void write_script(const fs::path& path, size_t blocks) {
+    std::ofstream out {path};
+    for (size_t i = 0; i < blocks; i++) {
+        out << "greet_" << i << "() {\n"
+            << "    echo \"hello $1\" | tr a-z A-Z > /dev/null\n"
+            << "}\n"
+            << "for x in a b c; do\n"
+            << "    if test \"$x\" = b; then greet_" << i << " \"$x\"; else echo $x; fi\n"
+            << "done\n"
+            << "count=$((count + " << i << "))\n"
+            << "case $count in 1*) echo one ;; *) echo other ;; esac\n";
+    }
+}
+
+int main() {
+    char dir_template[] {"/tmp/stush-bench-XXXXXX"};
+    const fs::path dir {mkdtemp(dir_template)};
+    var::set_var("XDG_CACHE_HOME", (dir / "cache").string());
+    const fs::path script {dir / "script.sh"};
+    write_script(script, 250);
+
+    const double before {bench::run("2000 line script (parsed)", [&] {
+        bench::do_not_optimize(parser::parse(source_text::map_file(script), " "));
+    })};
+
+    (void) script_cache::load(script, " ");
+    const double after {bench::run("2000 line script (cached)", [&] {
+        bench::do_not_optimize(script_cache::load(script, " "));
+    })};
+    std::cout << "  speedup: " << before / after << "x\n";
+
+    fs::remove_all(dir);
+}
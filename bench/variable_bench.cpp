@@ -0,0 +1,85 @@
+#include "bench.h"
+#include "cmd/variable.h"
+#include "stringhash.h"
+#include <array>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+/* The variable store before it was a flat table, kept as a baseline: a
+ * node based map with a lookup for is_set and another one for get_var. */
+namespace legacy {
+
+static string_map<std::string> vars {};
+
+static void set_var(const std::string& var, const std::string& value) {
+    vars[var] = value;
+}
+
+static std::string_view get(const std::string& var) {
+    if (vars.contains(var))
+        return vars.at(var);
+    return "";
+}
+
+static void unset(const std::string& var) {
+    if (vars.contains(var))
+        vars.erase(var);
+}
+
+}
+
+static constexpr std::array<std::string_view, 8> NAMES {
+    "i", "count", "PATH_PART", "line", "result", "tmp", "CONFIG_DIR", "index",
+};
+
+int main() {
+    for (std::string_view name : NAMES) {
+        legacy::set_var(std::string {name}, "initial");
+        var::set_var(name, "initial");
+    }
+
+    size_t n {};
+    const double set_before {bench::run("set 8 variables (legacy)", [&] {
+        for (std::string_view name : NAMES) {
+            legacy::set_var(std::string {name}, std::to_string(n++));
+        }
+    })};
+    const double set_after {bench::run("set 8 variables (flat table)", [&] {
+        for (std::string_view name : NAMES) {
+            var::set_var(name, std::to_string(n++));
+        }
+    })};
+    std::cout << "  speedup: " << set_before / set_after << "x\n";
+
+    const double get_before {bench::run("get 8 variables (legacy)", [&] {
+        for (std::string_view name : NAMES) {
+            bench::do_not_optimize(legacy::get(std::string {name}));
+        }
+    })};
+    const double get_after {bench::run("get 8 variables (flat table)", [&] {
+        for (std::string_view name : NAMES) {
+            bench::do_not_optimize(var::find(name));
+        }
+    })};
+    std::cout << "  speedup: " << get_before / get_after << "x\n";
+
+    const double churn_before {bench::run("set, get and unset 8 variables (legacy)", [&] {
+        for (std::string_view name : NAMES) {
+            const std::string key {std::string {name} + "_tmp"};
+            legacy::set_var(key, "value");
+            bench::do_not_optimize(legacy::get(key));
+            legacy::unset(key);
+        }
+    })};
+    std::string key {};
+    const double churn_after {bench::run("set, get and unset 8 variables (flat table)", [&] {
+        for (std::string_view name : NAMES) {
+            key.assign(name).append("_tmp");
+            var::set_var(key, "value");
+            bench::do_not_optimize(var::find(key));
+            var::unset(key);
+        }
+    })};
+    std::cout << "  speedup: " << churn_before / churn_after << "x\n";
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "source.h"
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <string>
+#include <string_view>
+
+/* Syntax tree of a parsed command line or script. Nodes are stored in flat
+ * arrays and refer to their children by index range, words refer to the
+ * source text by offsets, so a program can be executed any number of times
+ * without being rescanned. Everything above pipelines is compiled to code
+ * that refers to the nodes. */
+namespace ast {
+
+enum class op_kind : uint8_t {
+    NONE,
+    PIPE_OUT,
+    PIPE_BOTH,
+    LIST_AND,
+    LIST_OR,
+    BACKGROUND,
+    COMMAND,
+    NEWLINE,
+};
+
+struct source_span {
+    uint32_t start;
+    uint32_t end;
+};
+
+/* What a word contains, noted by the tokenizer while it scans the word. A
+ * word with none of these is taken as it is, without looking at it again. */
+namespace word_flags {
+
+constexpr uint8_t VARIABLE {1 << 0};    // $, including ${ } and $(( ))
+constexpr uint8_t GLOB {1 << 1};        // unquoted *, ? or [
+constexpr uint8_t TILDE {1 << 2};       // a leading ~
+constexpr uint8_t QUOTES {1 << 3};
+constexpr uint8_t ESCAPES {1 << 4};
+constexpr uint8_t BRACES {1 << 5};      // unquoted {
+
+}
+
+struct word {
+    source_span span;
+    uint8_t flags;
+};
+
+/* Marks an absent node or code address. */
+constexpr uint32_t NO_INDEX {UINT32_MAX};
+
+/* A command with its arguments. pipe is the operator connecting it to the
+ * next command of the pipeline, NONE for the last one. A compound command
+ * that is a stage of a pipeline has no words, body is the address of its
+ * code instead. A list started with & is kept the same way, with all the
+ * words of the list, so that the job can be shown as it was written. */
+struct simple_command {
+    uint32_t first_word;
+    uint32_t nwords;
+    op_kind pipe;
+    uint32_t body;
+};
+
+/* Commands connected with | or |&. */
+struct pipeline {
+    uint32_t first_command;
+    uint32_t ncommands;
+};
+
+/* Lists, control flow and functions are compiled to code for a small
+ * machine with a status register, a stack of for loops and a stack of case
+ * subjects. Operands are indices of nodes or code addresses. */
+enum class opcode : uint8_t {
+    RUN_PIPELINE,       // run pipeline a
+    RUN_TIMED_PIPELINE, // run pipeline a and report its times in time_format b
+    RUN_BACKGROUND,     // start the list that is the body of command a as a job
+    JUMP,               // go to a
+    JUMP_IF_FAILURE,    // go to a if the status is not 0
+    JUMP_IF_SUCCESS,    // go to a if the status is 0
+    SET_STATUS,         // set the status to a
+    FOR_BEGIN,          // start a loop named by word b over the words of command a,
+                        // over the positional parameters if a is NO_INDEX
+    FOR_NEXT,           // assign the next item of the loop, or drop it and go to b
+    POP_LOOP,           // drop the innermost loop
+    CASE_BEGIN,         // push word a as the subject of a case
+    CASE_MATCH,         // if the subject matches pattern word a, drop it and go to b
+    CASE_END,           // drop the subject, nothing matched
+    DEFINE_FUNCTION,    // define a function named by word a with its body at b
+    RETURN,             // leave the body with the status from word a, or the
+                        // current one if a is NO_INDEX
+};
+
+/* How time reports a pipeline. */
+enum class time_format : uint32_t {
+    HUMAN,
+    JSON,
+};
+
+struct instruction {
+    opcode op;
+    uint32_t a;
+    uint32_t b;
+};
+
+/* All nodes of a program are allocated from its own arena and freed
+ * together with it. */
+struct program {
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena {
+        std::make_unique<std::pmr::monotonic_buffer_resource>()
+    };
+    /* Once parsed, every word in the source is followed by a NUL character. */
+    source_text source;
+    line_index lines {};
+    std::pmr::vector<word> words {arena.get()};
+    std::pmr::vector<simple_command> commands {arena.get()};
+    std::pmr::vector<pipeline> pipelines {arena.get()};
+    std::pmr::vector<instruction> code {arena.get()};
+
+    std::string_view text(const word& w) const {
+        return source.view().substr(w.span.start, w.span.end - w.span.start);
+    }
+
+    std::span<const word> words_of(const simple_command& c) const {
+        return std::span {words}.subspan(c.first_word, c.nwords);
+    }
+
+    std::span<const simple_command> commands_of(const pipeline& p) const {
+        return std::span {commands}.subspan(p.first_command, p.ncommands);
+    }
+};
+
+}
@@ -1,13 +1,15 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include "cmd/cmd.h"
 
 using cmd_function_t = int(*)(args_view);
 
 struct Command {
+    std::string_view name;
     cmd_function_t function;
-    std::string doc;
+    std::string_view doc;
 };
 
 const int BUILTIN_NOT_FOUND = 127;
@@ -26,4 +28,12 @@ int com_export(args_view args);
 
 int com_unset(args_view args);
 
+int com_hash(args_view args);
+
+/* Returns the builtin called name, nullptr if there is none. */
+const Command* find_builtin(std::string_view name) noexcept;
+
+bool is_builtin(std::string_view name);
+
+/* Runs the builtin args[0], returns BUILTIN_NOT_FOUND if there is none. */
 int exec_builtin(args_view args);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "cmd/cmd.h"
+
+/* Exit status of wait for a pid that isn't a job of the shell */
+const int WAIT_NOT_A_CHILD = 127;
+
+/* Lists the jobs, or the ones named, with -p only their process groups. */
+int com_jobs(args_view args);
+
+/* Brings a job to the foreground, continuing it if it's stopped. */
+int com_fg(args_view args);
+
+/* Continues stopped jobs in the background. */
+int com_bg(args_view args);
+
+/* Waits for the jobs named, or all of them, and returns the status of the
+ * last one. With -n, only waits for the first of them to finish. */
+int com_wait(args_view args);
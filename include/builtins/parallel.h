@@ -0,0 +1,17 @@
+#pragma once
+
+#include "cmd/cmd.h"
+
+/* Exit status of parallel when it can't run any task, failed tasks are
+ * counted up to PARALLEL_MAX_FAILED. */
+const int PARALLEL_ERROR = 255;
+const int PARALLEL_MAX_FAILED = 101;
+
+/* parallel [-j jobs] [-k] [-r] command [args...] ::: inputs...
+ *
+ * Runs the command once for each input, at most jobs of them at a time, one
+ * per CPU by default. The input replaces every {} in the arguments, or is
+ * added after them if there is none. With -k, the output of each task is
+ * held back until the ones before it have written theirs. -r reports the
+ * status and time of every task on standard error once all are done. */
+int com_parallel(args_view args);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "cmd/cmd.h"
+
+/* Exit status of test for invalid expressions */
+const int TEST_ERROR = 2;
+
+/* test and [, evaluating an expression of up to four arguments as
+ * described by POSIX. */
+int com_test(args_view args);
+
+int com_true(args_view args);
+
+int com_false(args_view args);
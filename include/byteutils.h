@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <cstdlib>
 #include <stdint.h>
@@ -24,7 +25,7 @@ constexpr std::array<uint8_t, sizeof(T)> unpackn(T code) {
     static_assert(std::is_integral_v<T>, "Code must be an integer.");
     constexpr std::size_t N = sizeof(T);
     std::array<uint8_t, N> res {};
-    for (int i = 0; i < N; i++) {
+    for (std::size_t i = 0; i < N; i++) {
         res[i] = (uint8_t)((code >> (8 * (N - i - 1))) & 0xFF);
     }
     return res;
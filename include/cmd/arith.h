@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+/* Arithmetic expansion, $(( )). Expressions use the operators of C over
+ * 64-bit integers that wrap around, plus ** for exponentiation. They are
+ * compiled to code for a small stack machine once per source text and read
+ * and assign shell variables directly. */
+namespace arith {
+
+/* Evaluates an expression, compiling it on its first use. Throws
+ * expansion_error if it is malformed or can't be evaluated, like when it
+ * divides by zero. */
+int64_t evaluate(std::string_view expr);
+
+/* Drops every compiled expression. */
+void clear() noexcept;
+
+}
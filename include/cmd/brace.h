@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/* Brace expansion. Words are generated one at a time, so a range of a
+ * million numbers or the product of several lists never has to be held in
+ * memory as a whole. */
+namespace brace {
+
+/* Whether word contains a brace expression: a list {a,b} or a sequence
+ * {1..10}, {a..e} or {01..10..3}. Braces that are quoted, escaped or
+ * belong to a ${ } are left alone. */
+[[nodiscard]]
+bool has_braces(std::string_view word);
+
+/* Generates the words a word expands to, leftmost expressions varying
+ * slowest. A word without braces generates itself. */
+class generator {
+    struct sequence {
+        int64_t first;
+        int64_t step;
+        /* Numbers are padded with zeros to this width */
+        int width;
+        bool letters;
+    };
+
+    /* A word being expanded at its leftmost expression */
+    struct frame {
+        std::string text;
+        size_t open;
+        size_t close;
+        /* Start and length of each alternative of a list, empty for a sequence */
+        std::vector<std::pair<size_t, size_t>> alternatives;
+        sequence seq;
+        uint64_t count;
+        uint64_t index;
+    };
+
+    std::vector<frame> stack {};
+    std::string word;
+    bool started {false};
+
+    bool push(std::string_view text);
+    void append_item(const frame& f, std::string& out) const;
+
+public:
+    explicit generator(std::string_view word) : word(word) {}
+
+    /* Replaces the contents of out with the next word. Returns false once
+     * every word has been generated. Throws expansion_error for a sequence
+     * with more words than could ever be passed to a command. */
+    bool next(std::string& out);
+};
+
+}
@@ -1,16 +1,54 @@
 #pragma once
 
+#include "ast.h"
+#include <chrono>
+#include <memory>
+#include <memory_resource>
 #include <span>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
 
 using args_container = std::vector<std::string>;
-using args_view = std::span<std::string>;
+/* Arguments of a command ready to be executed. Each of them is followed by a
+ * NUL character, so data() can be passed where a C string is expected. */
+using args_view = std::span<const std::string_view>;
+using arg_list = std::pmr::vector<std::string_view>;
+
+/* Time and resources a stage of a pipeline took, for time. A stage that
+ * runs inside the shell has no pid, it is charged with what the shell and
+ * the children it started used meanwhile. */
+struct stage_usage {
+    pid_t pid {-1};
+    int status {};
+    std::chrono::nanoseconds real {};
+    std::chrono::microseconds user {};
+    std::chrono::microseconds sys {};
+    /* Largest resident set size in KiB */
+    long max_rss {};
+};
 
 int run_simple_command(args_view args);
 
-int run_pipeline(args_view args);
+/* Memory needed to run the pipeline is taken from arena, the caller is
+ * responsible for releasing it. If usage isn't empty, it has an element for
+ * every stage, which is filled in. */
+int run_pipeline(const ast::program& prog, const ast::pipeline& pipeline,
+    std::pmr::memory_resource* arena, std::span<stage_usage> usage = {});
+
+/* Runs a pipeline and reports on standard error how long it took and what
+ * it used, with a breakdown by stage. */
+int run_timed_pipeline(const ast::program& prog, const ast::pipeline& pipeline,
+    std::pmr::memory_resource* arena, ast::time_format format);
+
+/* Source text of the words of a command. Delimiters that parsing replaced
+ * with NUL characters show as spaces. */
+std::string command_text(const ast::program& prog, const ast::simple_command& command);
 
-int run_list(args_view args);
+/* Starts a list in a copy of the shell without waiting for it and adds it
+ * to the job table. list is the command & compiled it to. */
+int run_background(const ast::program& prog, const ast::simple_command& list);
 
-int run_compound_command(args_container& args);
+/* Runs a whole program. Functions it defines keep it alive. */
+int run_compound_command(std::shared_ptr<const ast::program> prog);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/* Cache of command names resolved through PATH. */
+namespace cmdhash {
+
+struct entry {
+    std::string path;
+    size_t hits;
+};
+
+using table = std::unordered_map<std::string, entry>;
+
+/* Resolves a command name to the path it should be executed from. Names
+ * containing a slash are returned unchanged, others are looked up in the
+ * cache and searched for in PATH on a miss. Only absolute paths are cached.
+ * Returns an empty string if the command could not be found. */
+[[nodiscard]]
+std::string resolve(std::string_view name);
+
+/* Same as above, cached is set to whether the path came from the cache. */
+[[nodiscard]]
+std::string resolve(std::string_view name, bool& cached);
+
+/* Drops a single command from the cache, e.g. when its binary is gone. */
+void forget(std::string_view name);
+
+/* Drops all cached commands. The variable store calls it whenever PATH
+ * changes. */
+void clear() noexcept;
+
+const table& entries() noexcept;
+
+}
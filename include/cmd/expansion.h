@@ -1,14 +1,75 @@
 #pragma once
 
 #include "cmd/cmd.h"
+#include "cmd/glob.h"
+#include <cstdint>
+#include <cstdlib>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 
+/* Thrown when the expansions of a command can't be carried out. */
+class expansion_error : public std::runtime_error {
+public:
+    /* Exit status of the command that couldn't be expanded */
+    int status;
+
+    expansion_error(const std::string& what, int status = EXIT_FAILURE) :
+        std::runtime_error(what),
+        status(status)
+    {}
+};
+
+[[nodiscard]]
+std::string get_variable(std::string_view name);
+
+/* Returns the value of a variable or special parameter, nothing if it is
+ * unset. Values the shell computes are built in scratch. */
 [[nodiscard]]
-std::string get_variable(const std::string& str) noexcept;
+std::optional<std::string_view> find_parameter(std::string_view name, std::string& scratch);
+
+/* Returns str without the quotes around it, if it is quoted as a whole. */
+[[nodiscard]]
+std::string_view strip_quotes(std::string_view str);
+
+/* Expand shell and env variables, ${ } expressions, tilde, strip escaping
+ * slashes. Throws expansion_error for a malformed ${ }. Returns
+ * word itself if nothing had to be expanded, otherwise the result is built
+ * in a single pass into out, replacing its contents. */
+std::string_view expand_word(std::string_view word, std::string& out);
 
-/* Expand shell and env variables, tilde, strip escaping slashes. */
+/* Same as above, in place. */
 void expand_word(std::string& str);
 
-void expand_globs(args_container& args);
+/* Copies str into arena, followed by a NUL character. */
+std::string_view arena_copy(std::string_view str, std::pmr::memory_resource* arena);
 
-void strip_all_quotes(args_view args);
+/* Performs all expansions and quote removal on a word, appending the
+ * resulting arguments to args. Words that don't change are appended as they
+ * are if they are followed by a NUL character, everything else is allocated
+ * in arena. Directories read for pathname expansion are kept in dirs.
+ * Throws expansion_error if brace expansion makes args larger than a new
+ * process accepts. */
+void expand_argument(std::string_view word, arg_list& args, std::pmr::memory_resource* arena,
+    glob::dir_cache& dirs);
+
+/* Same as above, for a word of a program with the ast::word_flags the
+ * tokenizer found in it. Words without any are appended without looking at
+ * them, words without braces or globs skip these expansions. */
+void expand_argument(std::string_view word, uint8_t flags, arg_list& args,
+    std::pmr::memory_resource* arena, glob::dir_cache& dirs);
+
+/* Same as above, for a word whose directory listings aren't shared. */
+void expand_argument(std::string_view word, arg_list& args, std::pmr::memory_resource* arena);
+
+/* Performs expansions and quote removal on a word that stays a single
+ * word, without expanding globs. */
+[[nodiscard]]
+std::string expand_single(std::string_view word);
+
+/* Same as above, for a pattern of a case command. Characters that were
+ * quoted or escaped are put in brackets, so they only match themselves. */
+[[nodiscard]]
+std::string expand_pattern(std::string_view word);
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "cmd/cmd.h"
+#include <bitset>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/* Pathname expansion. Patterns are compiled once per word and matched
+ * against directory listings that are read once per command. A ** component
+ * matches any number of directories, which are walked in parallel. */
+namespace glob {
+
+/* A compiled pattern for a single path component. Supports *, ? and
+ * bracket expressions with ranges, negation by ! or ^ and the POSIX
+ * character classes. Characters are matched byte by byte. */
+class matcher {
+    enum class kind : uint8_t {
+        LITERAL,
+        ANY_CHAR,
+        ANY_STRING,
+        CHAR_CLASS,
+    };
+
+    struct token {
+        kind type;
+        uint32_t start;
+        uint32_t length;
+    };
+
+    std::string literals {};
+    std::vector<token> tokens {};
+    std::vector<std::bitset<256>> classes {};
+    bool _magic {false};
+
+    bool matches_class(const token& tok, char c) const;
+    bool matches_at(const token& tok, std::string_view str, size_t pos) const;
+
+public:
+    matcher() = default;
+    explicit matcher(std::string_view pattern);
+
+    /* Whether the pattern contains anything but literal characters. */
+    bool magic() const {
+        return _magic;
+    }
+
+    /* Whether the pattern explicitly matches names starting with a dot. */
+    bool matches_hidden() const {
+        return !tokens.empty() && tokens.front().type == kind::LITERAL &&
+            literals[tokens.front().start] == '.';
+    }
+
+    /* Whether the pattern matches all of str. */
+    [[nodiscard]]
+    bool matches(std::string_view str) const;
+};
+
+/* A directory entry. Type is one of the DT_ constants of dirent.h. */
+struct entry {
+    std::string_view name;
+    unsigned char type;
+};
+
+/* The entries of a directory, sorted by name, without . and .. Names point
+ * into a buffer that moves along with the listing. */
+struct listing {
+    std::vector<char> names {};
+    std::vector<entry> entries {};
+};
+
+/* Reads a directory, the current one if dir is empty. A directory that
+ * can't be read gives an empty listing. */
+[[nodiscard]]
+listing read_listing(const std::string& dir);
+
+/* Whether a listed entry is a directory. Symbolic links are only followed
+ * if follow_links is set. */
+[[nodiscard]]
+bool is_directory(const entry& e, const std::string& path, bool follow_links);
+
+/* Directory listings of a single command, shared by all of its words.
+ * Directories are named the way they are prefixed to matches, that is
+ * empty or ending with a slash. */
+class dir_cache {
+    std::unordered_map<std::string, listing> listings {};
+
+public:
+    const listing& list(const std::string& dir);
+
+    /* Adds a listing that has been read elsewhere, unless dir is already
+     * cached. */
+    void add(std::string dir, listing contents);
+};
+
+/* Whether a word could be a pattern. */
+[[nodiscard]]
+bool has_magic(std::string_view word);
+
+/* Appends the paths matching pattern to args in sorted order, allocating
+ * them in arena. Returns the number of matches. */
+size_t expand(std::string_view pattern, dir_cache& dirs, arg_list& args,
+    std::pmr::memory_resource* arena);
+
+}
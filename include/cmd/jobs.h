@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <termios.h>
+#include <vector>
+
+/* Table of the jobs of the shell: lists started with & and, with job
+ * control, pipelines stopped from the terminal. Job control is only there
+ * when the shell reads commands from a terminal, then every pipeline gets a
+ * process group of its own that the terminal is handed to while it runs in
+ * the foreground. Otherwise everything stays in the shell's process group
+ * and jobs can only be waited for. */
+namespace jobs {
+
+enum class job_state : uint8_t {
+    RUNNING,
+    STOPPED,
+    DONE,
+};
+
+struct job {
+    int id;
+    pid_t pgid;
+    /* Processes of the job that haven't exited yet */
+    std::vector<pid_t> pids;
+    /* Process whose exit status is the job's, the last of a pipeline */
+    pid_t last;
+    int status;
+    job_state state;
+    std::string command;
+    /* Whether the state changed since the job was last reported */
+    bool changed;
+};
+
+/* Puts the shell in a process group of its own and takes the terminal, if
+ * standard input is one. */
+void init_job_control();
+
+bool job_control() noexcept;
+
+/* Descriptor of the controlling terminal, -1 without job control. */
+int terminal() noexcept;
+
+/* Forgets the jobs and job control of the parent, for a forked copy of the
+ * shell. */
+void reset_after_fork() noexcept;
+
+/* Adds a running job and returns it. The last of pids decides its status. */
+job& add(pid_t pgid, std::vector<pid_t> pids, std::string command);
+
+/* Returns the job named by spec, %n, %+, %% or %- for the current and
+ * previous job, or the pid of one of its processes. nullptr if there is
+ * none. */
+job* find(std::string_view spec);
+
+job* find(int id);
+
+/* Returns the job started or stopped most recently, nullptr if there is
+ * none. */
+job* current();
+
+const std::vector<job>& table() noexcept;
+
+/* Collects the jobs that exited or stopped, without waiting. */
+void update();
+
+/* Waits until the job is done, or stops with until_stopped. Returns its
+ * status. */
+int wait(job& j, bool until_stopped = false);
+
+/* Waits until one of the jobs with the given ids is done, or any job that
+ * isn't stopped if there are no ids, and returns it. A job that is done
+ * already counts. Returns nullptr if there is no such job. */
+job* wait_next(std::span<const int> ids);
+
+/* Continues a stopped job. In the foreground, it gets the terminal and is
+ * waited for until it's done or stops again, and its status is returned. */
+int resume(job& j, bool foreground);
+
+/* Forgets a job that is done. */
+void remove(const job& j);
+
+/* Describes a job the way the jobs builtin lists it. */
+std::string describe(const job& j);
+
+/* Reports the jobs whose state changed since the last time, dropping the
+ * ones that are done. Returns the report, empty if nothing happened. */
+std::string notify();
+
+/* Hands the terminal to the process group pgid for the lifetime of the
+ * object, then takes it back for the shell together with the modes the
+ * shell had. Does nothing without job control. */
+class foreground {
+    pid_t pgid;
+    termios modes {};
+
+public:
+    explicit foreground(pid_t pgid);
+    ~foreground();
+
+    foreground(const foreground&) = delete;
+    foreground& operator=(const foreground&) = delete;
+};
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+/* Parameter expansion with operators: ${name}, ${#name}, ${name:-word},
+ * ${name-word}, ${name#pattern}, ${name##pattern}, ${name%pattern},
+ * ${name%%pattern}, ${name/pattern/string}, ${name//pattern/string} and
+ * ${name:offset:length}. Everything works on views of the value, patterns
+ * are compiled once and kept for the session. */
+namespace param {
+
+/* Returns the position after the } that closes the ${ at start, or
+ * std::string_view::npos if it isn't closed. */
+[[nodiscard]]
+size_t find_end(std::string_view word, size_t start);
+
+/* Appends the expansion of expr, the text between ${ and }, to out. Throws
+ * expansion_error if it isn't a valid expression. */
+void expand(std::string_view expr, std::string& out);
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <csignal>
+#include <optional>
+#include <span>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/* Collects the children of the shell in the order they exit. SIGCHLD is
+ * blocked and read from a signalfd that an epoll instance waits on, every
+ * child that has exited is reaped with wait4 and kept until somebody asks
+ * for it. Children that stop are reported the same way, for job control. */
+namespace reaper {
+
+using clock = std::chrono::steady_clock;
+
+struct child_exit {
+    pid_t pid;
+    /* Status as reported by wait, WIFSTOPPED if the child only stopped */
+    int status;
+    rusage usage;
+    /* Wall time from watch to the exit being reaped */
+    clock::duration elapsed;
+};
+
+/* What the children that started while it was open used, as wait4
+ * reported it once they were reaped. Accounts nest, a child counts towards
+ * every one that was open when it started, whoever waits for it. */
+class account {
+public:
+    std::chrono::microseconds user {};
+    std::chrono::microseconds sys {};
+    /* Largest resident set size of any of the children in KiB */
+    long max_rss {};
+
+    account();
+    ~account();
+
+    account(const account&) = delete;
+    account& operator=(const account&) = delete;
+};
+
+/* Blocks SIGCHLD and sets up the signalfd. Called on first use, it only
+ * has to be called directly to be set up before any child exists. */
+void init();
+
+/* Signal mask new processes should start with, the one the shell had
+ * before SIGCHLD was blocked. */
+const sigset_t& child_sigmask();
+
+/* Notes when a child started, for its elapsed time. The time is taken
+ * before the child is created, so that it can't miss any of its run. */
+void watch(pid_t pid, clock::time_point time);
+
+/* Exit status of a command from the status wait reported for it. */
+int exit_status(int status) noexcept;
+
+/* Descriptor that becomes readable when a child exits or stops, for an
+ * event loop that shouldn't block on children. -1 if there is none. */
+int fd();
+
+/* Reaps every child that has exited without waiting, making fd() quiet
+ * again until the next one does. */
+void poll();
+
+/* Waits for the first of pids to exit and returns it, leaving the others
+ * to later calls. Returns nothing if deadline passes first. */
+std::optional<child_exit> wait_any(std::span<const pid_t> pids,
+    clock::time_point deadline = clock::time_point::max());
+
+/* Same as above for a single child. */
+std::optional<child_exit> wait(pid_t pid, clock::time_point deadline = clock::time_point::max());
+
+/* Forgets everything inherited from the parent, for a forked copy of the
+ * shell, whose children are its own. */
+void reset_after_fork() noexcept;
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "cmd/cmd.h"
+#include <functional>
+#include <span>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* File descriptors a spawned process should see as its standard streams.
+ * Every descriptor from close_fds is closed in the child after the standard
+ * streams have been set up. */
+struct spawn_fds {
+    int in {STDIN_FILENO};
+    int out {STDOUT_FILENO};
+    int err {STDERR_FILENO};
+    std::span<const int> close_fds {};
+};
+
+/* Process group a spawned process is put in, NO_PGROUP to stay in the
+ * shell's and 0 to start one of its own. The group is handed terminal, unless
+ * that is -1. */
+const pid_t NO_PGROUP = -1;
+
+struct spawn_group {
+    pid_t pgid {NO_PGROUP};
+    int terminal {-1};
+};
+
+/* Exit status reported when a command cannot be found or executed. */
+const int SPAWN_NOT_FOUND = 127;
+const int SPAWN_NOT_EXECUTABLE = 126;
+
+/* Launches an external command with posix_spawn, without copying the shell's
+ * address space. The command is resolved through the PATH cache. Returns the
+ * pid of the child, or -1 on failure, in which case an error is printed and
+ * status is set to the exit code the command should report. */
+pid_t spawn_command(args_view args, const spawn_fds& fds, int& status,
+    const spawn_group& group = {});
+
+/* Forks a copy of the shell that runs body with the given standard streams
+ * and exits with the status it returns. Used for pipeline stages that have
+ * to run shell code, like functions and compound commands. Returns the pid
+ * of the child, or -1 on failure. */
+pid_t spawn_subshell(const spawn_fds& fds, const std::function<int()>& body,
+    const spawn_group& group = {});
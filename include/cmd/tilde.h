@@ -0,0 +1,26 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+/* Home directories for tilde expansion. User homes are memoized for the
+ * session and dropped when /etc/passwd changes, $HOME is read once and
+ * kept until the variable changes. */
+namespace tilde {
+
+/* Home directory of the current user, nothing if HOME is unset. */
+[[nodiscard]]
+std::optional<std::string_view> home();
+
+/* Home directory of a user, nothing if there is no such user. */
+[[nodiscard]]
+std::optional<std::string_view> home_of(std::string_view user);
+
+/* Drops the cached $HOME. The variable store calls it whenever HOME
+ * changes. */
+void forget_home() noexcept;
+
+/* Drops every memoized user home. */
+void clear() noexcept;
+
+}
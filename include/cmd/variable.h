@@ -1,15 +1,75 @@
 #pragma once
 
+#include <optional>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
 
 namespace var {
 
-void set_var(const std::string& var, const std::string& value) noexcept;
+/* Variables of the shell, including the environment it was started with.
+ * Exported ones are passed to new processes through environment(). */
 
-bool is_set(const std::string& var) noexcept;
+/* Sets a variable, keeping it exported if it is. */
+void set_var(std::string_view var, std::string_view value);
 
-void unset(const std::string& var) noexcept;
+bool is_set(std::string_view var) noexcept;
 
-const std::string& get_var(const std::string& var);
+void unset(std::string_view var) noexcept;
+
+const std::string& get_var(std::string_view var);
+
+/* Returns the value of a shell variable, std::nullopt if it isn't set. The
+ * view stays valid until the variable is set or unset again. */
+std::optional<std::string_view> find(std::string_view var) noexcept;
+
+/* Marks a variable for export, setting it to an empty value if it isn't
+ * set. */
+void export_var(std::string_view var);
+
+bool is_exported(std::string_view var) noexcept;
+
+/* NAME=value of every exported variable, terminated by nullptr, to be passed
+ * to new processes. It is only rebuilt after exported variables changed and
+ * stays valid until they change again. */
+char* const* environment();
+
+/* Called whenever a variable that is watched changes. */
+using watcher = void (*)() noexcept;
+
+/* Calls on_change whenever the variable is set, unset or restored by the
+ * end of a scope, however that happens. Caches of values derived from it
+ * use this to drop them. A variable has one watcher at most. */
+void watch(std::string_view var, watcher on_change);
+
+/* Starts a scope for local variables. */
+void push_scope();
+
+/* Sets a variable until the innermost scope ends, when the value it had
+ * before comes back. Without a scope it is the same as set_var. */
+void set_local(std::string_view var, std::string_view value);
+
+/* Ends the innermost scope, restoring the variables set in it. */
+void pop_scope() noexcept;
+
+/* Exit status of the last command, $? */
+int last_status() noexcept;
+
+void set_last_status(int status) noexcept;
+
+/* Process of the last job started in the background, $!, 0 if there is
+ * none. */
+pid_t last_background() noexcept;
+
+void set_last_background(pid_t pid) noexcept;
+
+/* Positional parameters $1, $2, ... of the innermost function call, or of
+ * the script if no function is running. */
+const std::vector<std::string>& positional() noexcept;
+
+void push_positional(std::vector<std::string> params);
+
+void pop_positional() noexcept;
 
 }
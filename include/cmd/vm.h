@@ -0,0 +1,35 @@
+#pragma once
+
+#include "ast.h"
+#include "cmd/cmd.h"
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+/* Interpreter of the code programs are compiled to. Pipelines are handed to
+ * run_pipeline, everything else runs inside the shell process. */
+namespace vm {
+
+/* A function keeps the program it was defined in alive. */
+struct function {
+    std::shared_ptr<const ast::program> prog;
+    uint32_t address;
+};
+
+/* Calls nested deeper than this fail instead of exhausting the stack. */
+const size_t MAX_CALL_DEPTH = 256;
+
+/* Runs a program from its start. */
+int run(std::shared_ptr<const ast::program> prog);
+
+/* Runs the body of a compound command of the program that is being run. */
+int run_body(const ast::program& prog, uint32_t address);
+
+/* Returns the function with the given name, nullptr if there is none. */
+const function* find_function(std::string_view name);
+
+/* Runs a function with the arguments after its name as positional
+ * parameters. */
+int call_function(const function& fn, args_view args);
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "cmd/glob.h"
+#include <string>
+#include <vector>
+
+/* Recursive directory walks for ** patterns. Subdirectories are read by a
+ * pool of threads that steal work from each other, once a tree turns out
+ * to be too large to be read by the calling thread alone. */
+namespace walk {
+
+/* A directory found by a walk, named like the directories of a
+ * glob::dir_cache. */
+struct directory {
+    std::string path;
+    glob::listing contents;
+};
+
+/* Number of threads walks use. Taken from STUSH_GLOB_THREADS, the number of
+ * CPUs if it isn't set to a positive number. */
+[[nodiscard]]
+unsigned default_threads();
+
+/* Reads root and every directory below it, skipping hidden ones and not
+ * following symbolic links. The result is sorted by path and starts with
+ * root itself. */
+[[nodiscard]]
+std::vector<directory> tree(const std::string& root, unsigned threads = default_threads());
+
+}
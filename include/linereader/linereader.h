@@ -5,6 +5,7 @@
 #include "linereader/terminal.h"
 #include "linereader/types.h"
 #include <functional>
+#include <string>
 #include <string_view>
 #include <termios.h>
 #include <unordered_map>
@@ -27,6 +28,8 @@ class LineReader {
     Terminal term {};
     LineBuffer linebuffer {};
     std::string _prompt {};
+    int notice_fd {-1};
+    std::function<std::string()> notices {};
     funcmap command_map {
         {packn<key_code_t>(CTRL_A), std::bind(&LineReader::go_to_line_start, this)},
         {packn<key_code_t>(CTRL_E), std::bind(&LineReader::go_to_line_end, this)},
@@ -78,6 +81,15 @@ class LineReader {
     void handle_control(key_code_t key);
     void handle_normal(key_code_t key);
 
+    /* Reads the next key, showing notices while waiting for it. */
+    key_code_t next_key();
+    /* Writes text above the line being edited. */
+    void show_notice(const std::string& text);
+
 public:
+    /* Shows what notices returns whenever fd becomes readable while a line
+     * is read, instead of holding it back until the line is done. */
+    void notify_from(int fd, std::function<std::string()> notices);
+
     std::string sh_read_line(std::string_view prompt, char terminator = ENTER);
 };
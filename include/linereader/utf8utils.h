@@ -21,7 +21,7 @@ constexpr int utf8_seq_length(uint8_t c) {
 
 constexpr size_t utf8_strlen(std::string_view s) {
     size_t res {};
-    int i {0};
+    size_t i {0};
     while (i < s.size()) {
         i += utf8_seq_length(s.at(i));
         res++;
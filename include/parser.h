@@ -1,52 +1,227 @@
 #pragma once
 
+#include "ast.h"
 #include "cmd/cmd.h"
+#include "scan.h"
+#include "trace.h"
 #include <cassert>
 #include <cstddef>
-#include <stack>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <stdexcept>
+#include <string>
 #include <string_view>
+#include <vector>
+
+class parse_error : public std::runtime_error {
+public:
+    size_t position;
+    /* Filled in once the error leaves the parser */
+    source_location location;
+
+    parse_error(const std::string& what, size_t position) :
+        std::runtime_error(what),
+        position(position),
+        location({0, 0})
+    {}
+};
+
+struct token {
+    ast::op_kind op;
+    ast::source_span span;
+    /* ast::word_flags of a word */
+    uint8_t flags;
+};
 
 class tokenizer {
-    enum class state {
+    enum class state : uint8_t {
         REGULAR,
         ESCAPED,
         SINGLE_QUOTES,
         DOUBLE_QUOTES,
+        /* Inside ${ }, which may contain delimeters and operators */
+        PARAMETER,
+        /* Inside $(( )) or parentheses nested in it */
+        ARITHMETIC,
     };
-    std::stack<state> states;
+
+    /* Stack of states packed into a single word, REGULAR is always at the
+     * bottom. */
+    class state_stack {
+        static constexpr unsigned BITS {4};
+        static constexpr unsigned CAPACITY {64 / BITS};
+        uint64_t states {};
+        unsigned depth {1};
+
+    public:
+        state top() const {
+            return static_cast<state>(states & ((1 << BITS) - 1));
+        }
+
+        /* Throws parse_error at position if quotes are nested too deeply. */
+        void push(state s, size_t position) {
+            if (depth == CAPACITY)
+                throw parse_error("Quotes are nested too deeply.", position);
+            states = (states << BITS) | static_cast<uint64_t>(s);
+            depth++;
+        }
+
+        void pop() {
+            assert(depth > 1);
+            states >>= BITS;
+            depth--;
+        }
+    };
+
+    state_stack states;
     std::string_view line;
     std::string_view delimeter;
-    args_container tokens;
+    /* Bytes that end a run of ordinary characters in REGULAR state */
+    scan::char_set regular_special;
+    scan::char_set delimeters;
 
     size_t token_start;
     size_t token_end;
+    ast::op_kind token_op;
+    uint8_t token_flags;
 
     bool is_delimeter(char c) const;
-    /* Advances token_start until a character that is not delimerter is met,
-    * then assigns token_end to token_start */
+    /* Advances token_start until a character that is not delimerter or a line
+    * continuation is met, then assigns token_end to token_start */
     void find_start();
     /* Advances token_end n positions */
     void advance(int n = 1);
+    /* Advances token_end over characters that can't change the state */
+    void skip_ordinary();
+    /* Pushes a state, noting the quotes or escape it stands for */
+    void push_state(state s);
+    /* Enters PARAMETER state if a ${ starts at token_end, or ARITHMETIC state
+     * if a $(( does. Returns whether it did. */
+    bool enter_expansion();
+    /* Advances token_end over an operator of length n that starts a token */
+    void advance_operator(ast::op_kind op, int n = 1);
     bool is_next(char c) const;
-    /* Tries to push a substring from token_start to token_end to the
-     * resulting collection. Assigns token_start to token_end and advances
-     * token_end on success*/
-    void push_token();
+    /* Skips a comment up to (but not including) the end of the line */
+    void skip_comment();
     /* Handles char depending on current state. Returns true if the current
      * token has ended and is ready to be pushed, false otherwise. */
     bool handle_char(char c);
 
-    /* Splits a string into tokens by characters provided in delimeter. */
-    [[nodiscard]]
-    args_container tokenize_impl();
-
+public:
     tokenizer(std::string_view line, std::string_view delimeter);
 
-public:
+    /* Scans the next word or operator. Returns nothing at the end of line. */
+    [[nodiscard]]
+    std::optional<token> next();
+
+    /* Splits a string into tokens by characters provided in delimeter. */
     [[nodiscard]]
     static args_container tokenize(std::string_view line, std::string_view delimeter) {
         tokenizer t {line, delimeter};
-        return t.tokenize_impl();
+        args_container tokens {};
+        while (const auto tok {t.next()}) {
+            tokens.emplace_back(line.substr(tok->span.start, tok->span.end - tok->span.start));
+        }
+        return tokens;
     }
 };
 
+/* Builds the syntax tree of a program in a single pass over its tokens,
+ * compiling lists and compound commands to code as they are met. */
+class parser {
+    /* A loop that break and continue can leave. */
+    struct loop_context {
+        /* Whether the loop keeps items on the loop stack */
+        bool has_items;
+        uint32_t continue_address;
+        /* Jumps to the end of the loop */
+        std::vector<uint32_t> breaks {};
+    };
+
+    tokenizer tokens;
+    ast::program& prog;
+    std::optional<token> current;
+    std::optional<token> lookahead;
+    std::vector<loop_context> loops;
+
+    void advance();
+    const std::optional<token>& peek();
+    bool at_end() const;
+    bool at(ast::op_kind op) const;
+    bool at_word() const;
+    bool at_keyword(std::string_view keyword) const;
+    /* Whether the current token starts a ;; */
+    bool at_case_end() const;
+    std::string_view current_text() const;
+    size_t current_position() const;
+    void skip_newlines();
+    void skip_separators(bool stop_at_case_end);
+    /* Throws parse_error if the current token can't start a command. */
+    void expect_command(std::string_view what) const;
+    /* Consumes the keyword or throws parse_error. */
+    void expect_keyword(std::string_view keyword);
+    uint32_t push_word(ast::source_span span, uint8_t flags);
+
+    uint32_t emit(ast::opcode op, uint32_t a = ast::NO_INDEX, uint32_t b = ast::NO_INDEX);
+    uint32_t here() const;
+    /* Points the jump at address to the next instruction. */
+    void patch(uint32_t address);
+    /* Moves the code emitted since start out of the way, so that it can be
+     * run as a pipeline stage. Returns its new address. */
+    uint32_t make_stage_body(uint32_t start);
+    /* Points the breaks of the innermost loop to the next instruction and
+     * drops it. */
+    void close_loop();
+
+    void parse_program();
+    /* Parses commands up to one of the terminators, which is left as the
+     * current token and returned. With in_case, ;; also ends the list. An
+     * empty list of terminators parses up to the end of the program. */
+    std::string_view parse_compound_list(std::initializer_list<std::string_view> terminators,
+        bool in_case = false);
+    void parse_and_or();
+    void parse_pipeline();
+    /* Returns the command if it is a simple one, compound commands are
+     * compiled in place. */
+    std::optional<ast::simple_command> parse_command();
+    bool parse_compound_command();
+    void parse_if();
+    void parse_while(bool until);
+    void parse_for();
+    void parse_case();
+    void parse_brace_group();
+    void parse_function(ast::source_span name);
+    void parse_loop_jump(bool is_break);
+    void parse_return();
+    ast::simple_command parse_simple_command();
+    /* Puts a NUL character after every word, so that they can be passed to
+     * exec without being copied. */
+    void terminate_words();
+
+    parser(ast::program& prog, std::string_view delimeter);
+
+public:
+    /* Parses source into a program. Constructs may span several lines.
+     * Throws parse_error on invalid syntax. */
+    [[nodiscard]]
+    static ast::program parse(source_text source, std::string_view delimeter) {
+        // tokens are read as the parser asks for them, so this covers both
+        const trace::span span {"parse"};
+        ast::program prog {.source = std::move(source)};
+        prog.lines = line_index {prog.source};
+        parser p {prog, delimeter};
+        try {
+            p.parse_program();
+        } catch (parse_error& err) {
+            err.location = prog.lines.locate(err.position);
+            throw;
+        }
+        return prog;
+    }
+
+    [[nodiscard]]
+    static ast::program parse(std::string source, std::string_view delimeter) {
+        return parse(source_text {std::move(source)}, delimeter);
+    }
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+/* Searching for the first of a small set of bytes, several bytes at a time. */
+namespace scan {
+
+class char_set {
+public:
+    /* Sets larger than this are only searched byte by byte. */
+    static constexpr size_t MAX_VECTOR_CHARS = 16;
+
+private:
+    std::array<char, MAX_VECTOR_CHARS> _chars {};
+    size_t _size {};
+    std::array<bool, 256> table {};
+
+public:
+    constexpr char_set() = default;
+
+    constexpr char_set(std::string_view chars) {
+        for (char c : chars) {
+            add(c);
+        }
+    }
+
+    constexpr void add(char c) {
+        if (contains(c))
+            return;
+        if (_size < MAX_VECTOR_CHARS)
+            _chars[_size] = c;
+        _size++;
+        table[static_cast<unsigned char>(c)] = true;
+    }
+
+    constexpr bool contains(char c) const {
+        return table[static_cast<unsigned char>(c)];
+    }
+
+    constexpr size_t size() const {
+        return _size;
+    }
+
+    constexpr bool vectorizable() const {
+        return _size <= MAX_VECTOR_CHARS;
+    }
+
+    constexpr std::string_view chars() const {
+        return {_chars.data(), _size < MAX_VECTOR_CHARS ? _size : MAX_VECTOR_CHARS};
+    }
+};
+
+/* Returns the position of the first byte of str at or after pos that belongs
+ * to set, or str.size() if there is none. Uses AVX2 or SSE2 when available. */
+[[nodiscard]]
+size_t find_first_of(std::string_view str, size_t pos, const char_set& set) noexcept;
+
+/* Byte by byte version of find_first_of. */
+[[nodiscard]]
+size_t find_first_of_scalar(std::string_view str, size_t pos, const char_set& set) noexcept;
+
+}
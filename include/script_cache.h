@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ast.h"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+/* Cache of parsed scripts, stored under $XDG_CACHE_HOME/stush. An entry is
+ * keyed by the script's path, modification time, size and inode, and holds
+ * the parsed program in a form that can be mapped back into memory. The
+ * script's contents are only hashed once an entry's stamp matches. */
+namespace script_cache {
+
+struct script_stamp {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint64_t inode;
+};
+
+/* 64-bit hash that takes 8 bytes at a time */
+[[nodiscard]]
+uint64_t hash_bytes(std::string_view bytes) noexcept;
+
+/* Directory the cache lives in, empty if neither XDG_CACHE_HOME nor HOME
+ * is set. */
+[[nodiscard]]
+std::filesystem::path cache_dir();
+
+/* Path of the cache entry for a script. */
+[[nodiscard]]
+std::filesystem::path entry_path(const std::filesystem::path& script);
+
+/* Maps a cache entry back into a program. Returns nothing if the entry is
+ * missing, corrupt or doesn't match the stamp and source of the script. */
+[[nodiscard]]
+std::optional<ast::program> read(const std::filesystem::path& entry,
+    const std::filesystem::path& script, const script_stamp& stamp, std::string_view source);
+
+/* Stores a parsed program. Failures are ignored, the cache is only an
+ * optimization. */
+void write(const std::filesystem::path& entry, const std::filesystem::path& script,
+    const script_stamp& stamp, uint64_t content_hash, const ast::program& prog) noexcept;
+
+/* Returns the program of a script file, from the cache if possible, parsing
+ * it and refreshing the cache otherwise. Throws parse_error and
+ * std::filesystem::filesystem_error. */
+[[nodiscard]]
+ast::program load(const std::filesystem::path& script, std::string_view delimeter);
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Text of a program. It is either owned or mapped from a file, and is always
+ * followed by a NUL character. */
+class source_text {
+    std::string owned {};
+    char* mapping {nullptr};
+    size_t mapping_size {};
+    char* text {nullptr};
+    size_t text_size {};
+
+    void unmap() noexcept;
+
+public:
+    source_text() = default;
+    explicit source_text(std::string text);
+    ~source_text();
+
+    source_text(source_text&& other) noexcept;
+    source_text& operator=(source_text&& other) noexcept;
+    source_text(const source_text&) = delete;
+    source_text& operator=(const source_text&) = delete;
+
+    /* Maps a file privately into memory, so that the text can be modified
+     * without affecting the file. Throws std::filesystem::filesystem_error. */
+    [[nodiscard]]
+    static source_text map_file(const std::filesystem::path& path);
+
+    /* Takes ownership of a memory mapping, the text being size bytes at
+     * offset inside of it. The byte after the text must be a NUL. */
+    [[nodiscard]]
+    static source_text adopt_mapping(char* mapping, size_t mapping_size, size_t offset, size_t size);
+
+    char* data() noexcept {
+        return mapping ? text : owned.data();
+    }
+
+    const char* data() const noexcept {
+        return mapping ? text : owned.data();
+    }
+
+    size_t size() const noexcept {
+        return text_size;
+    }
+
+    std::string_view view() const noexcept {
+        return {data(), size()};
+    }
+
+    operator std::string_view() const noexcept {
+        return view();
+    }
+};
+
+struct source_location {
+    size_t line;
+    size_t column;
+};
+
+/* Offsets at which the lines of a text begin, to turn positions into
+ * human readable locations. */
+class line_index {
+    std::vector<uint32_t> line_starts {};
+
+public:
+    line_index() = default;
+    explicit line_index(std::string_view text);
+    explicit line_index(std::vector<uint32_t> line_starts);
+
+    /* Returns the 1-based line and column of a position in the text. */
+    [[nodiscard]]
+    source_location locate(size_t position) const;
+
+    size_t lines() const noexcept {
+        return line_starts.size();
+    }
+
+    const std::vector<uint32_t>& starts() const noexcept {
+        return line_starts;
+    }
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/* Hashes strings and string views alike, so maps keyed by std::string can
+ * be searched without building a string first. */
+struct string_hash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view str) const noexcept {
+        return std::hash<std::string_view> {}(str);
+    }
+};
+
+/* Map from strings that can be searched with a string_view. */
+template <typename T>
+using string_map = std::unordered_map<std::string, T, string_hash, std::equal_to<>>;
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <string_view>
+#include <sys/types.h>
+
+/* Tracing of where the shell spends its time, turned on by naming a file in
+ * STUSH_TRACE. Spans are written there as Chrome trace events, which
+ * Perfetto and chrome://tracing can load. Events are buffered and written in
+ * large chunks, copies of the shell append theirs to the same file. */
+namespace trace {
+
+using clock = std::chrono::steady_clock;
+
+/* What a span is about, the parts that aren't set are left out. */
+struct details {
+    pid_t pid {-1};
+    std::string_view command {};
+    std::optional<int> status {};
+};
+
+/* Opens the file named by STUSH_TRACE, if it is set, and writes the rest of
+ * the trace when the shell exits. */
+void init();
+
+bool enabled() noexcept;
+
+/* Records a span that took from start to end. With thread set, it shows on
+ * a track of its own, for the life of a child process. */
+void event(std::string_view name, clock::time_point start, clock::time_point end,
+    const details& args, pid_t thread = -1);
+
+/* Writes out the buffered events. */
+void flush() noexcept;
+
+/* Drops the events a forked copy of the shell inherited, the parent writes
+ * them itself. */
+void reset_after_fork() noexcept;
+
+/* Records a span for the lifetime of the object, if tracing is on. Details
+ * can be filled in while it is open. */
+class span {
+    std::string_view name;
+    clock::time_point start {};
+
+public:
+    details args {};
+
+    explicit span(std::string_view name) : name(name) {
+        if (enabled())
+            start = clock::now();
+    }
+
+    ~span() {
+        if (enabled())
+            event(name, start, clock::now(), args);
+    }
+
+    span(const span&) = delete;
+    span& operator=(const span&) = delete;
+};
+
+}
@@ -1,38 +1,96 @@
 #include "builtins/builtins.h"
 #include "builtins/cd.h"
+#include "builtins/jobs.h"
+#include "builtins/parallel.h"
+#include "builtins/test.h"
 #include "cmd/cmd.h"
+#include "cmd/cmdhash.h"
 #include "cmd/variable.h"
 #include "linereader/terminal.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <iomanip>
 #include <iostream>
 #include <sched.h>
-#include <stdexcept>
 #include <string_view>
-#include <unordered_map>
-
-std::unordered_map<std::string, Command> commands {
-    {"cd", {com_cd, "Change directory"}},
-    {"help", {com_help, "Print help message"}},
-    {"clear", {com_clear, "Clear terminal screen"}},
-    {"exit", {com_exit, "Exit shell with a code"}},
-    {"set", {com_set, "Set a shell variable"}},
-    {"export", {com_export, "Set an environment variable"}},
-    {"unset", {com_unset, "Unset a variable"}},
+
+/* Every builtin, in the order help lists them. */
+static constexpr std::array BUILTINS {
+    Command {"cd", com_cd, "Change directory"},
+    Command {"help", com_help, "Print help message"},
+    Command {"clear", com_clear, "Clear terminal screen"},
+    Command {"exit", com_exit, "Exit shell with a code"},
+    Command {"set", com_set, "Set a shell variable"},
+    Command {"export", com_export, "Set an environment variable"},
+    Command {"unset", com_unset, "Unset a variable"},
+    Command {"hash", com_hash, "Show, add to or reset (-r) the command path cache"},
+    Command {"test", com_test, "Evaluate a conditional expression"},
+    Command {"[", com_test, "Evaluate a conditional expression"},
+    Command {"true", com_true, "Succeed"},
+    Command {"false", com_false, "Fail"},
+    Command {":", com_true, "Do nothing and succeed"},
+    Command {"jobs", com_jobs, "List jobs, or only their process groups (-p)"},
+    Command {"fg", com_fg, "Bring a job to the foreground"},
+    Command {"bg", com_bg, "Continue stopped jobs in the background"},
+    Command {"wait", com_wait, "Wait for jobs to finish"},
+    Command {"parallel", com_parallel, "Run a command for each input, a few at a time"},
+};
+
+/* Builtins are found with a perfect hash: a seed for FNV-1a is searched at
+ * compile time so that every name gets a slot of its own, and a lookup is
+ * one hash and one comparison. */
+static constexpr size_t BUILTIN_SLOTS {64};
+static constexpr uint8_t NO_BUILTIN {UINT8_MAX};
+
+static constexpr uint32_t hash_name(std::string_view name, uint32_t seed) {
+    uint32_t hash {2166136261u ^ seed};
+    for (const char c : name) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+struct builtin_index {
+    uint32_t seed;
+    size_t max_name;
+    std::array<uint8_t, BUILTIN_SLOTS> slots;
 };
 
+static constexpr builtin_index make_index() {
+    static_assert(BUILTINS.size() < BUILTIN_SLOTS);
+    for (uint32_t seed = 0;; seed++) {
+        builtin_index index {seed, 0, {}};
+        index.slots.fill(NO_BUILTIN);
+        bool collides {false};
+        for (size_t i = 0; i < BUILTINS.size() && !collides; i++) {
+            uint8_t& slot {index.slots[hash_name(BUILTINS[i].name, seed) % BUILTIN_SLOTS]};
+            collides = slot != NO_BUILTIN;
+            slot = static_cast<uint8_t>(i);
+            index.max_name = std::max(index.max_name, BUILTINS[i].name.size());
+        }
+        if (!collides)
+            return index;
+    }
+}
+
+static constexpr builtin_index BUILTIN_INDEX {make_index()};
+
 void err_too_many_args(std::string_view command) {
     std::cerr << command << ": too many arguments" << '\n';
 }
 
-int com_help(args_view args) {
-    for (const auto& [k,v] : commands) {
-        std::cout << k << ": " << v.doc << '\n';
+int com_help(args_view) {
+    for (const Command& command : BUILTINS) {
+        std::cout << command.name << ": " << command.doc << '\n';
     }
     return EXIT_SUCCESS;
 }
 
-int com_clear(args_view args) {
+int com_clear(args_view) {
     Terminal term {};
     term.set_cursor_position({1, 1});
     term.clear_to_screen_end();
@@ -49,7 +107,7 @@ int com_exit(args_view args) {
         return EXIT_FAILURE;
     }
 
-    exit(std::stoi(args[1]));
+    exit(std::stoi(std::string(args[1])));
 }
 
 int com_set(args_view args) {
@@ -59,11 +117,11 @@ int com_set(args_view args) {
             return EXIT_SUCCESS;
         }
         case 2: {
-            var::set_var(args[1].c_str(), "");
+            var::set_var(args[1], "");
             return EXIT_SUCCESS;
         }
         case 3: {
-            var::set_var(args[1].c_str(), args[2].c_str());
+            var::set_var(args[1], args[2]);
             return EXIT_SUCCESS;
         }
     }
@@ -72,28 +130,24 @@ int com_set(args_view args) {
 }
 
 int com_export(args_view args) {
-    switch (args.size()) {
-        case 1: {
-            //TODO: print all env vars?
-            return EXIT_SUCCESS;
-        }
-        case 2: {
-            if (setenv(args[1].c_str(), "", 1) == -1) {
-                perror("setenv");
-                return EXIT_FAILURE;
-            }
-            return EXIT_SUCCESS;
-        }
-        case 3: {
-            if (setenv(args[1].c_str(), args[2].c_str(), 1) == -1) {
-                perror("setenv");
-                return EXIT_FAILURE;
-            }
-            return EXIT_SUCCESS;
-        }
+    if (args.size() == 1) {
+        //TODO: print all env vars?
+        return EXIT_SUCCESS;
     }
-    err_too_many_args(args[0]);
-    return EXIT_FAILURE;
+    if (args.size() > 3) {
+        err_too_many_args(args[0]);
+        return EXIT_FAILURE;
+    }
+    if (args[1].empty() || args[1].find('=') != std::string_view::npos) {
+        std::cerr << "stush: export: " << args[1] << ": not a valid identifier\n";
+        return EXIT_FAILURE;
+    }
+
+    // a variable exported without a value keeps the one it has
+    if (args.size() == 3)
+        var::set_var(args[1], args[2]);
+    var::export_var(args[1]);
+    return EXIT_SUCCESS;
 }
 
 int com_unset(args_view args) {
@@ -107,24 +161,62 @@ int com_unset(args_view args) {
         return EXIT_FAILURE;
     }
 
-    if (var::is_set(args[1])) {
-        var::unset(args[1]);
+    var::unset(args[1]);
+    return EXIT_SUCCESS;
+}
+
+int com_hash(args_view args) {
+    if (args.size() == 1) {
+        if (cmdhash::entries().empty()) {
+            std::cout << "hash: hash table empty\n";
+            return EXIT_SUCCESS;
+        }
+        std::cout << "hits\tcommand\tpath\n";
+        for (const auto& [name, entry] : cmdhash::entries()) {
+            std::cout << std::setw(4) << entry.hits << '\t' << name << '\t' << entry.path << '\n';
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (args[1] == "-r") {
+        if (args.size() > 2) {
+            err_too_many_args(args[0]);
+            return EXIT_FAILURE;
+        }
+        cmdhash::clear();
         return EXIT_SUCCESS;
     }
 
-    if (unsetenv(args[1].c_str()) == -1) {
-        perror("unsetenv");
-        return EXIT_FAILURE;
+    int status {EXIT_SUCCESS};
+    for (const auto& name : args.subspan(1)) {
+        if (is_builtin(name))
+            continue;
+        cmdhash::forget(name);
+        if (cmdhash::resolve(name).empty()) {
+            std::cerr << "hash: " << name << ": not found\n";
+            status = EXIT_FAILURE;
+        }
     }
-    return EXIT_SUCCESS;
+    return status;
+}
+
+const Command* find_builtin(std::string_view name) noexcept {
+    // paths and most commands are longer than any builtin
+    if (name.size() > BUILTIN_INDEX.max_name)
+        return nullptr;
+    const uint8_t slot {BUILTIN_INDEX.slots[hash_name(name, BUILTIN_INDEX.seed) % BUILTIN_SLOTS]};
+    if (slot == NO_BUILTIN || BUILTINS[slot].name != name)
+        return nullptr;
+    return &BUILTINS[slot];
+}
+
+bool is_builtin(std::string_view name) {
+    return find_builtin(name) != nullptr;
 }
 
 int exec_builtin(args_view args) {
-    cmd_function_t builtin {};
-    try {
-        builtin = commands.at(args[0]).function;
-    } catch (const std::out_of_range& e) {
+    const Command* builtin {find_builtin(args[0])};
+    if (!builtin)
         return BUILTIN_NOT_FOUND;
-    }
-    return builtin(args);
+    return builtin->function(args);
 }
@@ -1,6 +1,7 @@
 #include "builtins/builtins.h"
 #include "cmd/cmd.h"
 #include "builtins/cd.h"
+#include "cmd/variable.h"
 #include <iostream>
 #include <unistd.h>
 #include <wait.h>
@@ -19,9 +20,9 @@ int try_cd(const fs::path& path) {
 
 int com_cd(args_view args) {
     if (args.size() == 1) {
-        char* home = getenv("HOME");
-        if (home && fs::is_directory(home)) {
-            return try_cd(home);
+        const auto home {var::find("HOME")};
+        if (home && fs::is_directory(*home)) {
+            return try_cd(*home);
         } else {
             std::cerr << "Couldn't locate HOME\n";
             return LOCATION_NOT_FOUND;
@@ -0,0 +1,153 @@
+#include "builtins/builtins.h"
+#include "builtins/jobs.h"
+#include "cmd/jobs.h"
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+/* Finds the job named by spec, or the current one if spec is empty,
+ * reporting a missing one for command. */
+static jobs::job* find_job(std::string_view command, std::string_view spec) {
+    jobs::job* job {spec.empty() ? jobs::current() : jobs::find(spec)};
+    if (!job)
+        std::cerr << "stush: " << command << ": " << (spec.empty() ? "current" : spec) << ": no such job\n";
+    return job;
+}
+
+static bool require_job_control(std::string_view command) {
+    if (jobs::job_control())
+        return true;
+    std::cerr << "stush: " << command << ": no job control\n";
+    return false;
+}
+
+int com_jobs(args_view args) {
+    jobs::update();
+    bool pids_only {false};
+    auto names {args.subspan(1)};
+    if (!names.empty() && names[0] == "-p") {
+        pids_only = true;
+        names = names.subspan(1);
+    }
+
+    const auto show {[&](const jobs::job& job) {
+        if (pids_only)
+            std::cout << job.pgid << '\n';
+        else
+            std::cout << jobs::describe(job) << '\n';
+    }};
+    if (names.empty()) {
+        for (const auto& job : jobs::table()) {
+            show(job);
+        }
+        // finished jobs are reported by being listed
+        std::cout.flush();
+        jobs::notify();
+        return EXIT_SUCCESS;
+    }
+
+    int status {EXIT_SUCCESS};
+    for (const auto& name : names) {
+        if (const auto* job {find_job(args[0], name)})
+            show(*job);
+        else
+            status = EXIT_FAILURE;
+    }
+    return status;
+}
+
+int com_fg(args_view args) {
+    if (!require_job_control(args[0]))
+        return EXIT_FAILURE;
+    if (args.size() > 2) {
+        err_too_many_args(args[0]);
+        return EXIT_FAILURE;
+    }
+    jobs::update();
+    jobs::job* job {find_job(args[0], args.size() == 2 ? args[1] : "")};
+    if (!job)
+        return EXIT_FAILURE;
+    std::cout << job->command << std::endl;
+    return jobs::resume(*job, true);
+}
+
+int com_bg(args_view args) {
+    if (!require_job_control(args[0]))
+        return EXIT_FAILURE;
+    jobs::update();
+    const auto resume {[&](jobs::job* job) {
+        if (!job)
+            return EXIT_FAILURE;
+        if (job->state == jobs::job_state::STOPPED) {
+            jobs::resume(*job, false);
+            std::cout << '[' << job->id << "] " << job->command << " &\n";
+        }
+        return EXIT_SUCCESS;
+    }};
+    if (args.size() == 1)
+        return resume(find_job(args[0], ""));
+
+    int status {EXIT_SUCCESS};
+    for (const auto& name : args.subspan(1)) {
+        if (resume(find_job(args[0], name)) != EXIT_SUCCESS)
+            status = EXIT_FAILURE;
+    }
+    return status;
+}
+
+/* wait -n, for the first of the jobs named to finish. */
+static int wait_next(args_view names) {
+    std::vector<int> ids {};
+    for (const auto& name : names) {
+        const jobs::job* job {jobs::find(name)};
+        if (!job) {
+            std::cerr << "stush: wait: " << name << ": no such job\n";
+            return WAIT_NOT_A_CHILD;
+        }
+        ids.push_back(job->id);
+    }
+    jobs::job* job {jobs::wait_next(ids)};
+    if (!job)
+        return WAIT_NOT_A_CHILD;
+    const int status {job->status};
+    jobs::remove(*job);
+    return status;
+}
+
+int com_wait(args_view args) {
+    if (args.size() > 1 && args[1] == "-n")
+        return wait_next(args.subspan(2));
+    if (args.size() == 1) {
+        // stopped jobs would never finish, so they are left alone
+        std::vector<int> ids {};
+        for (const auto& job : jobs::table()) {
+            if (job.state != jobs::job_state::STOPPED)
+                ids.push_back(job.id);
+        }
+        for (const int id : ids) {
+            jobs::job* job {jobs::find(id)};
+            jobs::wait(*job);
+            jobs::remove(*job);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    int status {EXIT_SUCCESS};
+    for (const auto& name : args.subspan(1)) {
+        jobs::job* job {jobs::find(name)};
+        if (!job) {
+            if (name.starts_with('%')) {
+                std::cerr << "stush: wait: " << name << ": no such job\n";
+                status = EXIT_FAILURE;
+            } else {
+                std::cerr << "stush: wait: pid " << name << " is not a child of this shell\n";
+                status = WAIT_NOT_A_CHILD;
+            }
+            continue;
+        }
+        status = jobs::wait(*job);
+        jobs::remove(*job);
+    }
+    return status;
+}
@@ -0,0 +1,329 @@
+#include "builtins/builtins.h"
+#include "builtins/parallel.h"
+#include "cmd/reaper.h"
+#include "cmd/spawn.h"
+#include "cmd/vm.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+struct options {
+    size_t jobs;
+    bool keep_order;
+    bool report;
+    args_view command;
+    args_view inputs;
+};
+
+/* A run of the command for one of the inputs. */
+struct task {
+    std::vector<std::string> args;
+    pid_t pid {-1};
+    int status {};
+    reaper::clock::duration elapsed {};
+    bool exited {};
+    /* With -k, read end of the pipe the output comes through, -1 once it
+     * is closed or if the task writes to standard output itself */
+    int output_fd {-1};
+    std::string output {};
+};
+
+/* Runs the tasks in the order of their inputs, starting the next one from
+ * the queue whenever the reaper reports one as done. */
+class task_runner {
+    const options& opts;
+    std::vector<task> tasks {};
+    /* First task that hasn't been started */
+    size_t next_start {};
+    /* With -k, first task whose output hasn't been written completely */
+    size_t next_output {};
+    std::vector<pid_t> running {};
+
+    void start(size_t i);
+    void record(const reaper::child_exit& child);
+    void wait_for_exit();
+    void wait_for_output();
+    void write_output();
+    bool has_output() const;
+
+public:
+    explicit task_runner(const options& opts);
+    int run();
+    void report() const;
+};
+
+}
+
+static const std::string_view SEPARATOR {":::"};
+static const std::string_view PLACEHOLDER {"{}"};
+static const size_t READ_SIZE {64 * 1024};
+
+static void usage() {
+    std::cerr << "stush: parallel: usage: parallel [-j jobs] [-k] [-r] command [args...] ::: inputs...\n";
+}
+
+static std::optional<options> parse_options(args_view args) {
+    options opts {
+        .jobs = std::max(std::thread::hardware_concurrency(), 1u),
+        .keep_order = false,
+        .report = false,
+        .command = {},
+        .inputs = {},
+    };
+    size_t i {1};
+    for (; i < args.size() && args[i].starts_with('-'); i++) {
+        const std::string_view arg {args[i]};
+        if (arg == "--") {
+            i++;
+            break;
+        }
+        if (arg == "-k") {
+            opts.keep_order = true;
+        } else if (arg == "-r") {
+            opts.report = true;
+        } else if (arg.starts_with("-j")) {
+            std::string_view value {arg.substr(2)};
+            if (value.empty() && i + 1 < args.size())
+                value = args[++i];
+            const auto [end, err] {std::from_chars(value.data(), value.data() + value.size(), opts.jobs)};
+            if (err != std::errc {} || end != value.data() + value.size() || opts.jobs == 0) {
+                std::cerr << "stush: parallel: " << value << ": invalid number of jobs\n";
+                return std::nullopt;
+            }
+        } else {
+            std::cerr << "stush: parallel: " << arg << ": invalid option\n";
+            usage();
+            return std::nullopt;
+        }
+    }
+
+    const auto separator {std::find(args.begin() + i, args.end(), SEPARATOR)};
+    if (separator == args.end() || separator == args.begin() + i) {
+        usage();
+        return std::nullopt;
+    }
+    opts.command = args.subspan(i, separator - args.begin() - i);
+    opts.inputs = args.subspan(separator - args.begin() + 1);
+    return opts;
+}
+
+/* Arguments of the command for one input, which replaces every {} or comes
+ * last. */
+static std::vector<std::string> task_args(args_view command, std::string_view input) {
+    std::vector<std::string> args {};
+    args.reserve(command.size() + 1);
+    bool replaced {false};
+    for (const std::string_view arg : command) {
+        std::string& out {args.emplace_back()};
+        size_t pos {};
+        for (size_t found; (found = arg.find(PLACEHOLDER, pos)) != std::string_view::npos;) {
+            out.append(arg.substr(pos, found - pos));
+            out.append(input);
+            pos = found + PLACEHOLDER.size();
+            replaced = true;
+        }
+        out.append(arg.substr(pos));
+    }
+    if (!replaced)
+        args.emplace_back(input);
+    return args;
+}
+
+task_runner::task_runner(const options& opts) : opts(opts) {
+    tasks.reserve(opts.inputs.size());
+    for (const std::string_view input : opts.inputs) {
+        tasks.push_back({.args = task_args(opts.command, input)});
+    }
+}
+
+void task_runner::start(size_t i) {
+    task& t {tasks[i]};
+    const std::vector<std::string_view> argv (t.args.begin(), t.args.end());
+    const args_view args {argv};
+
+    // The task whose output is due writes it directly
+    std::array<int, 2> out {-1, -1};
+    spawn_fds fds {};
+    if (opts.keep_order && i != next_output) {
+        if (pipe2(out.data(), O_CLOEXEC) == -1)
+            perror("stush: parallel");
+        else
+            fds = {.out = out[1], .close_fds = out};
+    }
+
+    // Builtins and functions have to run in a copy of the shell
+    if (vm::find_function(args[0]) || is_builtin(args[0]))
+        t.pid = spawn_subshell(fds, [&] { return run_simple_command(args); });
+    else
+        t.pid = spawn_command(args, fds, t.status);
+    if (out[1] != -1)
+        close(out[1]);
+
+    if (t.pid == -1) {
+        if (t.status == EXIT_SUCCESS)
+            t.status = EXIT_FAILURE;
+        t.exited = true;
+        if (out[0] != -1)
+            close(out[0]);
+        return;
+    }
+    t.output_fd = out[0];
+    running.push_back(t.pid);
+}
+
+void task_runner::record(const reaper::child_exit& child) {
+    // stopped tasks are still running
+    if (WIFSTOPPED(child.status))
+        return;
+    const auto it {std::ranges::find(tasks, child.pid, &task::pid)};
+    if (it == tasks.end())
+        return;
+    it->status = reaper::exit_status(child.status);
+    it->elapsed = child.elapsed;
+    it->exited = true;
+    std::erase(running, child.pid);
+}
+
+void task_runner::wait_for_exit() {
+    if (const auto child {reaper::wait_any(running)}) {
+        record(*child);
+        return;
+    }
+    // somebody else has reaped them
+    for (const pid_t pid : running) {
+        task& t {*std::ranges::find(tasks, pid, &task::pid)};
+        t.status = EXIT_FAILURE;
+        t.exited = true;
+    }
+    running.clear();
+}
+
+bool task_runner::has_output() const {
+    return std::ranges::any_of(tasks, [](const task& t) { return t.output_fd != -1; });
+}
+
+/* Reads whatever output is there until some arrives or a task exits, as
+ * tasks block once their pipe is full. */
+void task_runner::wait_for_output() {
+    std::vector<pollfd> fds {};
+    std::vector<task*> readers {};
+    for (task& t : tasks) {
+        if (t.output_fd == -1)
+            continue;
+        fds.push_back({t.output_fd, POLLIN, 0});
+        readers.push_back(&t);
+    }
+    const int reaper_fd {running.empty() ? -1 : reaper::fd()};
+    if (reaper_fd != -1)
+        fds.push_back({reaper_fd, POLLIN, 0});
+    // Without the reaper's descriptor, exits are looked for every now and then
+    const int timeout {!running.empty() && reaper_fd == -1 ? 10 : -1};
+    if (poll(fds.data(), fds.size(), timeout) == -1 && errno != EINTR) {
+        perror("stush: parallel");
+        return;
+    }
+
+    std::string buffer (READ_SIZE, '\0');
+    for (size_t i = 0; i < readers.size(); i++) {
+        if (!fds[i].revents)
+            continue;
+        task& t {*readers[i]};
+        const ssize_t count {read(t.output_fd, buffer.data(), buffer.size())};
+        if (count > 0) {
+            t.output.append(buffer.data(), count);
+        } else if (count == 0 || errno != EINTR) {
+            close(t.output_fd);
+            t.output_fd = -1;
+        }
+    }
+
+    if (running.empty())
+        return;
+    reaper::poll();
+    while (const auto child {reaper::wait_any(running, reaper::clock::now())}) {
+        record(*child);
+    }
+}
+
+/* Writes the output of tasks in order, up to the first one that isn't
+ * done. */
+void task_runner::write_output() {
+    bool written {false};
+    for (; next_output < tasks.size(); next_output++) {
+        task& t {tasks[next_output]};
+        if (!t.output.empty()) {
+            std::cout << t.output;
+            t.output.clear();
+            t.output.shrink_to_fit();
+            written = true;
+        }
+        if (!t.exited || t.output_fd != -1)
+            break;
+    }
+    if (written)
+        std::cout.flush();
+}
+
+int task_runner::run() {
+    while (next_start < tasks.size() || !running.empty() || has_output()) {
+        while (running.size() < opts.jobs && next_start < tasks.size()) {
+            start(next_start++);
+        }
+        if (opts.keep_order) {
+            write_output();
+            wait_for_output();
+            write_output();
+        } else if (!running.empty()) {
+            wait_for_exit();
+        }
+    }
+
+    const auto failed {std::ranges::count_if(tasks, [](const task& t) { return t.status != EXIT_SUCCESS; })};
+    return static_cast<int>(std::min<long>(failed, PARALLEL_MAX_FAILED));
+}
+
+void task_runner::report() const {
+    std::ostringstream out {};
+    out << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < tasks.size(); i++) {
+        const task& t {tasks[i]};
+        out << i + 1 << '\t' << t.status << '\t'
+            << std::chrono::duration<double> {t.elapsed}.count() << '\t';
+        for (size_t j = 0; j < t.args.size(); j++) {
+            out << (j > 0 ? " " : "") << t.args[j];
+        }
+        out << '\n';
+    }
+    std::cerr << out.str();
+}
+
+int com_parallel(args_view args) {
+    const auto opts {parse_options(args)};
+    if (!opts)
+        return PARALLEL_ERROR;
+
+    std::cout.flush();
+    task_runner runner {*opts};
+    const int status {runner.run()};
+    if (opts->report)
+        runner.report();
+    return status;
+}
@@ -0,0 +1,137 @@
+#include "builtins/test.h"
+#include <charconv>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void err_test(std::string_view what) {
+    std::cerr << "test: " << what << '\n';
+}
+
+static std::optional<long long> to_integer(std::string_view str) {
+    long long value {};
+    const auto [end, err] {std::from_chars(str.data(), str.data() + str.size(), value)};
+    if (err != std::errc {} || end != str.data() + str.size()) {
+        err_test(std::string(str) + ": integer expression expected");
+        return std::nullopt;
+    }
+    return value;
+}
+
+static bool is_unary_operator(std::string_view op) {
+    return op.size() == 2 && op[0] == '-' && std::string_view {"bcdefhLnrsSwxz"}.find(op[1]) != std::string_view::npos;
+}
+
+static bool is_binary_operator(std::string_view op) {
+    return op == "=" || op == "==" || op == "!=" || op == "-eq" || op == "-ne" ||
+        op == "-lt" || op == "-le" || op == "-gt" || op == "-ge";
+}
+
+static int unary(std::string_view op, std::string_view arg) {
+    if (op == "-n")
+        return !arg.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (op == "-z")
+        return arg.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // arguments are NUL-terminated
+    const char* path {arg.data()};
+    struct stat st;
+    const bool found {(op == "-h" || op == "-L" ? lstat(path, &st) : stat(path, &st)) == 0};
+    bool result {};
+    switch (op[1]) {
+        case 'b': result = found && S_ISBLK(st.st_mode); break;
+        case 'c': result = found && S_ISCHR(st.st_mode); break;
+        case 'd': result = found && S_ISDIR(st.st_mode); break;
+        case 'e': result = found; break;
+        case 'f': result = found && S_ISREG(st.st_mode); break;
+        case 'h':
+        case 'L': result = found && S_ISLNK(st.st_mode); break;
+        case 'r': result = access(path, R_OK) == 0; break;
+        case 's': result = found && st.st_size > 0; break;
+        case 'S': result = found && S_ISSOCK(st.st_mode); break;
+        case 'w': result = access(path, W_OK) == 0; break;
+        case 'x': result = access(path, X_OK) == 0; break;
+    }
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int binary(std::string_view lhs, std::string_view op, std::string_view rhs) {
+    if (op == "=" || op == "==")
+        return lhs == rhs ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (op == "!=")
+        return lhs != rhs ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    const auto a {to_integer(lhs)};
+    const auto b {to_integer(rhs)};
+    if (!a || !b)
+        return TEST_ERROR;
+    bool result {};
+    if (op == "-eq") result = *a == *b;
+    else if (op == "-ne") result = *a != *b;
+    else if (op == "-lt") result = *a < *b;
+    else if (op == "-le") result = *a <= *b;
+    else if (op == "-gt") result = *a > *b;
+    else if (op == "-ge") result = *a >= *b;
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int negate(int status) {
+    return status == TEST_ERROR ? status : !status;
+}
+
+/* Evaluates expressions by their number of arguments. */
+static int evaluate(args_view args) {
+    switch (args.size()) {
+        case 0:
+            return EXIT_FAILURE;
+        case 1:
+            return args[0].empty() ? EXIT_FAILURE : EXIT_SUCCESS;
+        case 2: {
+            if (args[0] == "!")
+                return negate(evaluate(args.subspan(1)));
+            if (is_unary_operator(args[0]))
+                return unary(args[0], args[1]);
+            break;
+        }
+        case 3: {
+            if (is_binary_operator(args[1]))
+                return binary(args[0], args[1], args[2]);
+            if (args[0] == "!")
+                return negate(evaluate(args.subspan(1)));
+            if (args[0] == "(" && args[2] == ")")
+                return evaluate(args.subspan(1, 1));
+            break;
+        }
+        case 4: {
+            if (args[0] == "!")
+                return negate(evaluate(args.subspan(1)));
+            if (args[0] == "(" && args[3] == ")")
+                return evaluate(args.subspan(1, 2));
+            break;
+        }
+    }
+    err_test("unsupported expression");
+    return TEST_ERROR;
+}
+
+int com_test(args_view args) {
+    if (args[0] == "[") {
+        if (args.back() != "]") {
+            err_test("missing ']'");
+            return TEST_ERROR;
+        }
+        args = args.first(args.size() - 1);
+    }
+    return evaluate(args.subspan(1));
+}
+
+int com_true(args_view) {
+    return EXIT_SUCCESS;
+}
+
+int com_false(args_view) {
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,565 @@
+#include "cmd/arith.h"
+#include "cmd/expansion.h"
+#include "cmd/variable.h"
+#include "stringhash.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Compiled expressions are dropped all at once when there are more than this */
+static const size_t MAX_EXPRESSIONS {256};
+
+namespace {
+
+enum class opcode : uint8_t {
+    PUSH,
+    LOAD,
+    /* Assigns the value on top of the stack, leaving it there */
+    STORE,
+    POP,
+    DUP,
+    NEG,
+    NOT,
+    BIT_NOT,
+    POW,
+    MUL,
+    DIV,
+    MOD,
+    ADD,
+    SUB,
+    SHL,
+    SHR,
+    LT,
+    LE,
+    GT,
+    GE,
+    EQ,
+    NE,
+    BIT_AND,
+    BIT_XOR,
+    BIT_OR,
+    JUMP,
+    /* Pop the condition */
+    JUMP_IF_ZERO,
+    JUMP_IF_NOT_ZERO,
+};
+
+/* The operand is a number for PUSH, an index into names for LOAD and STORE
+ * and an address for jumps. */
+struct instruction {
+    opcode op;
+    int64_t operand;
+};
+
+struct expression {
+    std::vector<instruction> code {};
+    std::vector<std::string> names {};
+};
+
+enum class token_kind : uint8_t {
+    NUMBER,
+    NAME,
+    OPERATOR,
+    END,
+};
+
+struct token {
+    token_kind kind;
+    std::string_view text;
+    int64_t value {};
+};
+
+struct binary_operator {
+    std::string_view text;
+    int precedence;
+    opcode op;
+};
+
+/* Longer operators come first, so that the lexer takes the longest match */
+constexpr std::array<std::string_view, 39> OPERATORS {
+    "<<=", ">>=",
+    "**", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+    "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=",
+    "+", "-", "*", "/", "%", "<", ">", "&", "|", "^", "!", "~", "?", ":", "=", ",", "(", ")",
+};
+
+/* && and || are compiled to jumps, their opcodes are unused */
+constexpr std::array<binary_operator, 19> BINARY_OPERATORS {{
+    {"||", 1, opcode::BIT_OR},
+    {"&&", 2, opcode::BIT_AND},
+    {"|", 3, opcode::BIT_OR},
+    {"^", 4, opcode::BIT_XOR},
+    {"&", 5, opcode::BIT_AND},
+    {"==", 6, opcode::EQ},
+    {"!=", 6, opcode::NE},
+    {"<", 7, opcode::LT},
+    {"<=", 7, opcode::LE},
+    {">", 7, opcode::GT},
+    {">=", 7, opcode::GE},
+    {"<<", 8, opcode::SHL},
+    {">>", 8, opcode::SHR},
+    {"+", 9, opcode::ADD},
+    {"-", 9, opcode::SUB},
+    {"*", 10, opcode::MUL},
+    {"/", 10, opcode::DIV},
+    {"%", 10, opcode::MOD},
+    {"**", 11, opcode::POW},
+}};
+constexpr int POW_PRECEDENCE {11};
+
+const binary_operator* find_binary(std::string_view text) {
+    const auto it {std::ranges::find(BINARY_OPERATORS, text, &binary_operator::text)};
+    return it == BINARY_OPERATORS.end() ? nullptr : &*it;
+}
+
+/* Single pass compiler of an expression to code. */
+class compiler {
+    std::string_view source;
+    std::vector<token> tokens {};
+    size_t pos {};
+    expression result {};
+
+    [[noreturn]]
+    void syntax_error() const {
+        throw expansion_error(std::string {source} + ": syntax error in expression");
+    }
+
+    void tokenize();
+
+    const token& peek(size_t offset = 0) const {
+        return tokens[std::min(pos + offset, tokens.size() - 1)];
+    }
+
+    bool at(std::string_view op, size_t offset = 0) const {
+        const token& tok {peek(offset)};
+        return tok.kind == token_kind::OPERATOR && tok.text == op;
+    }
+
+    void expect(std::string_view op) {
+        if (!at(op))
+            syntax_error();
+        pos++;
+    }
+
+    size_t emit(opcode op, int64_t operand = 0) {
+        result.code.push_back({op, operand});
+        return result.code.size() - 1;
+    }
+
+    void patch(size_t jump) {
+        result.code[jump].operand = static_cast<int64_t>(result.code.size());
+    }
+
+    int64_t name_index(std::string_view name);
+
+    bool at_assignment() const;
+    void parse_comma();
+    void parse_assignment();
+    void parse_conditional();
+    void parse_binary(int min_precedence);
+    void parse_unary();
+    void parse_postfix();
+    void parse_primary();
+
+public:
+    explicit compiler(std::string_view source) : source(source) {}
+
+    expression compile();
+};
+
+}
+
+/* Parses a number in C syntax: decimal, octal with a leading 0 or
+ * hexadecimal with a leading 0x. */
+static bool parse_number(std::string_view text, int64_t& value) {
+    int base {10};
+    if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        base = 16;
+        text.remove_prefix(2);
+    } else if (text.size() > 1 && text[0] == '0') {
+        base = 8;
+        text.remove_prefix(1);
+    }
+    uint64_t magnitude {};
+    const auto [end, err] {std::from_chars(text.data(), text.data() + text.size(), magnitude, base)};
+    value = static_cast<int64_t>(magnitude);
+    return !text.empty() && err == std::errc {} && end == text.data() + text.size();
+}
+
+void compiler::tokenize() {
+    size_t i {};
+    while (true) {
+        while (i < source.size() && std::isspace(static_cast<unsigned char>(source[i])))
+            i++;
+        if (i == source.size())
+            break;
+
+        const auto c {static_cast<unsigned char>(source[i])};
+        if (std::isalnum(c) || c == '_') {
+            const auto end {std::find_if_not(source.begin() + i, source.end(), [](unsigned char c) {
+                return std::isalnum(c) || c == '_';
+            })};
+            const std::string_view text {source.substr(i, end - source.begin() - i)};
+            i += text.size();
+            if (std::isdigit(c)) {
+                int64_t value {};
+                if (!parse_number(text, value))
+                    syntax_error();
+                tokens.push_back({token_kind::NUMBER, text, value});
+            } else {
+                tokens.push_back({token_kind::NAME, text});
+            }
+            continue;
+        }
+
+        const auto op {std::ranges::find_if(OPERATORS, [&](std::string_view op) {
+            return source.substr(i).starts_with(op);
+        })};
+        if (op == OPERATORS.end())
+            syntax_error();
+        tokens.push_back({token_kind::OPERATOR, *op});
+        i += op->size();
+    }
+    tokens.push_back({token_kind::END, {}});
+}
+
+int64_t compiler::name_index(std::string_view name) {
+    const auto it {std::ranges::find(result.names, name)};
+    if (it != result.names.end())
+        return it - result.names.begin();
+    result.names.emplace_back(name);
+    return static_cast<int64_t>(result.names.size() - 1);
+}
+
+expression compiler::compile() {
+    tokenize();
+    if (peek().kind == token_kind::END) {
+        // an empty expression is 0
+        emit(opcode::PUSH, 0);
+        return std::move(result);
+    }
+    parse_comma();
+    if (peek().kind != token_kind::END)
+        syntax_error();
+    return std::move(result);
+}
+
+void compiler::parse_comma() {
+    parse_assignment();
+    while (at(",")) {
+        pos++;
+        emit(opcode::POP);
+        parse_assignment();
+    }
+}
+
+bool compiler::at_assignment() const {
+    if (peek().kind != token_kind::NAME || peek(1).kind != token_kind::OPERATOR)
+        return false;
+    const std::string_view op {peek(1).text};
+    return op.ends_with('=') && op != "==" && op != "!=" && op != "<=" && op != ">=";
+}
+
+void compiler::parse_assignment() {
+    if (!at_assignment()) {
+        parse_conditional();
+        return;
+    }
+
+    const int64_t name {name_index(peek().text)};
+    const std::string_view op {peek(1).text};
+    pos += 2;
+    if (op == "=") {
+        parse_assignment();
+    } else {
+        const binary_operator* binary {find_binary(op.substr(0, op.size() - 1))};
+        emit(opcode::LOAD, name);
+        parse_assignment();
+        emit(binary->op);
+    }
+    emit(opcode::STORE, name);
+}
+
+void compiler::parse_conditional() {
+    parse_binary(1);
+    if (!at("?"))
+        return;
+    pos++;
+    const size_t to_else {emit(opcode::JUMP_IF_ZERO)};
+    parse_assignment();
+    expect(":");
+    const size_t to_end {emit(opcode::JUMP)};
+    patch(to_else);
+    parse_conditional();
+    patch(to_end);
+}
+
+void compiler::parse_binary(int min_precedence) {
+    parse_unary();
+    while (peek().kind == token_kind::OPERATOR) {
+        const binary_operator* binary {find_binary(peek().text)};
+        if (!binary || binary->precedence < min_precedence)
+            return;
+        pos++;
+
+        const bool is_and {binary->text == "&&"};
+        if (is_and || binary->text == "||") {
+            // Both operands are turned into 0 or 1, the right one is only
+            // evaluated if the left one doesn't decide the result
+            const opcode skip {is_and ? opcode::JUMP_IF_ZERO : opcode::JUMP_IF_NOT_ZERO};
+            const size_t left_decides {emit(skip)};
+            parse_binary(binary->precedence + 1);
+            const size_t right_decides {emit(skip)};
+            emit(opcode::PUSH, is_and ? 1 : 0);
+            const size_t to_end {emit(opcode::JUMP)};
+            patch(left_decides);
+            patch(right_decides);
+            emit(opcode::PUSH, is_and ? 0 : 1);
+            patch(to_end);
+            continue;
+        }
+
+        // ** groups to the right, everything else to the left
+        parse_binary(binary->precedence == POW_PRECEDENCE ? binary->precedence : binary->precedence + 1);
+        emit(binary->op);
+    }
+}
+
+void compiler::parse_unary() {
+    if (at("++") || at("--")) {
+        const bool increment {at("++")};
+        pos++;
+        if (peek().kind != token_kind::NAME)
+            syntax_error();
+        const int64_t name {name_index(peek().text)};
+        pos++;
+        emit(opcode::LOAD, name);
+        emit(opcode::PUSH, 1);
+        emit(increment ? opcode::ADD : opcode::SUB);
+        emit(opcode::STORE, name);
+        return;
+    }
+    if (at("+")) {
+        pos++;
+        parse_unary();
+        return;
+    }
+    for (const auto& [text, op] : {std::pair {"-", opcode::NEG}, {"!", opcode::NOT}, {"~", opcode::BIT_NOT}}) {
+        if (at(text)) {
+            pos++;
+            parse_unary();
+            emit(op);
+            return;
+        }
+    }
+    parse_postfix();
+}
+
+void compiler::parse_postfix() {
+    if (peek().kind != token_kind::NAME || !(at("++", 1) || at("--", 1))) {
+        parse_primary();
+        return;
+    }
+    // the old value stays on the stack
+    const int64_t name {name_index(peek().text)};
+    const bool increment {at("++", 1)};
+    pos += 2;
+    emit(opcode::LOAD, name);
+    emit(opcode::DUP);
+    emit(opcode::PUSH, 1);
+    emit(increment ? opcode::ADD : opcode::SUB);
+    emit(opcode::STORE, name);
+    emit(opcode::POP);
+}
+
+void compiler::parse_primary() {
+    const token& tok {peek()};
+    switch (tok.kind) {
+        case token_kind::NUMBER: {
+            pos++;
+            emit(opcode::PUSH, tok.value);
+            return;
+        }
+        case token_kind::NAME: {
+            pos++;
+            emit(opcode::LOAD, name_index(tok.text));
+            return;
+        }
+        case token_kind::OPERATOR: {
+            if (tok.text != "(")
+                break;
+            pos++;
+            parse_comma();
+            expect(")");
+            return;
+        }
+        case token_kind::END: {
+            break;
+        }
+    }
+    syntax_error();
+}
+
+static string_map<expression> expressions {};
+
+static const expression& compiled(std::string_view source) {
+    if (const auto it {expressions.find(source)}; it != expressions.end())
+        return it->second;
+    expression expr {compiler {source}.compile()};
+    if (expressions.size() == MAX_EXPRESSIONS)
+        expressions.clear();
+    return expressions.emplace(source, std::move(expr)).first->second;
+}
+
+/* Variables are read as numbers, unset and empty ones are 0. */
+static int64_t load(const std::string& name) {
+    std::string_view text {var::find(name).value_or("")};
+
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front())))
+        text.remove_prefix(1);
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back())))
+        text.remove_suffix(1);
+    if (text.empty())
+        return 0;
+
+    const bool negative {text.front() == '-'};
+    if (negative || text.front() == '+')
+        text.remove_prefix(1);
+    int64_t value {};
+    if (!parse_number(text, value))
+        throw expansion_error(name + ": value is not a number");
+    return negative ? static_cast<int64_t>(0 - static_cast<uint64_t>(value)) : value;
+}
+
+static void store(const std::string& name, int64_t value) {
+    std::array<char, 24> digits;
+    const auto end {std::to_chars(digits.begin(), digits.end(), value).ptr};
+    var::set_var(name, {digits.begin(), end});
+}
+
+static int64_t power(int64_t base, int64_t exponent) {
+    uint64_t result {1};
+    auto factor {static_cast<uint64_t>(base)};
+    for (auto e {static_cast<uint64_t>(exponent)}; e > 0; e >>= 1) {
+        if (e & 1)
+            result *= factor;
+        factor *= factor;
+    }
+    return static_cast<int64_t>(result);
+}
+
+/* Applies a binary operator. Everything wraps around instead of
+ * overflowing. */
+static int64_t apply(opcode op, int64_t a, int64_t b, std::string_view source) {
+    const auto ua {static_cast<uint64_t>(a)};
+    const auto ub {static_cast<uint64_t>(b)};
+    switch (op) {
+        case opcode::POW: {
+            if (b < 0)
+                throw expansion_error(std::string {source} + ": exponent less than 0");
+            return power(a, b);
+        }
+        case opcode::MUL: return static_cast<int64_t>(ua * ub);
+        case opcode::DIV:
+        case opcode::MOD: {
+            if (b == 0)
+                throw expansion_error(std::string {source} + ": division by 0");
+            if (b == -1)
+                return op == opcode::DIV ? static_cast<int64_t>(0 - ua) : 0;
+            return op == opcode::DIV ? a / b : a % b;
+        }
+        case opcode::ADD: return static_cast<int64_t>(ua + ub);
+        case opcode::SUB: return static_cast<int64_t>(ua - ub);
+        case opcode::SHL: return static_cast<int64_t>(ua << (ub & 63));
+        case opcode::SHR: return a >> (ub & 63);
+        case opcode::LT: return a < b;
+        case opcode::LE: return a <= b;
+        case opcode::GT: return a > b;
+        case opcode::GE: return a >= b;
+        case opcode::EQ: return a == b;
+        case opcode::NE: return a != b;
+        case opcode::BIT_AND: return a & b;
+        case opcode::BIT_XOR: return a ^ b;
+        case opcode::BIT_OR: return a | b;
+        default: break;
+    }
+    return 0;
+}
+
+int64_t arith::evaluate(std::string_view source) {
+    const expression& expr {compiled(source)};
+    static std::vector<int64_t> stack {};
+    stack.clear();
+
+    const auto pop {[] {
+        const int64_t value {stack.back()};
+        stack.pop_back();
+        return value;
+    }};
+
+    size_t pc {};
+    while (pc < expr.code.size()) {
+        const instruction& ins {expr.code[pc++]};
+        switch (ins.op) {
+            case opcode::PUSH: {
+                stack.push_back(ins.operand);
+                break;
+            }
+            case opcode::LOAD: {
+                stack.push_back(load(expr.names[ins.operand]));
+                break;
+            }
+            case opcode::STORE: {
+                store(expr.names[ins.operand], stack.back());
+                break;
+            }
+            case opcode::POP: {
+                stack.pop_back();
+                break;
+            }
+            case opcode::DUP: {
+                stack.push_back(stack.back());
+                break;
+            }
+            case opcode::NEG: {
+                stack.back() = static_cast<int64_t>(0 - static_cast<uint64_t>(stack.back()));
+                break;
+            }
+            case opcode::NOT: {
+                stack.back() = !stack.back();
+                break;
+            }
+            case opcode::BIT_NOT: {
+                stack.back() = ~stack.back();
+                break;
+            }
+            case opcode::JUMP: {
+                pc = ins.operand;
+                break;
+            }
+            case opcode::JUMP_IF_ZERO: {
+                if (pop() == 0)
+                    pc = ins.operand;
+                break;
+            }
+            case opcode::JUMP_IF_NOT_ZERO: {
+                if (pop() != 0)
+                    pc = ins.operand;
+                break;
+            }
+            default: {
+                const int64_t b {pop()};
+                stack.back() = apply(ins.op, stack.back(), b, source);
+            }
+        }
+    }
+    return stack.back();
+}
+
+void arith::clear() noexcept {
+    expressions.clear();
+}
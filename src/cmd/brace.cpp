@@ -0,0 +1,234 @@
+#include "cmd/brace.h"
+#include "cmd/expansion.h"
+#include "cmd/spawn.h"
+#include "stringsep.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace {
+
+struct expression {
+    size_t open;
+    size_t close;
+    std::vector<std::pair<size_t, size_t>> alternatives;
+    int64_t first;
+    int64_t step;
+    int width;
+    bool letters;
+    uint64_t count;
+    /* Set for a sequence with more words than count can hold */
+    bool too_long;
+};
+
+}
+
+/* Returns the position of the character closing the quote or ${ at pos,
+ * text.size() if it isn't closed. */
+static size_t skip_quoted(std::string_view text, size_t pos) {
+    const char c {text[pos]};
+    if (c == '\'') {
+        return std::min(text.find('\'', pos + 1), text.size());
+    }
+    if (c == '"') {
+        for (size_t i = pos + 1; i < text.size(); i++) {
+            if (text[i] == sep::ESCAPE_CHAR)
+                i++;
+            else if (text[i] == '"')
+                return i;
+        }
+        return text.size();
+    }
+    // ${
+    size_t depth {};
+    for (size_t i = pos + 1; i < text.size(); i++) {
+        if (text[i] == '{')
+            depth++;
+        else if (text[i] == '}' && --depth == 0)
+            return i;
+    }
+    return text.size();
+}
+
+static bool starts_quote(std::string_view text, size_t pos) {
+    return text[pos] == '\'' || text[pos] == '"' ||
+        (text[pos] == sep::VAR_PREFIX && pos + 1 < text.size() && text[pos + 1] == '{');
+}
+
+static bool parse_number(std::string_view str, int64_t& value) {
+    const auto [end, err] {std::from_chars(str.data(), str.data() + str.size(), value)};
+    return !str.empty() && err == std::errc {} && end == str.data() + str.size();
+}
+
+static bool is_padded(std::string_view number) {
+    if (!number.empty() && number.front() == '-')
+        number.remove_prefix(1);
+    return number.size() > 1 && number.front() == '0';
+}
+
+/* Parses the inside of {x..y} or {x..y..step}. */
+static bool parse_sequence(std::string_view body, expression& expr) {
+    const size_t dots {body.find("..")};
+    if (dots == std::string_view::npos)
+        return false;
+    const std::string_view from {body.substr(0, dots)};
+    std::string_view to {body.substr(dots + 2)};
+    int64_t step {1};
+    if (const size_t step_dots {to.find("..")}; step_dots != std::string_view::npos) {
+        if (!parse_number(to.substr(step_dots + 2), step))
+            return false;
+        to = to.substr(0, step_dots);
+    }
+
+    int64_t first {};
+    int64_t last {};
+    expr.letters = from.size() == 1 && to.size() == 1 &&
+        std::isalpha(static_cast<unsigned char>(from[0])) &&
+        std::isalpha(static_cast<unsigned char>(to[0]));
+    if (expr.letters) {
+        first = from[0];
+        last = to[0];
+        expr.width = 0;
+    } else if (parse_number(from, first) && parse_number(to, last)) {
+        expr.width = is_padded(from) || is_padded(to) ? std::max(from.size(), to.size()) : 0;
+    } else {
+        return false;
+    }
+
+    // the direction comes from the bounds, the sign of the step is ignored
+    uint64_t magnitude {step < 0 ? 0 - static_cast<uint64_t>(step) : static_cast<uint64_t>(step)};
+    if (magnitude == 0)
+        magnitude = 1;
+    const uint64_t distance {last >= first ? static_cast<uint64_t>(last) - static_cast<uint64_t>(first)
+        : static_cast<uint64_t>(first) - static_cast<uint64_t>(last)};
+    expr.first = first;
+    expr.step = static_cast<int64_t>(last >= first ? magnitude : 0 - magnitude);
+    expr.too_long = distance / magnitude == UINT64_MAX;
+    expr.count = expr.too_long ? 0 : distance / magnitude + 1;
+    return true;
+}
+
+/* Parses the expression opened at pos. Returns false if the braces don't
+ * form one, like {a} or an unclosed {. */
+static bool parse_expression(std::string_view text, size_t open, expression& expr) {
+    expr.alternatives.clear();
+    size_t depth {};
+    size_t start {open + 1};
+    for (size_t i = open + 1; i < text.size(); i++) {
+        const char c {text[i]};
+        if (c == sep::ESCAPE_CHAR) {
+            i++;
+        } else if (starts_quote(text, i)) {
+            i = skip_quoted(text, i);
+        } else if (c == '{') {
+            depth++;
+        } else if (c == ',' && depth == 0) {
+            expr.alternatives.emplace_back(start, i - start);
+            start = i + 1;
+        } else if (c == '}') {
+            if (depth-- > 0)
+                continue;
+            expr.open = open;
+            expr.close = i;
+            if (!expr.alternatives.empty()) {
+                expr.alternatives.emplace_back(start, i - start);
+                expr.count = expr.alternatives.size();
+                return true;
+            }
+            return parse_sequence(text.substr(open + 1, i - open - 1), expr);
+        }
+    }
+    return false;
+}
+
+/* Finds the leftmost brace expression of text. */
+static std::optional<expression> find_expression(std::string_view text) {
+    expression expr {};
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == sep::ESCAPE_CHAR) {
+            i++;
+        } else if (starts_quote(text, i)) {
+            i = skip_quoted(text, i);
+        } else if (text[i] == '{' && parse_expression(text, i, expr)) {
+            return expr;
+        }
+    }
+    return std::nullopt;
+}
+
+bool brace::has_braces(std::string_view word) {
+    return word.find('{') != std::string_view::npos && find_expression(word).has_value();
+}
+
+bool brace::generator::push(std::string_view text) {
+    auto expr {find_expression(text)};
+    if (!expr)
+        return false;
+    if (expr->too_long)
+        throw expansion_error("argument list too long", SPAWN_NOT_EXECUTABLE);
+    stack.push_back({
+        .text = std::string {text},
+        .open = expr->open,
+        .close = expr->close,
+        .alternatives = std::move(expr->alternatives),
+        .seq = {expr->first, expr->step, expr->width, expr->letters},
+        .count = expr->count,
+        .index = 0,
+    });
+    return true;
+}
+
+void brace::generator::append_item(const frame& f, std::string& out) const {
+    if (!f.alternatives.empty()) {
+        const auto [start, length] {f.alternatives[f.index]};
+        out.append(f.text, start, length);
+        return;
+    }
+
+    const auto value {static_cast<int64_t>(static_cast<uint64_t>(f.seq.first) +
+        f.index * static_cast<uint64_t>(f.seq.step))};
+    if (f.seq.letters) {
+        out.push_back(static_cast<char>(value));
+        return;
+    }
+    std::array<char, 24> digits;
+    const uint64_t magnitude {value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value)};
+    const auto end {std::to_chars(digits.begin(), digits.end(), magnitude).ptr};
+    const size_t length = (end - digits.begin()) + (value < 0);
+    if (value < 0)
+        out.push_back('-');
+    if (length < static_cast<size_t>(f.seq.width))
+        out.append(f.seq.width - length, '0');
+    out.append(digits.begin(), end);
+}
+
+bool brace::generator::next(std::string& out) {
+    if (!started) {
+        started = true;
+        if (!push(word)) {
+            out = word;
+            return true;
+        }
+    }
+
+    while (!stack.empty()) {
+        frame& f {stack.back()};
+        if (f.index == f.count) {
+            stack.pop_back();
+            continue;
+        }
+        out.assign(f.text, 0, f.open);
+        append_item(f, out);
+        f.index++;
+        out.append(f.text, f.close + 1);
+        // the word may still contain expressions right of this one, or
+        // nested in the alternative
+        if (!push(out))
+            return true;
+    }
+    return false;
+}
@@ -1,247 +1,523 @@
 #include "builtins/builtins.h"
 #include "cmd/cmd.h"
 #include "cmd/expansion.h"
-#include "stringsep.h"
+#include "cmd/jobs.h"
+#include "cmd/reaper.h"
+#include "cmd/spawn.h"
+#include "cmd/variable.h"
+#include "cmd/vm.h"
+#include "trace.h"
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
 #include <csignal>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <fcntl.h>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <sched.h>
-#include <stdexcept>
+#include <span>
+#include <sstream>
+#include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <wait.h>
 
-inline int signal_status(int status) {
-    return 128 + WTERMSIG(status);
+/* Process group for a process of a pipeline in the foreground: with job
+ * control, the first one starts a group of its own that the others join,
+ * and the group takes the terminal. */
+static spawn_group foreground_group(pid_t pgid) {
+    if (!jobs::job_control())
+        return {};
+    return {.pgid = pgid == -1 ? 0 : pgid, .terminal = jobs::terminal()};
 }
 
-static int wait_for_child(pid_t pid) {
-    int status {};
-    while (true) {
-        waitpid(pid, &status, WUNTRACED);
-        if (WIFEXITED(status)) {
-            return WEXITSTATUS(status);
-        }
-        if (WIFSIGNALED(status)) {
-            return signal_status(status);
+/* Words of the stages of a pipeline as they were expanded. */
+static std::string pipeline_text(std::span<const args_view> stages) {
+    std::string text {};
+    for (size_t i = 0; i < stages.size(); i++) {
+        if (i > 0)
+            text += " | ";
+        // compound stages have no words of their own
+        if (stages[i].empty())
+            text += "...";
+        for (size_t j = 0; j < stages[i].size(); j++) {
+            if (j > 0)
+                text += ' ';
+            text += stages[i][j];
         }
     }
+    return text;
+}
+
+static std::chrono::microseconds microseconds(const timeval& t) {
+    return std::chrono::seconds {t.tv_sec} + std::chrono::microseconds {t.tv_usec};
+}
+
+/* Usage of a child as wait4 reported it, including the children it waited
+ * for itself. */
+static stage_usage child_usage(const reaper::child_exit& child) {
+    return {
+        .pid = child.pid,
+        .status = reaper::exit_status(child.status),
+        .real = child.elapsed,
+        .user = microseconds(child.usage.ru_utime),
+        .sys = microseconds(child.usage.ru_stime),
+        .max_rss = child.usage.ru_maxrss,
+    };
+}
+
+/* Runs body inside the shell and notes what it used, the shell's own usage
+ * and that of the children it started that have exited meanwhile. Jobs the
+ * shell reaps while body runs only count if body started them. */
+static int measure_in_shell(stage_usage& usage, const std::function<int()>& body) {
+    rusage self {};
+    getrusage(RUSAGE_SELF, &self);
+    const reaper::account children {};
+    const auto start {reaper::clock::now()};
+
+    usage.status = body();
+
+    usage.real = reaper::clock::now() - start;
+    rusage self_after {};
+    getrusage(RUSAGE_SELF, &self_after);
+    usage.user = microseconds(self_after.ru_utime) - microseconds(self.ru_utime) + children.user;
+    usage.sys = microseconds(self_after.ru_stime) - microseconds(self.ru_stime) + children.sys;
+    usage.max_rss = std::max(self_after.ru_maxrss, children.max_rss);
+    return usage.status;
 }
 
-static void run_process(args_view args) {
-    signal(SIGINT, SIG_DFL);
-    const char* argv[args.size() + 1];
-    for (size_t i = 0; i < args.size(); i++) {
-        argv[i] = args[i].c_str();
+/* Waits for the children of a pipeline in the foreground, storing the exit
+ * status of each stage as it exits, and its usage unless usage is empty.
+ * With job control, a pipeline stopped from the terminal becomes a job
+ * instead, and the status of the stop is returned. */
+static std::optional<int> wait_foreground(std::span<const pid_t> children, std::span<int> statuses,
+    pid_t pgid, std::span<const args_view> stages, std::span<stage_usage> usage)
+{
+    trace::span span {"wait"};
+    span.args = {.pid = pgid, .command = stages[0].empty() ? std::string_view {} : stages[0][0]};
+    std::vector<pid_t> running {};
+    for (const pid_t child : children) {
+        if (child != -1)
+            running.push_back(child);
     }
-    argv[args.size()] = nullptr;
 
-    execvp(argv[0], const_cast<char**>(argv));
-    perror("execvp");
-    exit(EXIT_FAILURE);
+    // Stages are collected as they exit, whatever their order
+    const jobs::foreground fg {pgid};
+    while (!running.empty()) {
+        const auto child {reaper::wait_any(running)};
+        if (!child)
+            break;
+        if (WIFSTOPPED(child->status)) {
+            if (!jobs::job_control())
+                continue;
+            jobs::job& job {jobs::add(pgid, std::move(running), pipeline_text(stages))};
+            // a builtin at the end ran in the shell and has no process
+            job.last = *std::ranges::find_if(children.rbegin(), children.rend(),
+                [](pid_t pid) { return pid != -1; });
+            job.status = statuses.back();
+            job.state = jobs::job_state::STOPPED;
+            job.changed = true;
+            return reaper::exit_status(child->status);
+        }
+        const auto stage {std::ranges::find(children, child->pid) - children.begin()};
+        statuses[stage] = reaper::exit_status(child->status);
+        std::erase(running, child->pid);
+        if (!usage.empty())
+            usage[stage] = child_usage(*child);
+        if (trace::enabled()) {
+            // the life of the child, on a track of its own
+            const auto now {trace::clock::now()};
+            trace::event("exec", now - child->elapsed, now, {
+                .pid = child->pid,
+                .command = stages[stage].empty() ? std::string_view {} : stages[stage][0],
+                .status = statuses[stage],
+            }, child->pid);
+        }
+    }
+    span.args.status = statuses.back();
+    return std::nullopt;
 }
 
-/* Run a simple command or a shell builtin. Assumes that all expansions
- * of variables, globs, etc. have already been done*/
-int run_simple_command(args_view args) {
-    int builtin_status {exec_builtin(args)};
-    if (builtin_status != BUILTIN_NOT_FOUND)
-        return builtin_status;
+/* Runs a simple command like run_simple_command, noting its usage if usage
+ * has room for it. */
+static int run_simple(args_view args, std::span<stage_usage> usage) {
+    if (const auto* fn {vm::find_function(args[0])}) {
+        const auto run {[&] { return vm::call_function(*fn, args); }};
+        return usage.empty() ? run() : measure_in_shell(usage[0], run);
+    }
+
+    // a builtin may fail with the same status as one that isn't there
+    if (const Command* builtin {find_builtin(args[0])}) {
+        trace::span span {"builtin"};
+        span.args.command = args[0];
+        const auto run {[&] { return builtin->function(args); }};
+        span.args.status = usage.empty() ? run() : measure_in_shell(usage[0], run);
+        return *span.args.status;
+    }
 
     int status {};
-    const pid_t pid {fork()};
-    if (!pid) {
-        run_process(args);
-    } else if (pid == -1) {
-        perror("fork");
+    const pid_t pid {spawn_command(args, {}, status, foreground_group(-1))};
+    if (pid == -1) {
+        if (!usage.empty())
+            usage[0].status = status;
+        return status;
     }
-    return wait_for_child(pid);
+    status = EXIT_FAILURE;
+    const auto stopped {wait_foreground({&pid, 1}, {&status, 1}, pid, {&args, 1}, usage)};
+    return stopped.value_or(status);
+}
+
+/* Run a simple command, a function or a shell builtin. Assumes that all expansions
+ * of variables, globs, etc. have already been done*/
+int run_simple_command(args_view args) {
+    return run_simple(args, {});
 }
 
 /* Perform variable, tilde, glob expansion and strip quotes. */
-static args_container prepare_command_args(args_view args) {
-    args_container result {args.begin(), args.end()};
-    for (auto& arg : result) {
-        expand_word(arg);
+static arg_list prepare_command_args(const ast::program& prog,
+    const ast::simple_command& command, std::pmr::memory_resource* arena)
+{
+    trace::span span {"expand"};
+    arg_list result {arena};
+    result.reserve(command.nwords);
+    glob::dir_cache dirs {};
+    for (const auto& word : prog.words_of(command)) {
+        expand_argument(prog.text(word), word.flags, result, arena, dirs);
     }
-    expand_globs(result);
-    strip_all_quotes(result);
+    if (!result.empty())
+        span.args.command = result[0];
     return result;
 }
 
-enum class pipe_type {
-    PIPE_STDOUT,
-    PIPE_BOTH,
-};
+inline void close_fd(int& fd) {
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+}
 
-struct pipeline_item {
-    args_container args;
-    pipe_type type;
-};
+inline void close_pipes(std::span<int> pipes) {
+    for (int& fd : pipes) {
+        close_fd(fd);
+    }
+}
 
-/* Splits the pipeline by | and |& operators and performs expansions on each
- * of the resulting commands */
-static std::vector<pipeline_item> split_pipeline(args_view args) {
-    std::vector<pipeline_item> res {};
-
-    auto prev {args.begin()};
-    for (auto it = args.begin(); it != args.end(); it++) {
-        const std::string_view& s {*it};
-        if (s == sep::PIPE_OUT || s == sep::PIPE_BOTH) {
-            if (prev == it) {
-                throw std::runtime_error("Missing command in pipeline.");
-            }
-            const pipe_type type {s == sep::PIPE_BOTH ? pipe_type::PIPE_BOTH : pipe_type::PIPE_STDOUT};
-            res.push_back({prepare_command_args({prev, it}), type});
-            prev = it + 1;
-        }
+/* Points a standard stream at fd for the lifetime of the object, restoring
+ * the original descriptor on destruction. */
+class stream_redirect {
+    int target;
+    int saved {-1};
+
+public:
+    stream_redirect(int fd, int target) : target(target) {
+        if (fd == target)
+            return;
+        saved = dup(target);
+        dup2(fd, target);
     }
 
-    if (prev != args.end())
-        res.push_back({prepare_command_args({prev, args.end()}), pipe_type::PIPE_STDOUT});
+    ~stream_redirect() {
+        if (saved == -1)
+            return;
+        dup2(saved, target);
+        close(saved);
+    }
 
-    return res;
-}
+    stream_redirect(const stream_redirect&) = delete;
+    stream_redirect& operator=(const stream_redirect&) = delete;
+};
 
-inline void close_pipes(const std::vector<int[2]>& pipes) {
-    for (auto pipe : pipes) {
-        close(pipe[0]);
-        close(pipe[1]);
+/* Runs a builtin inside the shell process with its standard streams pointed
+ * at the given descriptors. */
+static int run_builtin_redirected(args_view args, const spawn_fds& fds) {
+    trace::span span {"builtin"};
+    span.args.command = args[0];
+    std::cout.flush();
+    std::cerr.flush();
+    int status {};
+    {
+        const stream_redirect in {fds.in, STDIN_FILENO};
+        const stream_redirect out {fds.out, STDOUT_FILENO};
+        const stream_redirect err {fds.err, STDERR_FILENO};
+        status = exec_builtin(args);
+        std::cout.flush();
+        std::cerr.flush();
     }
+    // Writing into a pipe nobody reads from anymore leaves the streams failed
+    std::cout.clear();
+    std::cerr.clear();
+    span.args.status = status;
+    return status;
 }
 
-int run_pipeline(args_view args) {
-    auto pipelines {split_pipeline(args)};
-    assert(!pipelines.empty());
+int run_pipeline(const ast::program& prog, const ast::pipeline& pipeline,
+    std::pmr::memory_resource* arena, std::span<stage_usage> usage)
+{
+    const auto commands {prog.commands_of(pipeline)};
+    assert(!commands.empty());
+
+    const size_t ncommands {commands.size()};
+    std::pmr::vector<arg_list> stages {arena};
+    stages.reserve(ncommands);
+    try {
+        for (const auto& command : commands) {
+            stages.push_back(prepare_command_args(prog, command, arena));
+        }
+    } catch (const expansion_error& err) {
+        std::cerr << "stush: " << err.what() << '\n';
+        if (!usage.empty())
+            usage.back().status = err.status;
+        return err.status;
+    }
+
+    if (ncommands == 1) {
+        if (commands[0].body == ast::NO_INDEX)
+            return run_simple(stages[0], usage);
+        const auto run {[&] { return vm::run_body(prog, commands[0].body); }};
+        return usage.empty() ? run() : measure_in_shell(usage[0], run);
+    }
 
-    const size_t ncommands {pipelines.size()};
-    if (ncommands == 1)
-        return run_simple_command(pipelines[0].args);
+    std::pmr::vector<bool> builtin (ncommands, false, arena);
+    for (size_t i = 0; i < ncommands; i++) {
+        builtin[i] = commands[i].body == ast::NO_INDEX && !vm::find_function(stages[i][0]) &&
+            is_builtin(stages[i][0]);
+    }
+    const size_t first_builtin {static_cast<size_t>(std::ranges::find(builtin, true) - builtin.begin())};
 
+    // Read and write ends of the i-th pipe are at 2*i and 2*i + 1
     const size_t npipes {ncommands - 1};
-    std::vector<int[2]> pipes(npipes);
-    for (auto p : pipes) {
-        if (pipe(p) == -1) {
-            perror("pipe");
-            return EXIT_FAILURE;
+    std::pmr::vector<int> pipes (npipes * 2, -1, arena);
+    for (size_t i = 0; i < npipes; i++) {
+        // Builtins run before the builtins upstream of them, so a pipe to one
+        // would lose its reader before the stages feeding it got any input.
+        // Builtins don't read, what these stages write is thrown away instead.
+        if (builtin[i + 1] && first_builtin <= i) {
+            pipes[i * 2] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            pipes[i * 2 + 1] = open("/dev/null", O_WRONLY | O_CLOEXEC);
+            if (pipes[i * 2] != -1 && pipes[i * 2 + 1] != -1)
+                continue;
+        } else if (pipe(&pipes[i * 2]) == 0) {
+            continue;
         }
+        perror("pipe");
+        close_pipes(pipes);
+        return EXIT_FAILURE;
     }
 
-    std::vector<pid_t> children (ncommands);
-    for (size_t i = 0; i < ncommands; i++) {
-        const pid_t pid {fork()};
-        if (!pid) {
-            if (i > 0) {
-                dup2(pipes[i - 1][0], STDIN_FILENO);
-            }
-            if (i < npipes) {
-                dup2(pipes[i][1], STDOUT_FILENO);
-                if (pipelines[i].type == pipe_type::PIPE_BOTH) {
-                    dup2(pipes[i][1], STDERR_FILENO);
-                }
+    const auto input_fd {[&](size_t i) -> int& { return pipes[(i - 1) * 2]; }};
+    const auto output_fd {[&](size_t i) -> int& { return pipes[i * 2 + 1]; }};
+    const auto stage_fds {[&](size_t i) {
+        spawn_fds fds {.close_fds = pipes};
+        if (i > 0) {
+            fds.in = input_fd(i);
+        }
+        if (i < npipes) {
+            fds.out = output_fd(i);
+            if (commands[i].pipe == ast::op_kind::PIPE_BOTH) {
+                fds.err = fds.out;
             }
-
-            close_pipes(pipes);
-
-            int builtin_status {exec_builtin(pipelines[i].args)};
-            if (builtin_status != BUILTIN_NOT_FOUND)
-                exit(builtin_status);
-
-            run_process(pipelines[i].args);
-        } else if (pid < 0) {
-            perror("fork");
-            return EXIT_FAILURE;
         }
-        children[i] = pid;
+        return fds;
+    }};
+
+    // External stages are started first, so that builtins always have
+    // somebody to write to. Functions and compound commands may read their
+    // input, so they run in a subshell like external commands do.
+    std::pmr::vector<pid_t> children (ncommands, -1, arena);
+    std::pmr::vector<int> statuses (ncommands, 0, arena);
+    pid_t pgid {-1};
+    for (size_t i = 0; i < ncommands; i++) {
+        const args_view stage {stages[i]};
+        const uint32_t body {commands[i].body};
+        if (body != ast::NO_INDEX) {
+            children[i] = spawn_subshell(stage_fds(i), [&] { return vm::run_body(prog, body); },
+                foreground_group(pgid));
+        } else if (const auto* fn {vm::find_function(stage[0])}) {
+            children[i] = spawn_subshell(stage_fds(i), [&] { return vm::call_function(*fn, stage); },
+                foreground_group(pgid));
+        } else if (!builtin[i]) {
+            children[i] = spawn_command(stage, stage_fds(i), statuses[i], foreground_group(pgid));
+        }
+        // a stage that couldn't be started fails
+        if (!builtin[i] && children[i] == -1 && statuses[i] == EXIT_SUCCESS)
+            statuses[i] = EXIT_FAILURE;
+        if (!builtin[i] && children[i] == -1 && !usage.empty())
+            usage[i].status = statuses[i];
+        if (pgid == -1 && children[i] != -1)
+            pgid = children[i];
     }
 
-    close_pipes(pipes);
+    // Only the pipe ends builtins are going to use have to stay open
+    std::pmr::vector<bool> keep (pipes.size(), false, arena);
+    for (size_t i = 0; i < ncommands; i++) {
+        if (!builtin[i])
+            continue;
+        if (i > 0)
+            keep[(i - 1) * 2] = true;
+        if (i < npipes)
+            keep[i * 2 + 1] = true;
+    }
+    for (size_t fd = 0; fd < pipes.size(); fd++) {
+        if (!keep[fd])
+            close_fd(pipes[fd]);
+    }
 
-    int pl_status {};
-    for (pid_t pid : children) {
-        pl_status = wait_for_child(pid);
+    // Builtins never read their input, so running them from the end of the
+    // pipeline lets every builtin see its reader either alive or gone,
+    // instead of blocking on a full pipe.
+    for (size_t i = ncommands; i-- > 0;) {
+        if (!builtin[i])
+            continue;
+        const auto run {[&] { return run_builtin_redirected(stages[i], stage_fds(i)); }};
+        statuses[i] = usage.empty() ? run() : measure_in_shell(usage[i], run);
+        if (i > 0)
+            close_fd(input_fd(i));
+        if (i < npipes)
+            close_fd(output_fd(i));
     }
 
-    return pl_status;
+    const std::vector<args_view> views (stages.begin(), stages.end());
+    const auto stopped {wait_foreground(children, statuses, pgid, views, usage)};
+    return stopped.value_or(statuses.back());
 }
 
-enum list_type {
-    AND,
-    OR,
-};
-
-struct list_item {
-    args_view args;
-    list_type type;
-};
-
-/* Gets the next pipeline from list and advances the argument iterator. */
-static list_item get_next_pipeline(args_view args, args_view::iterator& it) {
-    const auto start {it};
-    while (it != args.end()) {
-        const std::string_view& s {*it};
-        if (s == sep::LIST_AND || s == sep::LIST_OR) {
-            const args_view command {start, it};
-            if (command.empty()) {
-                throw std::runtime_error("Missing command in list.");
-            }
+std::string command_text(const ast::program& prog, const ast::simple_command& command) {
+    const auto words {prog.words_of(command)};
+    if (words.empty())
+        return {};
+    const auto start {words.front().span.start};
+    std::string text {prog.source.view().substr(start, words.back().span.end - start)};
+    std::ranges::replace(text, '\0', ' ');
+    return text;
+}
 
-            it++;
-            const list_type type {s == sep::LIST_AND ? list_type::AND : list_type::OR};
-            return {command, type};
-        }
-        it++;
+int run_background(const ast::program& prog, const ast::simple_command& list) {
+    // Without job control, the job can't have the terminal to read from
+    int null_fd {-1};
+    spawn_fds fds {};
+    if (!jobs::job_control()) {
+        null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (null_fd != -1)
+            fds = {.in = null_fd, .close_fds = {&null_fd, 1}};
     }
-    return {{start, it}, list_type::AND};
+    const spawn_group group {.pgid = jobs::job_control() ? 0 : NO_PGROUP};
+    const pid_t pid {spawn_subshell(fds, [&] { return vm::run_body(prog, list.body); }, group)};
+    close_fd(null_fd);
+    if (pid == -1)
+        return EXIT_FAILURE;
+
+    var::set_last_background(pid);
+    const jobs::job& job {jobs::add(pid, {pid}, command_text(prog, list))};
+    if (jobs::job_control())
+        std::cerr << '[' << job.id << "] " << pid << '\n';
+    return EXIT_SUCCESS;
 }
 
-int run_list(args_view args) {
-    int status {};
-
-    auto it {args.begin()};
+static double seconds(std::chrono::nanoseconds d) {
+    return std::chrono::duration<double> {d}.count();
+}
 
-    while (it != args.end()) {
-        const auto command = get_next_pipeline(args, it);
-        status = run_pipeline(command.args);
+static std::string format_seconds(std::chrono::nanoseconds d) {
+    std::array<char, 32> text {};
+    snprintf(text.data(), text.size(), "%.3fs", seconds(d));
+    return text.data();
+}
 
-        if (command.type == list_type::AND && status != EXIT_SUCCESS) {
-            return status;
-        }
-        if (command.type == list_type::OR && status == EXIT_SUCCESS) {
-            return status;
+static std::string json_string(std::string_view text) {
+    std::string quoted {'"'};
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            std::array<char, 8> escaped {};
+            snprintf(escaped.data(), escaped.size(), "\\u%04x", c);
+            quoted += escaped.data();
+        } else {
+            quoted += c;
         }
     }
-
-    return status;
+    return quoted + '"';
 }
 
-static std::vector<args_view> split_compound_command(args_container& args) {
-    std::vector<args_view> res {};
-
-    auto prev {args.begin()};
-    for (auto it = args.begin(); it != args.end(); it++) {
-        const std::string_view& s {*it};
-        if (s == sep::NEWLINE || s == sep::COMMAND) {
-            const args_view command {prev, it};
-            if (!command.empty()) {
-                res.push_back(command);
-            }
-            prev = it + 1;
-        }
+static void write_times_json(std::ostream& out, const stage_usage& total,
+    std::span<const stage_usage> usage, std::span<const std::string> names)
+{
+    const auto fields {[&](const stage_usage& u) {
+        out << "\"status\":" << u.status << ",\"real\":" << seconds(u.real)
+            << ",\"user\":" << seconds(u.user) << ",\"sys\":" << seconds(u.sys)
+            << ",\"max_rss_kib\":" << u.max_rss;
+    }};
+    out << std::fixed << std::setprecision(6) << '{';
+    fields(total);
+    out << ",\"stages\":[";
+    for (size_t i = 0; i < usage.size(); i++) {
+        out << (i > 0 ? "," : "") << "{\"command\":" << json_string(names[i]) << ",\"pid\":";
+        if (usage[i].pid == -1)
+            out << "null,";
+        else
+            out << usage[i].pid << ',';
+        fields(usage[i]);
+        out << '}';
     }
+    out << "]}\n";
+}
 
-    if (prev != args.end())
-        res.push_back({prev, args.end()});
-
-    return res;
+static void write_times(std::ostream& out, const stage_usage& total,
+    std::span<const stage_usage> usage, std::span<const std::string> names)
+{
+    out << "real\t" << format_seconds(total.real) << '\n'
+        << "user\t" << format_seconds(total.user) << '\n'
+        << "sys\t" << format_seconds(total.sys) << '\n'
+        << "maxrss\t" << total.max_rss << " KiB\n";
+    if (usage.size() < 2)
+        return;
+
+    out << std::left << std::setw(7) << "stage" << std::setw(9) << "pid" << std::setw(8) << "status"
+        << std::setw(10) << "real" << std::setw(10) << "user" << std::setw(10) << "sys"
+        << std::setw(12) << "maxrss" << "command\n";
+    for (size_t i = 0; i < usage.size(); i++) {
+        const stage_usage& u {usage[i]};
+        out << std::setw(7) << i + 1 << std::setw(9) << (u.pid == -1 ? "-" : std::to_string(u.pid))
+            << std::setw(8) << u.status << std::setw(10) << format_seconds(u.real)
+            << std::setw(10) << format_seconds(u.user) << std::setw(10) << format_seconds(u.sys)
+            << std::setw(12) << std::to_string(u.max_rss) + " KiB" << names[i] << '\n';
+    }
 }
 
-int run_compound_command(args_container& args) {
-    int status {};
-    for (auto command : split_compound_command(args)) {
-        status = run_list(command);
+int run_timed_pipeline(const ast::program& prog, const ast::pipeline& pipeline,
+    std::pmr::memory_resource* arena, ast::time_format format)
+{
+    std::vector<stage_usage> usage (pipeline.ncommands);
+    stage_usage total {};
+    total.status = measure_in_shell(total, [&] {
+        return pipeline.ncommands == 0 ? EXIT_SUCCESS : run_pipeline(prog, pipeline, arena, usage);
+    });
+
+    std::vector<std::string> names {};
+    for (const auto& command : prog.commands_of(pipeline)) {
+        names.push_back(command.body == ast::NO_INDEX ? command_text(prog, command) : "...");
     }
-    return status;
+    std::ostringstream report {};
+    if (format == ast::time_format::JSON)
+        write_times_json(report, total, usage, names);
+    else
+        write_times(report, total, usage, names);
+    std::cerr << report.str();
+    return total.status;
+}
+
+int run_compound_command(std::shared_ptr<const ast::program> prog) {
+    return vm::run(std::move(prog));
 }
@@ -0,0 +1,71 @@
+#include "cmd/cmdhash.h"
+#include "cmd/variable.h"
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static cmdhash::table cache {};
+
+static bool is_executable(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(path.c_str(), X_OK) == 0;
+}
+
+static std::string search_path(std::string_view name) {
+    const std::string_view path {var::find("PATH").value_or("/bin:/usr/bin")};
+
+    size_t start {};
+    while (start <= path.size()) {
+        size_t end {path.find(':', start)};
+        if (end == std::string_view::npos)
+            end = path.size();
+
+        // An empty PATH entry stands for the current directory
+        std::string candidate {start == end ? "." : path.substr(start, end - start)};
+        candidate.push_back('/');
+        candidate.append(name);
+        if (is_executable(candidate))
+            return candidate;
+
+        start = end + 1;
+    }
+    return "";
+}
+
+std::string cmdhash::resolve(std::string_view name) {
+    bool cached {};
+    return resolve(name, cached);
+}
+
+std::string cmdhash::resolve(std::string_view name, bool& cached) {
+    cached = false;
+    if (name.find('/') != std::string_view::npos)
+        return std::string(name);
+
+    if (auto it {cache.find(std::string(name))}; it != cache.end()) {
+        it->second.hits++;
+        cached = true;
+        return it->second.path;
+    }
+
+    std::string path {search_path(name)};
+    // What a relative PATH entry finds depends on the working directory
+    if (path.starts_with('/')) {
+        var::watch("PATH", clear);
+        cache.emplace(std::string(name), entry {path, 1});
+    }
+    return path;
+}
+
+void cmdhash::forget(std::string_view name) {
+    cache.erase(std::string(name));
+}
+
+void cmdhash::clear() noexcept {
+    cache.clear();
+}
+
+const cmdhash::table& cmdhash::entries() noexcept {
+    return cache;
+}
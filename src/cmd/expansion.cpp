@@ -1,130 +1,357 @@
 #include "cmd/expansion.h"
+#include "cmd/arith.h"
+#include "cmd/brace.h"
 #include "cmd/cmd.h"
+#include "cmd/glob.h"
+#include "cmd/parameter.h"
+#include "cmd/spawn.h"
+#include "cmd/tilde.h"
 #include "cmd/variable.h"
+#include "scan.h"
 #include "stringsep.h"
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cctype>
+#include <charconv>
 #include <cstddef>
 #include <cstdlib>
-#include <glob.h>
+#include <memory_resource>
+#include <optional>
 #include <string>
 #include <string_view>
-#include <pwd.h>
+#include <unistd.h>
 
-[[nodiscard]]
-std::string get_variable(const std::string& str) noexcept {
-    const char* env {getenv(str.data())};
-    if (!env) {
-        if (var::is_set(str))
-            return var::get_var(str);
-        return "";
-    }
-    return env;
+/* Characters expand_word has to look at, everything else is copied as is */
+static constexpr scan::char_set EXPANDED_CHARS {"$\\"};
+static constexpr scan::char_set NAME_ENDS {sep::WORD_SEPARATORS};
+
+/* Output of expand_argument before it is copied into an arena. Reused by
+ * every call, so it only allocates when a word is longer than any before. */
+static std::string expansion_buffer {};
+/* Words generated by brace expansion before they are expanded further */
+static std::string brace_buffer {};
+/* Used when the system doesn't report its limit on argument sizes */
+static const size_t DEFAULT_ARG_MAX {128 * 1024};
+
+/* Parameters with a one character name that are maintained by the shell. */
+static bool is_special_parameter(char c) {
+    return c == '?' || c == '#' || c == '!' || std::isdigit(static_cast<unsigned char>(c));
 }
 
-static void expand_variable(std::string& str, size_t start_pos, size_t end_pos) {
-    const std::string varname {str.substr(start_pos + 1, end_pos - start_pos - 1)};
-    const auto expanded {get_variable(std::move(varname))};
-    str.replace(start_pos, end_pos - start_pos, expanded);
+static bool is_positional(std::string_view name) {
+    return std::ranges::all_of(name, [](unsigned char c) { return std::isdigit(c); });
 }
 
-[[nodiscard]]
-static std::string get_home(std::string_view name) {
-    for (passwd* entry = getpwent(); entry != nullptr; entry = getpwent()) {
-        if (entry->pw_name == name) {
-            endpwent();
-            return entry->pw_dir;
-        }
+/* Looks up a special parameter or a positional parameter of any length. */
+static std::optional<std::string_view> find_special_parameter(std::string_view name,
+    std::string& scratch)
+{
+    const auto& params {var::positional()};
+    if (name == "?") {
+        scratch = std::to_string(var::last_status());
+        return scratch;
+    }
+    if (name == "#") {
+        scratch = std::to_string(params.size());
+        return scratch;
+    }
+    if (name == "!") {
+        if (var::last_background() == 0)
+            return std::nullopt;
+        scratch = std::to_string(var::last_background());
+        return scratch;
     }
-    endpwent();
-    return "";
+    if (name == "0")
+        return "stush";
+    size_t n {};
+    std::from_chars(name.data(), name.data() + name.size(), n);
+    if (n == 0 || n > params.size())
+        return std::nullopt;
+    return params[n - 1];
+}
+
+std::optional<std::string_view> find_parameter(std::string_view name, std::string& scratch) {
+    if (!name.empty() && (name == "?" || name == "#" || name == "!" || is_positional(name)))
+        return find_special_parameter(name, scratch);
+    return var::find(name);
 }
 
-static void expand_tilde(std::string& str) {
-    if (str.empty() || str.at(0) != '~')
+static void append_variable(std::string_view name, std::string& out) {
+    if (name.size() == 1 && is_special_parameter(name[0])) {
+        std::string scratch {};
+        out.append(find_special_parameter(name, scratch).value_or(""));
         return;
+    }
+    if (const auto value {var::find(name)})
+        out.append(*value);
+}
+
+[[nodiscard]]
+std::string get_variable(std::string_view name) {
+    std::string value {};
+    append_variable(name, value);
+    return value;
+}
 
-    const size_t slash_idx {str.find('/')};
-    const size_t prefix_end {slash_idx == std::string::npos ? str.size() : slash_idx};
+/* Appends the expansion of a tilde prefix. Returns how many characters of
+ * the word it replaces, 0 if there is nothing to expand. */
+static size_t expand_tilde(std::string_view word, std::string& out) {
+    if (word.empty() || word.front() != '~')
+        return 0;
 
+    const size_t prefix_end {std::min(word.find('/'), word.size())};
     if (prefix_end == 1) {
-        const char* home {getenv("HOME")};
-        if (home) {
-            str.replace(0, 1, home);
-        }
-        return;
+        const auto home {tilde::home()};
+        if (!home)
+            return 0;
+        out.append(*home);
+        return 1;
     }
 
-    const std::string homedir {get_home(str.substr(1, prefix_end - 1))};
-    if (homedir.size() == 1) {
-        str.replace(0, prefix_end + 1, homedir);
-    } else if (homedir.size() > 1) {
-        str.replace(0, prefix_end, homedir);
-    }
+    const auto homedir {tilde::home_of(word.substr(1, prefix_end - 1))};
+    if (!homedir || homedir->empty())
+        return 0;
+    out.append(*homedir);
+    // a home of / would otherwise be followed by another slash
+    if (homedir->size() == 1)
+        return std::min(prefix_end + 1, word.size());
+    return prefix_end;
 }
 
-inline bool is_word_separator(char c) {
-    return sep::WORD_SEPARATORS.find(c) != std::string::npos;
+/* Returns the end of the variable name starting at start. */
+static size_t variable_name_end(std::string_view word, size_t start) {
+    if (start < word.size() && is_special_parameter(word[start]))
+        return start + 1;
+    return scan::find_first_of(word, start, NAME_ENDS);
 }
 
-void expand_word(std::string& str) {
-    if (!str.empty() && str.front() == '\'' && str.back() == '\'')
-        return;
+/* Returns the position after the )) that closes the $(( at start, or
+ * std::string_view::npos if it isn't closed. */
+static size_t arithmetic_end(std::string_view word, size_t start) {
+    size_t depth {};
+    for (size_t i = start + 1; i < word.size(); i++) {
+        if (word[i] == '(') {
+            depth++;
+        } else if (word[i] == ')' && --depth == 1) {
+            // the parentheses of $(( have to close together
+            if (i + 1 < word.size() && word[i + 1] == ')')
+                return i + 2;
+            return std::string_view::npos;
+        }
+    }
+    return std::string_view::npos;
+}
+
+static void append_arithmetic(std::string_view expr, std::string& out) {
+    std::string buffer {};
+    std::array<char, 24> digits;
+    const auto end {std::to_chars(digits.begin(), digits.end(), arith::evaluate(expand_word(expr, buffer))).ptr};
+    out.append(digits.begin(), end);
+}
 
-    expand_tilde(str);
+/* Appends c so that it only matches itself when the result is used as a
+ * pattern. */
+static void append_pattern_literal(char c, std::string& out) {
+    if (c == '*' || c == '?' || c == '[') {
+        out.push_back('[');
+        out.push_back(c);
+        out.push_back(']');
+    } else {
+        out.push_back(c);
+    }
+}
 
-    bool escaped {false};
-    size_t i {};
-    while (i < str.size()) {
-        const char c {str[i]};
-        if (c == sep::ESCAPE_CHAR && !escaped) {
-            str.erase(i, 1);
-            escaped = true;
+/* Appends the expansion of word to out. For a pattern, escaped characters
+ * are kept literal. */
+static void expand_into(std::string_view word, std::string& out, bool pattern) {
+    size_t i {expand_tilde(word, out)};
+    while (i < word.size()) {
+        const char c {word[i]};
+        if (c == sep::ESCAPE_CHAR) {
+            // the escaped character is taken literally, an escaped newline
+            // continues the word on the next line
+            if (i + 1 < word.size() && word[i + 1] != '\n') {
+                if (pattern)
+                    append_pattern_literal(word[i + 1], out);
+                else
+                    out.push_back(word[i + 1]);
+            }
+            i += 2;
             continue;
         }
-        if (c == sep::VAR_PREFIX && !escaped) {
-            size_t varname_end {i + 1};
-            while (varname_end < str.size() &&
-                !is_word_separator(str[varname_end]))
-            {
-                varname_end++;
-            }
-            expand_variable(str, i, varname_end);
+        if (c == sep::VAR_PREFIX && word.compare(i + 1, 2, "((") == 0) {
+            const size_t end {arithmetic_end(word, i)};
+            if (end == std::string_view::npos)
+                throw expansion_error(std::string {word.substr(i)} + ": bad substitution");
+            append_arithmetic(word.substr(i + 3, end - i - 5), out);
+            i = end;
+            continue;
+        }
+        if (c == sep::VAR_PREFIX && i + 1 < word.size() && word[i + 1] == '{') {
+            const size_t end {param::find_end(word, i)};
+            if (end == std::string_view::npos)
+                throw expansion_error(std::string {word.substr(i)} + ": bad substitution");
+            param::expand(word.substr(i + 2, end - i - 3), out);
+            i = end;
+            continue;
+        }
+        if (c == sep::VAR_PREFIX) {
+            const size_t name_end {variable_name_end(word, i + 1)};
+            append_variable(word.substr(i + 1, name_end - i - 1), out);
+            i = name_end;
+            continue;
         }
-        escaped = false;
-        i++;
+        const size_t run_end {scan::find_first_of(word, i + 1, EXPANDED_CHARS)};
+        out.append(word, i, run_end - i);
+        i = run_end;
     }
 }
 
-void expand_globs(args_container& args) {
-    for (auto it = args.begin(); it != args.end(); it++) {
-        if (it->find('*') == std::string::npos)
-            continue;
+std::string_view expand_word(std::string_view word, std::string& out) {
+    if (word.empty() || (word.front() == '\'' && word.back() == '\''))
+        return word;
+    if (word.front() != '~' && scan::find_first_of(word, 0, EXPANDED_CHARS) == word.size())
+        return word;
 
-        glob_t globbuf;
-        glob(it->c_str(), GLOB_TILDE | GLOB_NOCHECK | GLOB_NOSORT, nullptr, &globbuf);
-        if (globbuf.gl_pathc) {
-            *it = globbuf.gl_pathv[0];
-            for (int i = 1; i < globbuf.gl_pathc; i++) {
-                it = args.insert(it, globbuf.gl_pathv[i]);
-            }
-        }
-        globfree(&globbuf);
-    }
+    out.clear();
+    expand_into(word, out, false);
+    return out;
+}
+
+void expand_word(std::string& str) {
+    std::string out {};
+    if (expand_word(str, out).data() == out.data())
+        str = std::move(out);
+}
+
+std::string_view arena_copy(std::string_view str, std::pmr::memory_resource* arena) {
+    char* copy {static_cast<char*>(arena->allocate(str.size() + 1, alignof(char)))};
+    str.copy(copy, str.size());
+    copy[str.size()] = '\0';
+    return {copy, str.size()};
 }
 
 static constexpr bool is_quoted(std::string_view str) {
     return str.size() > 1 && str.front() == str.back() && (str.front() == '\'' || str.front() == '\"');
 }
 
-static void strip_quotes(std::string& str) {
+std::string_view strip_quotes(std::string_view str) {
     if (is_quoted(str)) {
-        str.erase(0, 1);
-        str.erase(str.size() - 1, 1);
+        return str.substr(1, str.size() - 2);
     }
+    return str;
 }
 
-void strip_all_quotes(args_view args) {
-    for (auto& str : args) {
-        strip_quotes(str);
+/* Whether expand_word or quote removal could change the word. */
+static bool needs_expansion(std::string_view word) {
+    return word.front() == '~' || is_quoted(word) ||
+        scan::find_first_of(word, 0, EXPANDED_CHARS) != word.size();
+}
+
+/* Appends a word that doesn't change. The word itself is only put into
+ * args if it is persistent, otherwise it is copied. */
+static void append_unchanged(std::string_view word, bool persistent, arg_list& args,
+    std::pmr::memory_resource* arena)
+{
+    args.push_back(persistent && word.data()[word.size()] == '\0' ? word : arena_copy(word, arena));
+}
+
+/* Expands a word without brace expressions, globbing it if has_glob. */
+static void expand_unbraced(std::string_view word, bool persistent, bool has_glob, arg_list& args,
+    std::pmr::memory_resource* arena, glob::dir_cache& dirs)
+{
+    if (word.empty() || (!has_glob && !needs_expansion(word))) {
+        append_unchanged(word, persistent, args, arena);
+        return;
+    }
+
+    const std::string_view expanded {expand_word(word, expansion_buffer)};
+    // a word that matches nothing is kept as it is
+    if (has_glob && glob::has_magic(expanded) && glob::expand(expanded, dirs, args, arena) > 0)
+        return;
+    args.push_back(arena_copy(strip_quotes(expanded), arena));
+}
+
+/* Space the arguments take up in the memory of a new process. */
+static size_t argv_size(const arg_list& args) {
+    size_t size {};
+    for (const auto arg : args) {
+        size += arg.size() + 1 + sizeof(char*);
+    }
+    return size;
+}
+
+static size_t max_argv_size() {
+    static const long max {sysconf(_SC_ARG_MAX)};
+    return max > 0 ? max : DEFAULT_ARG_MAX;
+}
+
+/* Whether a word generated by brace expansion or without flags is a glob. */
+static bool has_glob(std::string_view word) {
+    return !is_quoted(word) && glob::has_magic(word);
+}
+
+/* Expands a word that may have brace expressions. */
+static void expand_braced(std::string_view word, arg_list& args, std::pmr::memory_resource* arena,
+    glob::dir_cache& dirs)
+{
+
+    // Words are generated one by one, so a huge expansion fails once it
+    // no longer fits instead of after it has been built.
+    size_t size {argv_size(args)};
+    brace::generator words {word};
+    while (words.next(brace_buffer)) {
+        const size_t first {args.size()};
+        expand_unbraced(brace_buffer, false, has_glob(brace_buffer), args, arena, dirs);
+        for (size_t i = first; i < args.size(); i++) {
+            size += args[i].size() + 1 + sizeof(char*);
+        }
+        if (size > max_argv_size())
+            throw expansion_error("argument list too long", SPAWN_NOT_EXECUTABLE);
+    }
+}
+
+void expand_argument(std::string_view word, arg_list& args, std::pmr::memory_resource* arena,
+    glob::dir_cache& dirs)
+{
+    if (brace::has_braces(word))
+        expand_braced(word, args, arena, dirs);
+    else
+        expand_unbraced(word, true, has_glob(word), args, arena, dirs);
+}
+
+void expand_argument(std::string_view word, uint8_t flags, arg_list& args,
+    std::pmr::memory_resource* arena, glob::dir_cache& dirs)
+{
+    if (flags == 0) {
+        append_unchanged(word, true, args, arena);
+    } else if (flags & ast::word_flags::BRACES && brace::has_braces(word)) {
+        expand_braced(word, args, arena, dirs);
+    } else {
+        // a quoted glob character doesn't make the word a glob
+        const bool glob {(flags & ast::word_flags::GLOB) != 0};
+        expand_unbraced(word, true, glob, args, arena, dirs);
+    }
+}
+
+void expand_argument(std::string_view word, arg_list& args, std::pmr::memory_resource* arena) {
+    glob::dir_cache dirs {};
+    expand_argument(word, args, arena, dirs);
+}
+
+std::string expand_single(std::string_view word) {
+    return std::string {strip_quotes(expand_word(word, expansion_buffer))};
+}
+
+std::string expand_pattern(std::string_view word) {
+    std::string pattern {};
+    if (!is_quoted(word)) {
+        expand_into(word, pattern, true);
+        return pattern;
+    }
+    for (const char c : strip_quotes(expand_word(word, expansion_buffer))) {
+        append_pattern_literal(c, pattern);
     }
+    return pattern;
 }
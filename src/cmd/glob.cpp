@@ -0,0 +1,366 @@
+#include "cmd/glob.h"
+#include "cmd/expansion.h"
+#include "cmd/walk.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/* Size of the buffer directory entries are read into */
+static const size_t DIRENT_BUFFER_SIZE {64 * 1024};
+
+struct named_class {
+    std::string_view name;
+    int (*contains)(int);
+};
+
+static const std::array<named_class, 12> NAMED_CLASSES {{
+    {"alnum", isalnum},
+    {"alpha", isalpha},
+    {"blank", isblank},
+    {"cntrl", iscntrl},
+    {"digit", isdigit},
+    {"graph", isgraph},
+    {"lower", islower},
+    {"print", isprint},
+    {"punct", ispunct},
+    {"space", isspace},
+    {"upper", isupper},
+    {"xdigit", isxdigit},
+}};
+
+static void add_named_class(std::string_view name, std::bitset<256>& set) {
+    for (const auto& cls : NAMED_CLASSES) {
+        if (cls.name != name)
+            continue;
+        for (int c = 0; c < 256; c++) {
+            if (cls.contains(c))
+                set.set(c);
+        }
+        return;
+    }
+}
+
+/* Parses the bracket expression starting at pos into set. Returns the
+ * position after its closing bracket, or 0 if it isn't terminated and the
+ * bracket has to be taken literally. */
+static size_t parse_bracket(std::string_view pattern, size_t pos, std::bitset<256>& set) {
+    size_t i {pos + 1};
+    const bool negated {i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^')};
+    if (negated)
+        i++;
+
+    // a closing bracket right at the start is a member
+    bool first {true};
+    while (i < pattern.size() && (pattern[i] != ']' || first)) {
+        first = false;
+        if (pattern.substr(i, 2) == "[:") {
+            const size_t end {pattern.find(":]", i + 2)};
+            if (end != std::string_view::npos) {
+                add_named_class(pattern.substr(i + 2, end - i - 2), set);
+                i = end + 2;
+                continue;
+            }
+        }
+        const auto low {static_cast<unsigned char>(pattern[i])};
+        if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+            const auto high {static_cast<unsigned char>(pattern[i + 2])};
+            for (unsigned c = low; c <= high; c++) {
+                set.set(c);
+            }
+            i += 3;
+            continue;
+        }
+        set.set(low);
+        i++;
+    }
+    if (i == pattern.size())
+        return 0;
+
+    if (negated)
+        set.flip();
+    return i + 1;
+}
+
+glob::matcher::matcher(std::string_view pattern) {
+    const auto add_literal {[this](char c) {
+        if (tokens.empty() || tokens.back().type != kind::LITERAL) {
+            tokens.push_back({kind::LITERAL, static_cast<uint32_t>(literals.size()), 0});
+        }
+        literals.push_back(c);
+        tokens.back().length++;
+    }};
+
+    size_t i {};
+    while (i < pattern.size()) {
+        const char c {pattern[i]};
+        if (c == '*') {
+            // adjacent stars match the same as one
+            if (tokens.empty() || tokens.back().type != kind::ANY_STRING)
+                tokens.push_back({kind::ANY_STRING, 0, 0});
+            _magic = true;
+            i++;
+            continue;
+        }
+        if (c == '?') {
+            tokens.push_back({kind::ANY_CHAR, 0, 1});
+            _magic = true;
+            i++;
+            continue;
+        }
+        if (c == '[') {
+            std::bitset<256> set {};
+            const size_t end {parse_bracket(pattern, i, set)};
+            if (end) {
+                tokens.push_back({kind::CHAR_CLASS, static_cast<uint32_t>(classes.size()), 1});
+                classes.push_back(set);
+                _magic = true;
+                i = end;
+                continue;
+            }
+        }
+        add_literal(c);
+        i++;
+    }
+}
+
+bool glob::matcher::matches_class(const token& tok, char c) const {
+    return classes[tok.start].test(static_cast<unsigned char>(c));
+}
+
+bool glob::matcher::matches_at(const token& tok, std::string_view str, size_t pos) const {
+    if (pos + tok.length > str.size())
+        return false;
+    switch (tok.type) {
+        case kind::LITERAL:
+            return str.compare(pos, tok.length, literals, tok.start, tok.length) == 0;
+        case kind::ANY_CHAR:
+            return true;
+        case kind::CHAR_CLASS:
+            return matches_class(tok, str[pos]);
+        case kind::ANY_STRING:
+            break;
+    }
+    return false;
+}
+
+bool glob::matcher::matches(std::string_view str) const {
+    // Segments between stars have a fixed length, so on a mismatch it is
+    // enough to let the last star swallow one more character.
+    size_t t {};
+    size_t pos {};
+    size_t star {std::string_view::npos};
+    size_t star_pos {};
+    while (true) {
+        if (t < tokens.size()) {
+            const token& tok {tokens[t]};
+            if (tok.type == kind::ANY_STRING) {
+                if (t + 1 == tokens.size())
+                    return true;
+                star = t++;
+                star_pos = pos;
+                continue;
+            }
+            if (matches_at(tok, str, pos)) {
+                pos += tok.length;
+                t++;
+                continue;
+            }
+        } else if (pos == str.size()) {
+            return true;
+        }
+
+        if (star == std::string_view::npos || star_pos >= str.size())
+            return false;
+        star_pos++;
+        // skip straight to where the literal after the star could start
+        if (star + 1 < tokens.size() && tokens[star + 1].type == kind::LITERAL) {
+            star_pos = str.find(literals[tokens[star + 1].start], star_pos);
+            if (star_pos == std::string_view::npos)
+                return false;
+        }
+        pos = star_pos;
+        t = star + 1;
+    }
+}
+
+glob::listing glob::read_listing(const std::string& dir) {
+    listing result {};
+    const int fd {open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    if (fd == -1)
+        return result;
+
+    // walks read directories from several threads
+    thread_local std::vector<char> buffer (DIRENT_BUFFER_SIZE);
+    std::vector<std::pair<size_t, unsigned char>> offsets {};
+    ssize_t nread {};
+    while ((nread = getdents64(fd, buffer.data(), buffer.size())) > 0) {
+        for (ssize_t offset = 0; offset < nread;) {
+            const auto* ent {reinterpret_cast<const dirent64*>(buffer.data() + offset)};
+            offset += ent->d_reclen;
+
+            const std::string_view name {ent->d_name};
+            if (name == "." || name == "..")
+                continue;
+            offsets.emplace_back(result.names.size(), ent->d_type);
+            result.names.insert(result.names.end(), name.begin(), name.end());
+            result.names.push_back('\0');
+        }
+    }
+    close(fd);
+
+    // names is complete, so the views into it stay valid
+    result.entries.reserve(offsets.size());
+    for (const auto& [offset, type] : offsets) {
+        result.entries.push_back({result.names.data() + offset, type});
+    }
+    std::sort(result.entries.begin(), result.entries.end(),
+        [](const entry& a, const entry& b) { return a.name < b.name; });
+    return result;
+}
+
+bool glob::is_directory(const entry& e, const std::string& path, bool follow_links) {
+    if (e.type == DT_DIR)
+        return true;
+    if (e.type != DT_UNKNOWN && (e.type != DT_LNK || !follow_links))
+        return false;
+    struct stat st;
+    const int err {follow_links ? stat(path.c_str(), &st) : lstat(path.c_str(), &st)};
+    return err == 0 && S_ISDIR(st.st_mode);
+}
+
+const glob::listing& glob::dir_cache::list(const std::string& dir) {
+    const auto [it, inserted] {listings.try_emplace(dir)};
+    if (inserted)
+        it->second = read_listing(dir);
+    return it->second;
+}
+
+void glob::dir_cache::add(std::string dir, listing contents) {
+    listings.try_emplace(std::move(dir), std::move(contents));
+}
+
+bool glob::has_magic(std::string_view word) {
+    return word.find_first_of("*?[") != std::string_view::npos;
+}
+
+static bool exists(const std::string& path, bool directory) {
+    struct stat st;
+    if (directory)
+        return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    return lstat(path.c_str(), &st) == 0;
+}
+
+/* Expands a ** component, which matches prefix and every directory below
+ * it. The walked directories are added to dirs for the components after
+ * it. */
+static void expand_recursive(const std::string& prefix, bool last, bool directories_only,
+    glob::dir_cache& dirs, arg_list& args, std::vector<std::string>& next,
+    std::pmr::memory_resource* arena)
+{
+    std::string path {};
+    for (auto& dir : walk::tree(prefix)) {
+        if (!last) {
+            next.push_back(dir.path);
+        } else {
+            for (const auto& entry : dir.contents.entries) {
+                if (entry.name.front() == '.')
+                    continue;
+                path = dir.path;
+                path.append(entry.name);
+                if (directories_only) {
+                    if (!glob::is_directory(entry, path, false))
+                        continue;
+                    path.push_back('/');
+                }
+                args.push_back(arena_copy(path, arena));
+            }
+        }
+        dirs.add(std::move(dir.path), std::move(dir.contents));
+    }
+}
+
+size_t glob::expand(std::string_view pattern, dir_cache& dirs, arg_list& args,
+    std::pmr::memory_resource* arena)
+{
+    std::vector<std::string_view> parts {};
+    std::vector<matcher> matchers {};
+    bool magic {false};
+    for (size_t start = 0; start < pattern.size();) {
+        const size_t end {std::min(pattern.find('/', start), pattern.size())};
+        if (end > start) {
+            parts.push_back(pattern.substr(start, end - start));
+            matchers.emplace_back(parts.back());
+            magic |= matchers.back().magic();
+        }
+        start = end + 1;
+    }
+    if (!magic)
+        return 0;
+
+    const bool directories_only {pattern.back() == '/'};
+    const size_t first_match {args.size()};
+    std::vector<std::string> prefixes {pattern.front() == '/' ? "/" : ""};
+    std::vector<std::string> next {};
+    std::string path {};
+    for (size_t i = 0; i < parts.size() && !prefixes.empty(); i++) {
+        const bool last {i + 1 == parts.size()};
+        const matcher& m {matchers[i]};
+        const bool recursive {parts[i] == "**"};
+        for (const auto& prefix : prefixes) {
+            if (recursive) {
+                expand_recursive(prefix, last, directories_only, dirs, args, next, arena);
+                continue;
+            }
+            if (!m.magic()) {
+                path = prefix;
+                path.append(parts[i]);
+                if (!last)
+                    next.push_back(path + '/');
+                else if (exists(path, directories_only))
+                    args.push_back(arena_copy(directories_only ? path + '/' : path, arena));
+                continue;
+            }
+
+            for (const auto& entry : dirs.list(prefix).entries) {
+                if (entry.name.front() == '.' && !m.matches_hidden())
+                    continue;
+                if (!m.matches(entry.name))
+                    continue;
+                path = prefix;
+                path.append(entry.name);
+                if (!last || directories_only) {
+                    if (!is_directory(entry, path, true))
+                        continue;
+                    path.push_back('/');
+                }
+                if (last)
+                    args.push_back(arena_copy(path, arena));
+                else
+                    next.push_back(path);
+            }
+        }
+        // walks of nested prefixes overlap
+        if (recursive) {
+            std::sort(next.begin(), next.end());
+            next.erase(std::unique(next.begin(), next.end()), next.end());
+        }
+        prefixes.swap(next);
+        next.clear();
+    }
+
+    // Listings are sorted, so matches only come out of order when they are
+    // collected from several directories.
+    const auto matches_begin {args.begin() + first_match};
+    if (!std::is_sorted(matches_begin, args.end()))
+        std::sort(matches_begin, args.end());
+    args.erase(std::unique(matches_begin, args.end()), args.end());
+    return args.size() - first_match;
+}
@@ -0,0 +1,302 @@
+#include "cmd/jobs.h"
+#include "cmd/reaper.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstdlib>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Finished jobs nobody waited for are remembered up to this many, so that a
+ * script starting jobs in a loop doesn't keep all of them. */
+static const size_t MAX_DONE_JOBS = 256;
+
+static int tty {-1};
+/* Ordered by id, which only grows while there are jobs */
+static std::vector<jobs::job> job_table {};
+/* Ids of jobs from the least to the most recently started or stopped */
+static std::vector<int> recency {};
+
+void jobs::init_job_control() {
+    if (tty != -1 || !isatty(STDIN_FILENO))
+        return;
+
+    // A shell started in the background waits until it is in the foreground
+    pid_t pgid {};
+    while (tcgetpgrp(STDIN_FILENO) != (pgid = getpgrp())) {
+        kill(-pgid, SIGTTIN);
+    }
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    // Standard input may be redirected for builtins, the terminal can't
+    tty = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (tty == -1) {
+        perror("stush: job control");
+        return;
+    }
+    // fails for a session leader, which already has a group of its own
+    setpgid(0, 0);
+    tcsetpgrp(tty, getpgrp());
+}
+
+bool jobs::job_control() noexcept {
+    return tty != -1;
+}
+
+int jobs::terminal() noexcept {
+    return tty;
+}
+
+void jobs::reset_after_fork() noexcept {
+    if (tty != -1) {
+        close(tty);
+        tty = -1;
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+    }
+    job_table.clear();
+    recency.clear();
+}
+
+static void make_current(int id) {
+    std::erase(recency, id);
+    recency.push_back(id);
+}
+
+static jobs::job* find_pid(pid_t pid) {
+    const auto it {std::ranges::find_if(job_table, [&](const jobs::job& j) {
+        return j.pgid == pid || j.last == pid || std::ranges::find(j.pids, pid) != j.pids.end();
+    })};
+    return it == job_table.end() ? nullptr : &*it;
+}
+
+jobs::job& jobs::add(pid_t pgid, std::vector<pid_t> pids, std::string command) {
+    update();
+    const size_t done {static_cast<size_t>(std::ranges::count(job_table, job_state::DONE, &job::state))};
+    if (done >= MAX_DONE_JOBS) {
+        const auto oldest {std::ranges::find(job_table, job_state::DONE, &job::state)};
+        std::erase(recency, oldest->id);
+        job_table.erase(oldest);
+    }
+
+    const int id {job_table.empty() ? 1 : job_table.back().id + 1};
+    const pid_t last {pids.back()};
+    make_current(id);
+    return job_table.emplace_back(id, pgid, std::move(pids), last, 0, job_state::RUNNING,
+        std::move(command), false);
+}
+
+jobs::job* jobs::find(std::string_view spec) {
+    if (!spec.starts_with('%')) {
+        pid_t pid {};
+        const auto [end, err] {std::from_chars(spec.data(), spec.data() + spec.size(), pid)};
+        if (err != std::errc {} || end != spec.data() + spec.size() || pid <= 0)
+            return nullptr;
+        return find_pid(pid);
+    }
+
+    spec.remove_prefix(1);
+    if (spec.empty() || spec == "%" || spec == "+")
+        return current();
+    if (spec == "-")
+        return recency.size() < 2 ? nullptr : find(recency[recency.size() - 2]);
+    int id {};
+    const auto [end, err] {std::from_chars(spec.data(), spec.data() + spec.size(), id)};
+    if (err == std::errc {} && end == spec.data() + spec.size())
+        return find(id);
+    // %name is the job whose command starts with name
+    const auto it {std::ranges::find_if(job_table, [&](const job& j) { return j.command.starts_with(spec); })};
+    return it == job_table.end() ? nullptr : &*it;
+}
+
+jobs::job* jobs::find(int id) {
+    const auto it {std::ranges::find(job_table, id, &job::id)};
+    return it == job_table.end() ? nullptr : &*it;
+}
+
+jobs::job* jobs::current() {
+    return recency.empty() ? nullptr : find(recency.back());
+}
+
+const std::vector<jobs::job>& jobs::table() noexcept {
+    return job_table;
+}
+
+/* Updates the job a child belongs to. */
+static void apply(const reaper::child_exit& child) {
+    jobs::job* j {find_pid(child.pid)};
+    if (!j)
+        return;
+    if (WIFSTOPPED(child.status)) {
+        if (j->state == jobs::job_state::RUNNING) {
+            j->state = jobs::job_state::STOPPED;
+            j->changed = true;
+            make_current(j->id);
+        }
+        return;
+    }
+    std::erase(j->pids, child.pid);
+    if (child.pid == j->last)
+        j->status = reaper::exit_status(child.status);
+    if (j->pids.empty()) {
+        j->state = jobs::job_state::DONE;
+        j->changed = true;
+    }
+}
+
+void jobs::update() {
+    reaper::poll();
+    std::vector<pid_t> pids {};
+    for (const job& j : job_table) {
+        pids.insert(pids.end(), j.pids.begin(), j.pids.end());
+    }
+    while (!pids.empty()) {
+        const auto child {reaper::wait_any(pids, reaper::clock::now())};
+        if (!child)
+            return;
+        apply(*child);
+        if (!WIFSTOPPED(child->status))
+            std::erase(pids, child->pid);
+    }
+}
+
+int jobs::wait(job& j, bool until_stopped) {
+    while (j.state != job_state::DONE) {
+        const auto child {reaper::wait_any(j.pids)};
+        if (!child) {
+            // somebody else has reaped them
+            j.pids.clear();
+            j.state = job_state::DONE;
+            j.changed = true;
+            break;
+        }
+        apply(*child);
+        if (until_stopped && WIFSTOPPED(child->status))
+            return reaper::exit_status(child->status);
+    }
+    return j.status;
+}
+
+jobs::job* jobs::wait_next(std::span<const int> ids) {
+    const auto is_candidate {[&](const job& j) {
+        if (ids.empty())
+            return j.state != job_state::STOPPED;
+        return std::ranges::find(ids, j.id) != ids.end();
+    }};
+
+    update();
+    while (true) {
+        std::vector<pid_t> pids {};
+        for (job& j : job_table) {
+            if (!is_candidate(j))
+                continue;
+            if (j.state == job_state::DONE)
+                return &j;
+            pids.insert(pids.end(), j.pids.begin(), j.pids.end());
+        }
+        if (pids.empty())
+            return nullptr;
+
+        if (const auto child {reaper::wait_any(pids)}) {
+            apply(*child);
+            continue;
+        }
+        // somebody else has reaped them
+        for (job& j : job_table) {
+            if (is_candidate(j) && j.state != job_state::DONE) {
+                j.pids.clear();
+                j.state = job_state::DONE;
+                j.changed = true;
+            }
+        }
+    }
+}
+
+int jobs::resume(job& j, bool foreground) {
+    make_current(j.id);
+    j.state = job_state::RUNNING;
+    j.changed = false;
+    if (!foreground) {
+        kill(-j.pgid, SIGCONT);
+        return EXIT_SUCCESS;
+    }
+
+    const int status {[&] {
+        const jobs::foreground fg {j.pgid};
+        kill(-j.pgid, SIGCONT);
+        return wait(j, true);
+    }()};
+    // a job brought to the foreground isn't reported once it's done
+    if (j.state == job_state::DONE)
+        remove(j);
+    return status;
+}
+
+void jobs::remove(const job& j) {
+    // j is one of the jobs that are moved around while erasing
+    const int id {j.id};
+    std::erase(recency, id);
+    std::erase_if(job_table, [&](const job& other) { return other.id == id; });
+}
+
+std::string jobs::describe(const job& j) {
+    char marker {' '};
+    if (!recency.empty() && recency.back() == j.id)
+        marker = '+';
+    else if (recency.size() > 1 && recency[recency.size() - 2] == j.id)
+        marker = '-';
+
+    std::string state {};
+    switch (j.state) {
+        case job_state::RUNNING:
+            state = "Running";
+            break;
+        case job_state::STOPPED:
+            state = "Stopped";
+            break;
+        case job_state::DONE:
+            state = j.status == EXIT_SUCCESS ? "Done" : "Exit " + std::to_string(j.status);
+            break;
+    }
+    state.resize(std::max<size_t>(state.size() + 1, 24), ' ');
+    return '[' + std::to_string(j.id) + ']' + marker + "  " + state + j.command;
+}
+
+std::string jobs::notify() {
+    update();
+    std::string report {};
+    for (job& j : job_table) {
+        if (!j.changed)
+            continue;
+        report += describe(j);
+        report += '\n';
+        j.changed = false;
+    }
+    for (const job& j : job_table) {
+        if (j.state == job_state::DONE)
+            std::erase(recency, j.id);
+    }
+    std::erase_if(job_table, [](const job& j) { return j.state == job_state::DONE; });
+    return report;
+}
+
+jobs::foreground::foreground(pid_t pgid) : pgid(job_control() ? pgid : -1) {
+    if (this->pgid <= 0)
+        return;
+    tcgetattr(tty, &modes);
+    tcsetpgrp(tty, this->pgid);
+}
+
+jobs::foreground::~foreground() {
+    if (pgid <= 0)
+        return;
+    tcsetpgrp(tty, getpgrp());
+    // whatever the job did to the terminal stays with it
+    tcsetattr(tty, TCSADRAIN, &modes);
+}
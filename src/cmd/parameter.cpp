@@ -0,0 +1,286 @@
+#include "cmd/parameter.h"
+#include "cmd/expansion.h"
+#include "cmd/glob.h"
+#include "stringhash.h"
+#include "stringsep.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/* Compiled patterns are dropped all at once when there are more than this */
+static const size_t MAX_PATTERNS {256};
+
+namespace {
+
+/* A pattern of #, % or /. Literal patterns are compared as they are. */
+struct pattern {
+    std::string text;
+    glob::matcher matcher;
+};
+
+}
+
+static string_map<pattern> patterns {};
+
+static const pattern& compile(std::string_view text) {
+    if (const auto it {patterns.find(text)}; it != patterns.end())
+        return it->second;
+    if (patterns.size() == MAX_PATTERNS)
+        patterns.clear();
+    std::string key {text};
+    return patterns.try_emplace(key, pattern {key, glob::matcher {text}}).first->second;
+}
+
+[[noreturn]]
+static void bad_substitution(std::string_view expr) {
+    throw expansion_error("${" + std::string {expr} + "}: bad substitution");
+}
+
+/* Returns the position of the first c in text at or after pos that isn't
+ * escaped, quoted or nested in another ${ }, text.size() if there is none. */
+static size_t find_unquoted(std::string_view text, size_t pos, char c) {
+    for (size_t i = pos; i < text.size(); i++) {
+        if (text[i] == c)
+            return i;
+        if (text[i] == sep::ESCAPE_CHAR) {
+            i++;
+        } else if (text[i] == '\'') {
+            i = std::min(text.find('\'', i + 1), text.size());
+        } else if (text[i] == sep::VAR_PREFIX && i + 1 < text.size() && text[i + 1] == '{') {
+            i = std::min(param::find_end(text, i), text.size()) - 1;
+        }
+    }
+    return text.size();
+}
+
+size_t param::find_end(std::string_view word, size_t start) {
+    size_t depth {};
+    for (size_t i = start; i < word.size(); i++) {
+        const char c {word[i]};
+        if (c == sep::ESCAPE_CHAR) {
+            i++;
+        } else if (c == '\'') {
+            i = word.find('\'', i + 1);
+            if (i == std::string_view::npos)
+                return i;
+        } else if (c == sep::VAR_PREFIX && i + 1 < word.size() && word[i + 1] == '{') {
+            depth++;
+            i++;
+        } else if (c == '}' && --depth == 0) {
+            return i + 1;
+        }
+    }
+    return std::string_view::npos;
+}
+
+/* Expands an operand of an operator into buffer and removes its quotes. */
+static std::string_view expand_operand(std::string_view operand, std::string& buffer) {
+    return strip_quotes(expand_word(operand, buffer));
+}
+
+/* Returns the end of the parameter name expr starts with, 0 if it doesn't
+ * start with one. */
+static size_t name_end(std::string_view expr) {
+    if (expr.empty())
+        return 0;
+    const auto is_digit {[](char c) { return std::isdigit(static_cast<unsigned char>(c)); }};
+    if (expr.front() == '?' || expr.front() == '#' || expr.front() == '!')
+        return 1;
+    if (is_digit(expr.front()))
+        return std::find_if_not(expr.begin(), expr.end(), is_digit) - expr.begin();
+    const auto is_name_char {[](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; }};
+    return std::find_if_not(expr.begin(), expr.end(), is_name_char) - expr.begin();
+}
+
+static std::string_view remove_prefix(std::string_view value, const pattern& p, bool longest) {
+    if (!p.matcher.magic())
+        return value.starts_with(p.text) ? value.substr(p.text.size()) : value;
+    for (size_t i = 0; i <= value.size(); i++) {
+        const size_t length {longest ? value.size() - i : i};
+        if (p.matcher.matches(value.substr(0, length)))
+            return value.substr(length);
+    }
+    return value;
+}
+
+static std::string_view remove_suffix(std::string_view value, const pattern& p, bool longest) {
+    if (!p.matcher.magic())
+        return value.ends_with(p.text) ? value.substr(0, value.size() - p.text.size()) : value;
+    for (size_t i = 0; i <= value.size(); i++) {
+        const size_t start {longest ? i : value.size() - i};
+        if (p.matcher.matches(value.substr(start)))
+            return value.substr(0, start);
+    }
+    return value;
+}
+
+/* Returns the length of the longest match of p starting at pos, or
+ * std::string_view::npos if there is none. The match has to reach the end
+ * of value if to_end is set. */
+static size_t longest_match(std::string_view value, size_t pos, const pattern& p, bool to_end) {
+    if (!p.matcher.magic()) {
+        const bool found {value.compare(pos, p.text.size(), p.text) == 0 &&
+            (!to_end || pos + p.text.size() == value.size())};
+        return found ? p.text.size() : std::string_view::npos;
+    }
+    for (size_t end = value.size(); end >= pos; end--) {
+        if (p.matcher.matches(value.substr(pos, end - pos)))
+            return end - pos;
+        if (to_end || end == pos)
+            break;
+    }
+    return std::string_view::npos;
+}
+
+/* ${name/pattern/string} and its variants, anchored by # or % before the
+ * pattern and replacing every match when the / is doubled. */
+static void replace(std::string_view value, std::string_view operands, std::string& out) {
+    bool all {false};
+    bool at_start {false};
+    bool at_end {false};
+    if (!operands.empty() && operands.front() == '/') {
+        all = true;
+        operands.remove_prefix(1);
+    } else if (!operands.empty() && operands.front() == '#') {
+        at_start = true;
+        operands.remove_prefix(1);
+    } else if (!operands.empty() && operands.front() == '%') {
+        at_end = true;
+        operands.remove_prefix(1);
+    }
+
+    const size_t slash {find_unquoted(operands, 0, '/')};
+    std::string pattern_buffer {};
+    std::string replacement_buffer {};
+    const std::string_view replacement {slash < operands.size()
+        ? expand_operand(operands.substr(slash + 1), replacement_buffer) : ""};
+    // compiled last, expanding the replacement may compile other patterns
+    const pattern& p {compile(expand_operand(operands.substr(0, slash), pattern_buffer))};
+    if (p.text.empty()) {
+        out.append(value);
+        return;
+    }
+
+    size_t pos {};
+    while (pos < value.size()) {
+        if (at_start && pos > 0)
+            break;
+        size_t length {std::string_view::npos};
+        // a literal pattern can only match where its first character is
+        if (!p.matcher.magic() && !at_start && !at_end) {
+            const size_t found {value.find(p.text, pos)};
+            if (found == std::string_view::npos)
+                break;
+            out.append(value, pos, found - pos);
+            pos = found;
+            length = p.text.size();
+        } else {
+            length = longest_match(value, pos, p, at_end);
+        }
+
+        if (length == std::string_view::npos || length == 0) {
+            out.push_back(value[pos++]);
+            continue;
+        }
+        out.append(replacement);
+        pos += length;
+        if (!all)
+            break;
+    }
+    out.append(value.substr(std::min(pos, value.size())));
+}
+
+static bool parse_offset(std::string_view text, std::string& buffer, int64_t& result) {
+    std::string_view number {expand_operand(text, buffer)};
+    while (!number.empty() && std::isspace(static_cast<unsigned char>(number.front())))
+        number.remove_prefix(1);
+    while (!number.empty() && std::isspace(static_cast<unsigned char>(number.back())))
+        number.remove_suffix(1);
+    const auto [end, err] {std::from_chars(number.data(), number.data() + number.size(), result)};
+    return !number.empty() && err == std::errc {} && end == number.data() + number.size();
+}
+
+/* ${name:offset} and ${name:offset:length}. Negative numbers count from
+ * the end of the value. */
+static void substring(std::string_view expr, std::string_view value, std::string_view operands,
+    std::string& out)
+{
+    const size_t colon {find_unquoted(operands, 0, ':')};
+    std::string buffer {};
+    int64_t offset {};
+    if (!parse_offset(operands.substr(0, colon), buffer, offset))
+        bad_substitution(expr);
+    const auto size {static_cast<int64_t>(value.size())};
+    if (offset < 0)
+        offset += size;
+    if (offset < 0 || offset > size)
+        return;
+
+    int64_t end {size};
+    if (colon < operands.size()) {
+        int64_t length {};
+        if (!parse_offset(operands.substr(colon + 1), buffer, length))
+            bad_substitution(expr);
+        end = length < 0 ? size + length : std::min(offset + length, size);
+    }
+    if (end > offset)
+        out.append(value.substr(offset, end - offset));
+}
+
+void param::expand(std::string_view expr, std::string& out) {
+    std::string scratch {};
+    if (expr.size() > 1 && expr.front() == '#') {
+        const std::string_view name {expr.substr(1)};
+        if (name_end(name) != name.size())
+            bad_substitution(expr);
+        out.append(std::to_string(find_parameter(name, scratch).value_or("").size()));
+        return;
+    }
+
+    const size_t end {name_end(expr)};
+    if (end == 0)
+        bad_substitution(expr);
+    const std::optional<std::string_view> found {find_parameter(expr.substr(0, end), scratch)};
+    const std::string_view value {found.value_or("")};
+    const std::string_view op {expr.substr(end)};
+    if (op.empty()) {
+        out.append(value);
+        return;
+    }
+
+    std::string buffer {};
+    switch (op.front()) {
+        case ':': {
+            if (op.size() > 1 && op[1] == '-') {
+                out.append(value.empty() ? expand_operand(op.substr(2), buffer) : value);
+                return;
+            }
+            substring(expr, value, op.substr(1), out);
+            return;
+        }
+        case '-': {
+            out.append(found ? value : expand_operand(op.substr(1), buffer));
+            return;
+        }
+        case '#': {
+            const bool longest {op.size() > 1 && op[1] == '#'};
+            const pattern& p {compile(expand_operand(op.substr(longest ? 2 : 1), buffer))};
+            out.append(remove_prefix(value, p, longest));
+            return;
+        }
+        case '%': {
+            const bool longest {op.size() > 1 && op[1] == '%'};
+            const pattern& p {compile(expand_operand(op.substr(longest ? 2 : 1), buffer))};
+            out.append(remove_suffix(value, p, longest));
+            return;
+        }
+        case '/': {
+            replace(value, op.substr(1), out);
+            return;
+        }
+    }
+    bad_substitution(expr);
+}
@@ -0,0 +1,225 @@
+#include "cmd/reaper.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+static bool initialized {false};
+static sigset_t original_mask {};
+static int signal_fd {-1};
+static int epoll_fd {-1};
+/* Children that have exited and haven't been asked for, oldest first */
+static std::deque<reaper::child_exit> exited {};
+
+/* When a child started, and the serial of the last account opened before */
+struct start {
+    reaper::clock::time_point time;
+    uint64_t serial;
+};
+
+struct open_account {
+    uint64_t serial;
+    reaper::account* account;
+};
+
+static std::unordered_map<pid_t, start> started {};
+/* Serials only grow, so the accounts a child counts towards are the open
+ * ones that aren't newer than it. */
+static std::vector<open_account> accounts {};
+static uint64_t last_serial {};
+
+reaper::account::account() {
+    accounts.push_back({++last_serial, this});
+}
+
+reaper::account::~account() {
+    std::erase_if(accounts, [this](const open_account& open) { return open.account == this; });
+}
+
+static std::chrono::microseconds microseconds(const timeval& t) {
+    return std::chrono::seconds {t.tv_sec} + std::chrono::microseconds {t.tv_usec};
+}
+
+/* Adds what a child used to the accounts that were open when it started. */
+static void charge(const rusage& usage, uint64_t serial) {
+    for (const auto& open : accounts) {
+        if (open.serial > serial)
+            break;
+        open.account->user += microseconds(usage.ru_utime);
+        open.account->sys += microseconds(usage.ru_stime);
+        open.account->max_rss = std::max(open.account->max_rss, usage.ru_maxrss);
+    }
+}
+
+void reaper::init() {
+    if (initialized)
+        return;
+    initialized = true;
+
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &original_mask);
+    sigdelset(&original_mask, SIGCHLD);
+
+    signal_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event {.events = EPOLLIN, .data = {.fd = signal_fd}};
+    if (signal_fd == -1 || epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) == -1) {
+        // children are still reaped, just without timeouts
+        perror("stush: reaper");
+        if (signal_fd != -1)
+            close(signal_fd);
+        if (epoll_fd != -1)
+            close(epoll_fd);
+        signal_fd = epoll_fd = -1;
+    }
+}
+
+const sigset_t& reaper::child_sigmask() {
+    init();
+    return original_mask;
+}
+
+void reaper::watch(pid_t pid, clock::time_point time) {
+    init();
+    started.insert_or_assign(pid, start {time, last_serial});
+}
+
+/* Reaps every child that has exited. With block set, waits for at least
+ * one if none has. Returns how many there were. */
+static size_t reap(bool block) {
+    size_t count {};
+    while (true) {
+        reaper::child_exit child {};
+        const pid_t pid {wait4(-1, &child.status, WUNTRACED | (block ? 0 : WNOHANG), &child.usage)};
+        if (pid == -1 && errno == EINTR)
+            continue;
+        if (pid <= 0)
+            return count;
+        block = false;
+        count++;
+        child.pid = pid;
+        // a stopped child is still running, as far as its time goes
+        if (const auto it {started.find(pid)}; it != started.end() && !WIFSTOPPED(child.status)) {
+            child.elapsed = reaper::clock::now() - it->second.time;
+            charge(child.usage, it->second.serial);
+            started.erase(it);
+        }
+        exited.push_back(child);
+    }
+}
+
+static std::optional<reaper::child_exit> take(std::span<const pid_t> pids) {
+    const auto it {std::ranges::find_if(exited, [&](const reaper::child_exit& child) {
+        return std::ranges::find(pids, child.pid) != pids.end();
+    })};
+    if (it == exited.end())
+        return std::nullopt;
+    const reaper::child_exit child {*it};
+    exited.erase(it);
+    return child;
+}
+
+/* Whether pid is a child that hasn't been reaped yet. */
+static bool is_child(pid_t pid) {
+    siginfo_t info {};
+    return waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0;
+}
+
+static void drain_signals() {
+    signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {}
+}
+
+/* Waits until SIGCHLD arrives or deadline passes. Returns false on the
+ * deadline. */
+static bool wait_for_signal(reaper::clock::time_point deadline) {
+    int timeout {-1};
+    if (deadline != reaper::clock::time_point::max()) {
+        const auto left {std::chrono::ceil<std::chrono::milliseconds>(deadline - reaper::clock::now())};
+        if (left.count() <= 0)
+            return false;
+        timeout = static_cast<int>(std::min<long long>(left.count(), INT32_MAX));
+    }
+
+    epoll_event event;
+    const int ready {epoll_wait(epoll_fd, &event, 1, timeout)};
+    if (ready == 0)
+        return false;
+    drain_signals();
+    return true;
+}
+
+int reaper::exit_status(int status) noexcept {
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return WEXITSTATUS(status);
+}
+
+int reaper::fd() {
+    init();
+    return epoll_fd;
+}
+
+void reaper::poll() {
+    init();
+    // signals that arrive after this are for children the reap below may miss
+    if (signal_fd != -1)
+        drain_signals();
+    reap(false);
+}
+
+std::optional<reaper::child_exit> reaper::wait_any(std::span<const pid_t> pids,
+    clock::time_point deadline)
+{
+    init();
+    while (true) {
+        reap(false);
+        if (auto child {take(pids)})
+            return child;
+        // nothing would ever wake us up
+        if (std::ranges::none_of(pids, is_child))
+            return std::nullopt;
+        if (epoll_fd == -1) {
+            if (reap(true) == 0)
+                return std::nullopt;
+            continue;
+        }
+        if (!wait_for_signal(deadline)) {
+            // one last look, the child may have exited right at the deadline
+            reap(false);
+            return take(pids);
+        }
+    }
+}
+
+std::optional<reaper::child_exit> reaper::wait(pid_t pid, clock::time_point deadline) {
+    return wait_any({&pid, 1}, deadline);
+}
+
+void reaper::reset_after_fork() noexcept {
+    if (!initialized)
+        return;
+    if (signal_fd != -1)
+        close(signal_fd);
+    if (epoll_fd != -1)
+        close(epoll_fd);
+    signal_fd = epoll_fd = -1;
+    exited.clear();
+    started.clear();
+    // what the copy starts is accounted for in the copy
+    accounts.clear();
+    // set up again when the copy starts children of its own
+    sigprocmask(SIG_SETMASK, &original_mask, nullptr);
+    initialized = false;
+}
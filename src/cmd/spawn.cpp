@@ -0,0 +1,183 @@
+#include "cmd/spawn.h"
+#include "cmd/cmdhash.h"
+#include "cmd/jobs.h"
+#include "cmd/reaper.h"
+#include "cmd/variable.h"
+#include "trace.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <spawn.h>
+#include <string>
+#include <vector>
+
+/* Runs executable files that the kernel doesn't know how to load */
+static const char* const SCRIPT_SHELL {"/bin/sh"};
+
+/* RAII wrapper around posix_spawn's file actions and attributes. */
+class spawn_context {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+
+public:
+    spawn_context(const spawn_fds& fds, const spawn_group& group) {
+        posix_spawn_file_actions_init(&actions);
+        posix_spawnattr_init(&attr);
+
+        if (fds.in != STDIN_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, fds.in, STDIN_FILENO);
+        if (fds.out != STDOUT_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, fds.out, STDOUT_FILENO);
+        if (fds.err != STDERR_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, fds.err, STDERR_FILENO);
+        for (int fd : fds.close_fds) {
+            posix_spawn_file_actions_addclose(&actions, fd);
+        }
+
+        short flags {POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_USEVFORK};
+        if (group.pgid != NO_PGROUP) {
+            posix_spawnattr_setpgroup(&attr, group.pgid);
+            flags |= POSIX_SPAWN_SETPGROUP;
+        }
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 35)
+        // Taking the terminal before exec, the command can't read from it
+        // while it is still in the background
+        if (group.terminal != -1)
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, group.terminal);
+#endif
+
+        // The shell ignores some signals, children should get the defaults back
+        sigset_t defaults;
+        sigemptyset(&defaults);
+        for (const int sig : {SIGINT, SIGPIPE, SIGTSTP, SIGTTIN, SIGTTOU}) {
+            sigaddset(&defaults, sig);
+        }
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        // SIGCHLD is only blocked for the reaper
+        posix_spawnattr_setsigmask(&attr, &reaper::child_sigmask());
+        posix_spawnattr_setflags(&attr, flags);
+    }
+
+    ~spawn_context() {
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+    }
+
+    spawn_context(const spawn_context&) = delete;
+    spawn_context& operator=(const spawn_context&) = delete;
+
+    const posix_spawn_file_actions_t* file_actions() const {
+        return &actions;
+    }
+
+    const posix_spawnattr_t* attributes() const {
+        return &attr;
+    }
+};
+
+pid_t spawn_command(args_view args, const spawn_fds& fds, int& status, const spawn_group& group) {
+    std::vector<char*> argv (args.size() + 1);
+    for (size_t i = 0; i < args.size(); i++) {
+        argv[i] = const_cast<char*>(args[i].data());
+    }
+    argv[args.size()] = nullptr;
+
+    // With vfork, posix_spawn only returns once the child has exec'd
+    trace::span span {"spawn"};
+    span.args.command = args[0];
+    const spawn_context ctx {fds, group};
+    bool cached {};
+    std::string path {cmdhash::resolve(args[0], cached)};
+    const reaper::clock::time_point started {reaper::clock::now()};
+    pid_t pid {};
+    int err {ENOENT};
+    if (!path.empty()) {
+        err = posix_spawn(&pid, path.c_str(), ctx.file_actions(), ctx.attributes(),
+            argv.data(), var::environment());
+    }
+    // The cached binary might have been removed or moved since it was hashed
+    if (err == ENOENT && cached) {
+        cmdhash::forget(args[0]);
+        path = cmdhash::resolve(args[0]);
+        if (!path.empty()) {
+            err = posix_spawn(&pid, path.c_str(), ctx.file_actions(), ctx.attributes(),
+                argv.data(), var::environment());
+        }
+    }
+    // Like execvp, take a file without a #! line for a shell script
+    if (err == ENOEXEC) {
+        std::vector<char*> script_argv {const_cast<char*>(SCRIPT_SHELL), path.data()};
+        script_argv.insert(script_argv.end(), argv.begin() + 1, argv.end());
+        err = posix_spawn(&pid, SCRIPT_SHELL, ctx.file_actions(), ctx.attributes(),
+            script_argv.data(), var::environment());
+    }
+
+    if (path.empty()) {
+        std::cerr << "stush: " << args[0] << ": command not found\n";
+        status = SPAWN_NOT_FOUND;
+        span.args.status = status;
+        return -1;
+    }
+    if (err) {
+        std::cerr << "stush: " << args[0] << ": " << strerror(err) << '\n';
+        status = err == ENOENT ? SPAWN_NOT_FOUND : SPAWN_NOT_EXECUTABLE;
+        span.args.status = status;
+        return -1;
+    }
+    span.args.pid = pid;
+    reaper::watch(pid, started);
+    return pid;
+}
+
+pid_t spawn_subshell(const spawn_fds& fds, const std::function<int()>& body,
+    const spawn_group& group)
+{
+    // whatever is still buffered would be written by both processes
+    std::cout.flush();
+    std::cerr.flush();
+    reaper::init();
+    trace::span span {"fork"};
+    const reaper::clock::time_point started {reaper::clock::now()};
+    const pid_t pid {fork()};
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid > 0) {
+        span.args.pid = pid;
+        // both sides set the group, so that it is there whichever runs first
+        if (group.pgid != NO_PGROUP)
+            setpgid(pid, group.pgid == 0 ? pid : group.pgid);
+        reaper::watch(pid, started);
+        return pid;
+    }
+
+    if (group.pgid != NO_PGROUP) {
+        setpgid(0, group.pgid);
+        if (group.terminal != -1)
+            tcsetpgrp(group.terminal, getpgrp());
+    }
+    reaper::reset_after_fork();
+    jobs::reset_after_fork();
+    trace::reset_after_fork();
+    signal(SIGINT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    if (fds.in != STDIN_FILENO)
+        dup2(fds.in, STDIN_FILENO);
+    if (fds.out != STDOUT_FILENO)
+        dup2(fds.out, STDOUT_FILENO);
+    if (fds.err != STDERR_FILENO)
+        dup2(fds.err, STDERR_FILENO);
+    for (int fd : fds.close_fds) {
+        if (fd != -1)
+            close(fd);
+    }
+
+    const int status {body()};
+    std::cout.flush();
+    std::cerr.flush();
+    trace::flush();
+    _exit(status);
+}
@@ -0,0 +1,76 @@
+#include "cmd/tilde.h"
+#include "cmd/variable.h"
+#include "stringhash.h"
+#include <cerrno>
+#include <ctime>
+#include <pwd.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static const char* const PASSWD_PATH {"/etc/passwd"};
+/* Used when sysconf doesn't know how large passwd entries can get */
+static const size_t DEFAULT_BUFFER_SIZE {1024};
+
+/* Users that don't exist are remembered as well */
+static string_map<std::optional<std::string>> homes {};
+static timespec passwd_mtime {};
+
+static std::optional<std::string> cached_home {};
+static bool home_valid {false};
+
+/* Clears the memo table if /etc/passwd has been modified since it was
+ * filled. */
+static void check_passwd() {
+    struct stat st;
+    const timespec mtime {stat(PASSWD_PATH, &st) == 0 ? st.st_mtim : timespec {}};
+    if (mtime.tv_sec != passwd_mtime.tv_sec || mtime.tv_nsec != passwd_mtime.tv_nsec) {
+        homes.clear();
+        passwd_mtime = mtime;
+    }
+}
+
+static std::optional<std::string> lookup_home(const std::string& user) {
+    const long max_size {sysconf(_SC_GETPW_R_SIZE_MAX)};
+    std::vector<char> buffer (max_size > 0 ? max_size : DEFAULT_BUFFER_SIZE);
+    passwd entry;
+    passwd* result {};
+    int err {};
+    while ((err = getpwnam_r(user.c_str(), &entry, buffer.data(), buffer.size(), &result)) == ERANGE) {
+        buffer.resize(buffer.size() * 2);
+    }
+    if (err || !result)
+        return std::nullopt;
+    return result->pw_dir;
+}
+
+std::optional<std::string_view> tilde::home() {
+    if (!home_valid) {
+        // whoever changes HOME next, the cached value goes with it
+        var::watch("HOME", forget_home);
+        const auto env {var::find("HOME")};
+        cached_home = env ? std::optional<std::string> {*env} : std::nullopt;
+        home_valid = true;
+    }
+    return cached_home;
+}
+
+std::optional<std::string_view> tilde::home_of(std::string_view user) {
+    check_passwd();
+    auto it {homes.find(user)};
+    if (it == homes.end()) {
+        std::string name {user};
+        auto home {lookup_home(name)};
+        it = homes.emplace(std::move(name), std::move(home)).first;
+    }
+    return it->second;
+}
+
+void tilde::forget_home() noexcept {
+    home_valid = false;
+}
+
+void tilde::clear() noexcept {
+    homes.clear();
+}
@@ -1,22 +1,285 @@
 #include "cmd/variable.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <stdexcept>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
 
-std::unordered_map<std::string, std::string> shell_vars {};
+namespace {
 
-void var::set_var(const std::string& var, const std::string& value) noexcept {
-    shell_vars[var] = value;
+/* Variables are never removed, unsetting one only clears set, so that its
+ * interned name and its place in the table stay for the next time it is
+ * set. */
+struct variable {
+    std::string name;
+    std::string value;
+    bool set;
+    bool exported;
+    var::watcher on_change;
+};
+
+/* Open addressing hash table with linear probing over the indices of
+ * variables. The variables themselves live in a deque, so references to
+ * them stay valid when the table grows. */
+class variable_table {
+    static constexpr uint32_t EMPTY {UINT32_MAX};
+    static constexpr size_t MIN_CAPACITY {64};
+
+    struct slot {
+        uint32_t hash;
+        uint32_t index;
+    };
+
+    std::vector<slot> slots {};
+    std::deque<variable> vars {};
+
+    static uint32_t hash(std::string_view name) noexcept {
+        return static_cast<uint32_t>(std::hash<std::string_view> {}(name));
+    }
+
+    void place(slot s) noexcept {
+        const size_t mask {slots.size() - 1};
+        size_t i {s.hash & mask};
+        while (slots[i].index != EMPTY) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = s;
+    }
+
+    void grow() {
+        std::vector<slot> old (std::max(slots.size() * 2, MIN_CAPACITY), slot {0, EMPTY});
+        old.swap(slots);
+        for (const slot& s : old) {
+            if (s.index != EMPTY)
+                place(s);
+        }
+    }
+
+public:
+    /* Returns the variable called name, nullptr if there never was one. */
+    variable* find(std::string_view name) noexcept {
+        if (slots.empty())
+            return nullptr;
+        const uint32_t h {hash(name)};
+        const size_t mask {slots.size() - 1};
+        for (size_t i = h & mask; slots[i].index != EMPTY; i = (i + 1) & mask) {
+            if (slots[i].hash == h && vars[slots[i].index].name == name)
+                return &vars[slots[i].index];
+        }
+        return nullptr;
+    }
+
+    /* Returns the variable called name, adding it unset if there never was
+     * one. */
+    variable& intern(std::string_view name) {
+        if (variable* var {find(name)})
+            return *var;
+        // kept at most half full, so that probe sequences stay short
+        if ((vars.size() + 1) * 2 > slots.size())
+            grow();
+        place({hash(name), static_cast<uint32_t>(vars.size())});
+        return vars.emplace_back(std::string {name}, std::string {}, false, false, nullptr);
+    }
+
+    const std::deque<variable>& all() const noexcept {
+        return vars;
+    }
+};
+
+/* What a local variable hid, restored when its scope ends. */
+struct saved_variable {
+    variable* var;
+    std::string value;
+    bool set;
+    bool exported;
+};
+
+}
+
+/* Starts out with the environment of the shell, exported. */
+static variable_table from_environment() {
+    variable_table vars {};
+    for (char** entry = environ; *entry; entry++) {
+        const std::string_view str {*entry};
+        const size_t equals {str.find('=')};
+        if (equals == 0 || equals == std::string_view::npos)
+            continue;
+        variable& var {vars.intern(str.substr(0, equals))};
+        if (var.set)
+            continue;
+        var.value = str.substr(equals + 1);
+        var.set = true;
+        var.exported = true;
+    }
+    return vars;
+}
+
+static variable_table shell_vars {from_environment()};
+static std::vector<std::vector<saved_variable>> scopes {};
+static int status {};
+static pid_t last_job {};
+// The bottom frame holds the parameters of the script
+static std::vector<std::vector<std::string>> positional_frames {{}};
+
+// NAME=value strings of exported variables, one after another, and pointers
+// to each of them for envp
+static std::vector<char> env_strings {};
+static std::vector<char*> envp {};
+static bool env_changed {true};
+
+static void changed(const variable& var) noexcept {
+    if (var.on_change)
+        var.on_change();
+}
+
+static void assign(variable& var, std::string_view value) {
+    var.value.assign(value);
+    var.set = true;
+    env_changed |= var.exported;
+    changed(var);
+}
+
+void var::set_var(std::string_view var, std::string_view value) {
+    assign(shell_vars.intern(var), value);
+}
+
+bool var::is_set(std::string_view var) noexcept {
+    return find(var).has_value();
+}
+
+void var::unset(std::string_view var) noexcept {
+    variable* found {shell_vars.find(var)};
+    if (!found || !found->set)
+        return;
+    env_changed |= found->exported;
+    found->value.clear();
+    found->set = false;
+    found->exported = false;
+    changed(*found);
+}
+
+const std::string& var::get_var(std::string_view var) {
+    const variable* found {shell_vars.find(var)};
+    if (!found || !found->set)
+        throw std::out_of_range("variable not set");
+    return found->value;
+}
+
+std::optional<std::string_view> var::find(std::string_view var) noexcept {
+    const variable* found {shell_vars.find(var)};
+    if (!found || !found->set)
+        return std::nullopt;
+    return found->value;
+}
+
+void var::export_var(std::string_view var) {
+    variable& found {shell_vars.intern(var)};
+    if (!found.set) {
+        found.value.clear();
+        found.set = true;
+        changed(found);
+    }
+    env_changed |= !found.exported;
+    found.exported = true;
+}
+
+bool var::is_exported(std::string_view var) noexcept {
+    const variable* found {shell_vars.find(var)};
+    return found && found->set && found->exported;
+}
+
+void var::watch(std::string_view var, watcher on_change) {
+    shell_vars.intern(var).on_change = on_change;
+}
+
+void var::push_scope() {
+    scopes.emplace_back();
+}
+
+void var::set_local(std::string_view var, std::string_view value) {
+    variable& found {shell_vars.intern(var)};
+    if (!scopes.empty()) {
+        auto& scope {scopes.back()};
+        const bool saved {std::ranges::any_of(scope, [&](const saved_variable& s) { return s.var == &found; })};
+        if (!saved)
+            scope.push_back({&found, found.value, found.set, found.exported});
+    }
+    assign(found, value);
+}
+
+void var::pop_scope() noexcept {
+    assert(!scopes.empty());
+    auto& scope {scopes.back()};
+    for (auto it {scope.rbegin()}; it != scope.rend(); it++) {
+        variable& var {*it->var};
+        env_changed |= var.exported || it->exported;
+        var.value = std::move(it->value);
+        var.set = it->set;
+        var.exported = it->exported;
+        changed(var);
+    }
+    scopes.pop_back();
+}
+
+char* const* var::environment() {
+    if (!env_changed)
+        return envp.data();
+
+    env_strings.clear();
+    size_t count {};
+    for (const variable& var : shell_vars.all()) {
+        if (!var.set || !var.exported)
+            continue;
+        env_strings.insert(env_strings.end(), var.name.begin(), var.name.end());
+        env_strings.push_back('=');
+        env_strings.insert(env_strings.end(), var.value.begin(), var.value.end());
+        env_strings.push_back('\0');
+        count++;
+    }
+    // pointers are taken once all strings are in place, as inserting may
+    // move them
+    envp.clear();
+    envp.reserve(count + 1);
+    for (size_t pos = 0; envp.size() < count; pos += strlen(&env_strings[pos]) + 1) {
+        envp.push_back(&env_strings[pos]);
+    }
+    envp.push_back(nullptr);
+    env_changed = false;
+    return envp.data();
+}
+
+int var::last_status() noexcept {
+    return status;
+}
+
+void var::set_last_status(int new_status) noexcept {
+    status = new_status;
+}
+
+pid_t var::last_background() noexcept {
+    return last_job;
+}
+
+void var::set_last_background(pid_t pid) noexcept {
+    last_job = pid;
 }
 
-bool var::is_set(const std::string& var) noexcept {
-    return shell_vars.contains(var);
+const std::vector<std::string>& var::positional() noexcept {
+    return positional_frames.back();
 }
 
-void var::unset(const std::string& var) noexcept {
-    if (shell_vars.contains(var))
-        shell_vars.erase(var);
+void var::push_positional(std::vector<std::string> params) {
+    positional_frames.push_back(std::move(params));
 }
 
-const std::string& var::get_var(const std::string& var) {
-    return shell_vars.at(var);
+void var::pop_positional() noexcept {
+    assert(positional_frames.size() > 1);
+    positional_frames.pop_back();
 }
@@ -0,0 +1,326 @@
+#include "cmd/vm.h"
+#include "cmd/brace.h"
+#include "cmd/expansion.h"
+#include "cmd/variable.h"
+#include "stringhash.h"
+#include <array>
+#include <cassert>
+#include <charconv>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/* Exit status of return with an argument that isn't a number */
+static const int BAD_RETURN_STATUS = 2;
+
+static string_map<vm::function> functions {};
+/* Programs being run, innermost last. Functions defined by the running code
+ * take their program from here. */
+static std::vector<std::shared_ptr<const ast::program>> running {};
+
+namespace {
+
+/* Items of a for loop, expanded a word at a time as the loop asks for
+ * them. Brace expansions are generated lazily as well, so a loop over a huge
+ * sequence never holds more than one of its words. */
+class item_source {
+    const ast::program* prog {};
+    std::span<const ast::word> words {};
+    size_t next_word {};
+    std::optional<brace::generator> braces {};
+    std::string generated {};
+    std::vector<std::string> pending {};
+    size_t next_pending {};
+
+    /* Expands a word into pending, replacing what is there. A word that
+     * can't be expanded gives no items. Words generated by brace expansion
+     * have no flags. */
+    void expand(std::string_view word, std::optional<uint8_t> flags, std::pmr::memory_resource* arena) {
+        arg_list args {arena};
+        glob::dir_cache dirs {};
+        try {
+            if (flags)
+                expand_argument(word, *flags, args, arena, dirs);
+            else
+                expand_argument(word, args, arena, dirs);
+        } catch (const expansion_error& err) {
+            std::cerr << "stush: " << err.what() << '\n';
+        }
+        pending.assign(args.begin(), args.end());
+        next_pending = 0;
+    }
+
+    /* Generates the next word of the brace expansion. One that can't be
+     * generated ends it. */
+    bool next_generated() {
+        try {
+            return braces->next(generated);
+        } catch (const expansion_error& err) {
+            std::cerr << "stush: " << err.what() << '\n';
+            return false;
+        }
+    }
+
+public:
+    /* Loops over the words of a command, or the positional parameters if
+     * it is NO_INDEX. */
+    item_source(const ast::program& prog, uint32_t command) : prog(&prog) {
+        if (command == ast::NO_INDEX)
+            pending = var::positional();
+        else
+            words = prog.words_of(prog.commands[command]);
+    }
+
+    /* Stores the next item in item. Returns false once there are none
+     * left. */
+    bool next(std::string& item, std::pmr::memory_resource* arena) {
+        while (next_pending == pending.size()) {
+            if (braces && next_generated()) {
+                expand(generated, std::nullopt, arena);
+                continue;
+            }
+            braces.reset();
+            if (next_word == words.size())
+                return false;
+            const ast::word& word {words[next_word++]};
+            const std::string_view text {prog->text(word)};
+            if (word.flags & ast::word_flags::BRACES && brace::has_braces(text))
+                braces.emplace(text);
+            else
+                expand(text, word.flags, arena);
+        }
+        item = std::move(pending[next_pending++]);
+        return true;
+    }
+};
+
+struct loop {
+    std::string name;
+    item_source items;
+    std::string item {};
+};
+
+/* A case pattern as it was last expanded, compiled again only when its
+ * expansion changes. */
+struct case_pattern {
+    std::string text;
+    glob::matcher matcher;
+};
+
+/* Keeps a program on the stack of running ones while it runs. */
+class running_guard {
+public:
+    running_guard(std::shared_ptr<const ast::program> prog) {
+        running.push_back(std::move(prog));
+    }
+
+    ~running_guard() {
+        running.pop_back();
+    }
+
+    running_guard(const running_guard&) = delete;
+    running_guard& operator=(const running_guard&) = delete;
+};
+
+/* Gives a function call its positional parameters and counts it towards
+ * the nesting depth until it returns. */
+class call_guard {
+    size_t& depth;
+
+public:
+    call_guard(size_t& depth, args_view args) : depth(depth) {
+        var::push_positional({args.begin() + 1, args.end()});
+        depth++;
+    }
+
+    ~call_guard() {
+        depth--;
+        var::pop_positional();
+    }
+
+    call_guard(const call_guard&) = delete;
+    call_guard& operator=(const call_guard&) = delete;
+};
+
+}
+
+/* expand_single for words outside of pipelines, which report their errors
+ * and expand to nothing instead. */
+static std::string expand_reported(std::string_view word,
+    std::string (*expand)(std::string_view) = expand_single)
+{
+    try {
+        return expand(word);
+    } catch (const expansion_error& err) {
+        std::cerr << "stush: " << err.what() << '\n';
+        return {};
+    }
+}
+
+static int parse_return_status(std::string_view arg) {
+    const std::string value {expand_reported(arg)};
+    int status {};
+    const auto [end, err] {std::from_chars(value.data(), value.data() + value.size(), status)};
+    if (err != std::errc {} || end != value.data() + value.size()) {
+        std::cerr << "stush: return: " << value << ": numeric argument required\n";
+        return BAD_RETURN_STATUS;
+    }
+    return status & 0xff;
+}
+
+/* Runs code from pc until the end of the program or a return. Every body
+ * gets a machine of its own, so whatever it leaves on its stacks is dropped
+ * along with it. */
+static int execute(const ast::program& prog, uint32_t pc) {
+    // Expanded arguments of every pipeline live here and are dropped in bulk
+    // once the pipeline has finished.
+    std::array<std::byte, 4096> initial_buffer;
+    std::pmr::monotonic_buffer_resource arena {initial_buffer.data(), initial_buffer.size()};
+    std::vector<loop> loops {};
+    std::vector<std::string> subjects {};
+    // by the index of their instruction
+    std::unordered_map<uint32_t, case_pattern> patterns {};
+
+    int status {var::last_status()};
+    const auto set_status {[&status](int new_status) {
+        status = new_status;
+        var::set_last_status(new_status);
+    }};
+
+    const auto& code {prog.code};
+    while (pc < code.size()) {
+        const ast::instruction& ins {code[pc++]};
+        switch (ins.op) {
+            case ast::opcode::RUN_PIPELINE: {
+                set_status(run_pipeline(prog, prog.pipelines[ins.a], &arena));
+                arena.release();
+                break;
+            }
+            case ast::opcode::RUN_TIMED_PIPELINE: {
+                set_status(run_timed_pipeline(prog, prog.pipelines[ins.a], &arena,
+                    static_cast<ast::time_format>(ins.b)));
+                arena.release();
+                break;
+            }
+            case ast::opcode::RUN_BACKGROUND: {
+                set_status(run_background(prog, prog.commands[ins.a]));
+                break;
+            }
+            case ast::opcode::JUMP: {
+                pc = ins.a;
+                break;
+            }
+            case ast::opcode::JUMP_IF_FAILURE: {
+                if (status != EXIT_SUCCESS)
+                    pc = ins.a;
+                break;
+            }
+            case ast::opcode::JUMP_IF_SUCCESS: {
+                if (status == EXIT_SUCCESS)
+                    pc = ins.a;
+                break;
+            }
+            case ast::opcode::SET_STATUS: {
+                set_status(ins.a);
+                break;
+            }
+            case ast::opcode::FOR_BEGIN: {
+                loops.push_back({
+                    .name = std::string {prog.text(prog.words[ins.b])},
+                    .items = item_source {prog, ins.a},
+                });
+                set_status(EXIT_SUCCESS);
+                break;
+            }
+            case ast::opcode::FOR_NEXT: {
+                loop& current {loops.back()};
+                const bool more {current.items.next(current.item, &arena)};
+                arena.release();
+                if (!more) {
+                    loops.pop_back();
+                    pc = ins.b;
+                    break;
+                }
+                var::set_var(current.name, current.item);
+                break;
+            }
+            case ast::opcode::POP_LOOP: {
+                loops.pop_back();
+                break;
+            }
+            case ast::opcode::CASE_BEGIN: {
+                subjects.push_back(expand_reported(prog.text(prog.words[ins.a])));
+                break;
+            }
+            case ast::opcode::CASE_MATCH: {
+                std::string text {expand_reported(prog.text(prog.words[ins.a]), expand_pattern)};
+                auto [it, added] {patterns.try_emplace(pc - 1)};
+                if (added || it->second.text != text) {
+                    it->second.matcher = glob::matcher {text};
+                    it->second.text = std::move(text);
+                }
+                if (it->second.matcher.matches(subjects.back())) {
+                    subjects.pop_back();
+                    set_status(EXIT_SUCCESS);
+                    pc = ins.b;
+                }
+                break;
+            }
+            case ast::opcode::CASE_END: {
+                subjects.pop_back();
+                set_status(EXIT_SUCCESS);
+                break;
+            }
+            case ast::opcode::DEFINE_FUNCTION: {
+                assert(!running.empty() && running.back().get() == &prog);
+                functions.insert_or_assign(std::string {prog.text(prog.words[ins.a])},
+                    vm::function {running.back(), ins.b});
+                set_status(EXIT_SUCCESS);
+                break;
+            }
+            case ast::opcode::RETURN: {
+                if (ins.a != ast::NO_INDEX)
+                    set_status(parse_return_status(prog.text(prog.words[ins.a])));
+                return status;
+            }
+        }
+    }
+    return status;
+}
+
+int vm::run(std::shared_ptr<const ast::program> prog) {
+    const ast::program& p {*prog};
+    const running_guard guard {std::move(prog)};
+    return execute(p, 0);
+}
+
+int vm::run_body(const ast::program& prog, uint32_t address) {
+    assert(!running.empty() && running.back().get() == &prog);
+    return execute(prog, address);
+}
+
+const vm::function* vm::find_function(std::string_view name) {
+    const auto it {functions.find(name)};
+    return it == functions.end() ? nullptr : &it->second;
+}
+
+int vm::call_function(const function& fn, args_view args) {
+    static size_t depth {};
+    if (depth == MAX_CALL_DEPTH) {
+        std::cerr << "stush: " << args[0] << ": maximum function nesting level exceeded\n";
+        return EXIT_FAILURE;
+    }
+
+    // the function may redefine itself while it runs
+    const function callee {fn};
+    const call_guard call {depth, args};
+    const running_guard guard {callee.prog};
+    return execute(*callee.prog, callee.address);
+}
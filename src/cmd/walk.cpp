@@ -0,0 +1,148 @@
+#include "cmd/walk.h"
+#include "cmd/variable.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Directories read by the calling thread alone before workers are started */
+static const size_t SERIAL_DIRECTORIES {32};
+
+namespace {
+
+/* Directories waiting to be read by a worker. The owner takes the most
+ * recently found ones, which keeps its walk depth first, while idle workers
+ * steal the oldest ones, which tend to be the largest subtrees. */
+class work_queue {
+    std::mutex lock {};
+    std::deque<std::string> paths {};
+
+public:
+    void push(std::string path) {
+        const std::lock_guard guard {lock};
+        paths.push_back(std::move(path));
+    }
+
+    std::optional<std::string> pop() {
+        const std::lock_guard guard {lock};
+        if (paths.empty())
+            return std::nullopt;
+        std::string path {std::move(paths.back())};
+        paths.pop_back();
+        return path;
+    }
+
+    std::optional<std::string> steal() {
+        const std::lock_guard guard {lock};
+        if (paths.empty())
+            return std::nullopt;
+        std::string path {std::move(paths.front())};
+        paths.pop_front();
+        return path;
+    }
+};
+
+}
+
+unsigned walk::default_threads() {
+    if (const auto env {var::find("STUSH_GLOB_THREADS")}) {
+        unsigned threads {};
+        const char* end {env->data() + env->size()};
+        const auto [ptr, err] {std::from_chars(env->data(), end, threads)};
+        if (err == std::errc {} && ptr == end && threads > 0)
+            return threads;
+    }
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+std::vector<walk::directory> walk::tree(const std::string& root, unsigned threads) {
+    threads = std::max(threads, 1u);
+    std::vector<work_queue> queues (threads);
+    std::vector<std::vector<directory>> found (threads);
+    // directories that have been queued but not read yet
+    std::atomic<size_t> pending {1};
+    // bumped whenever there is work or the walk is done, for idle workers
+    // to wait on
+    std::atomic<uint32_t> signals {};
+    std::atomic<unsigned> idle {};
+    queues[0].push(root);
+
+    const auto wake {[&] {
+        signals.fetch_add(1);
+        if (idle.load() > 0)
+            signals.notify_all();
+    }};
+
+    const auto find_work {[&](unsigned self) {
+        std::optional<std::string> path {queues[self].pop()};
+        for (unsigned i = 1; !path && i < threads; i++) {
+            path = queues[(self + i) % threads].steal();
+        }
+        return path;
+    }};
+
+    // Reads directories until the walk is done, or until it has read limit
+    // of them
+    const auto work {[&](unsigned self, size_t limit) {
+        size_t read {};
+        while (read < limit && pending.load() > 0) {
+            std::optional<std::string> path {find_work(self)};
+            if (!path) {
+                // whoever finds work after this looks wakes us up
+                idle.fetch_add(1);
+                const uint32_t seen {signals.load()};
+                path = find_work(self);
+                if (!path && pending.load() > 0)
+                    signals.wait(seen);
+                idle.fetch_sub(1);
+                if (!path)
+                    continue;
+            }
+
+            glob::listing contents {glob::read_listing(*path)};
+            directory dir {std::move(*path), std::move(contents)};
+            std::string subdir {};
+            for (const auto& entry : dir.contents.entries) {
+                if (entry.name.front() == '.')
+                    continue;
+                subdir = dir.path;
+                subdir.append(entry.name);
+                if (!glob::is_directory(entry, subdir, false))
+                    continue;
+                subdir.push_back('/');
+                pending.fetch_add(1);
+                queues[self].push(std::move(subdir));
+                wake();
+            }
+            found[self].push_back(std::move(dir));
+            read++;
+            if (pending.fetch_sub(1) == 1)
+                wake();
+        }
+    }};
+
+    // Small trees are done before threads would have started
+    work(0, SERIAL_DIRECTORIES);
+    if (pending.load() > 0) {
+        std::vector<std::jthread> workers {};
+        workers.reserve(threads - 1);
+        for (unsigned i = 1; i < threads; i++) {
+            workers.emplace_back(work, i, SIZE_MAX);
+        }
+        work(0, SIZE_MAX);
+    }
+
+    std::vector<directory> result {};
+    for (auto& dirs : found) {
+        std::move(dirs.begin(), dirs.end(), std::back_inserter(result));
+    }
+    std::sort(result.begin(), result.end(),
+        [](const directory& a, const directory& b) { return a.path < b.path; });
+    return result;
+}
@@ -104,8 +104,8 @@ void LineBuffer::jump_word_right() {
     const size_t adjusted_cursor {cursor_to_idx()};
     size_t res_idx {std::string::npos};
 
-    char selected_char {};
-    for (const auto c : _word_separators) {
+    char32_t selected_char {};
+    for (const char32_t c : _word_separators) {
         size_t cur {adjusted_cursor + 1};
         auto it {buffer.cit_at(cur)};
         while (cur < buffer.char_size() && *it != c) {
@@ -139,8 +139,8 @@ void LineBuffer::jump_word_left() {
     const size_t adjusted_cursor {cursor_to_idx()};
     size_t res_idx {0};
 
-    char selected_char {};
-    for (const auto c : _word_separators) {
+    char32_t selected_char {};
+    for (const char32_t c : _word_separators) {
         size_t cur {adjusted_cursor - 1};
         auto it {buffer.cit_at(cur)};
         while (cur > 0 && *it != c) {
@@ -1,6 +1,10 @@
 #include "linereader/linereader.h"
 #include "linereader/types.h"
+#include <array>
+#include <cerrno>
 #include <iostream>
+#include <poll.h>
+#include <utility>
 
 void LineReader::set_cursor_position(cursor_pos position) {
     linebuffer.cursor_position(position);
@@ -132,9 +136,52 @@ void LineReader::handle_normal(key_code_t key) {
     }
 }
 
+void LineReader::show_notice(const std::string& text) {
+    if (text.empty())
+        return;
+    // Raw mode doesn't turn line feeds into new lines
+    std::string lines {};
+    for (const char c : text) {
+        if (c == '\n')
+            lines += '\r';
+        lines += c;
+    }
+    term.erase_line();
+    term.write_text("\r" + lines);
+    term.commit();
+
+    // the line being edited moves below the notice
+    cursor_pos position {linebuffer.cursor_position()};
+    position.row = term.query_cursor_position().row;
+    linebuffer.cursor_position(position);
+    redraw_line(_prompt, linebuffer.get_text());
+    term.commit();
+}
+
+key_code_t LineReader::next_key() {
+    while (notice_fd != -1) {
+        std::array<pollfd, 2> fds {{{STDIN_FILENO, POLLIN, 0}, {notice_fd, POLLIN, 0}}};
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+            show_notice(notices());
+        if (fds[0].revents)
+            break;
+    }
+    return term.read_key();
+}
+
+void LineReader::notify_from(int fd, std::function<std::string()> notices) {
+    notice_fd = fd;
+    this->notices = std::move(notices);
+}
+
 std::string LineReader::sh_read_line(std::string_view prompt, char terminator) {
     init_readline(prompt);
-    key_code_t key {term.read_key()};
+    key_code_t key {next_key()};
     while (key != terminator) { //FIXME: do not terminate if there still are characters in queue (handle line break)
         if (iscntrl(key & 0xFF)) { // check lowest byte
             handle_control(key);
@@ -142,7 +189,7 @@ std::string LineReader::sh_read_line(std::string_view prompt, char terminator) {
             handle_normal(key);
         }
         term.commit();
-        key = term.read_key();
+        key = next_key();
     }
     term.disable_raw_mode();
     return linebuffer.get_text();
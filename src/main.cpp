@@ -1,15 +1,19 @@
 #include "cmd/cmd.h"
+#include "cmd/jobs.h"
+#include "cmd/reaper.h"
+#include "cmd/variable.h"
 #include "linereader/linereader.h"
 #include "parser.h"
-#include "stringsep.h"
+#include "script_cache.h"
+#include "trace.h"
 #include <bits/getopt_core.h>
 #include <cassert>
 #include <csignal>
 #include <cstdlib>
 #include <filesystem>
-#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <sys/types.h>
@@ -17,28 +21,47 @@
 namespace fs = std::filesystem;
 
 const std::string_view DELIMETER {" \t"};
+const int PARSE_ERROR = 2;
 
-int sh_main_loop(int argc, const char** argv) {
+int sh_main_loop(int, const char**) {
     std::string prompt {">>> "};
     LineReader linereader {};
+    // jobs that finish while a line is edited are reported right away
+    linereader.notify_from(reaper::fd(), jobs::notify);
     while (true) {
-        const std::string line {linereader.sh_read_line(prompt)};
+        std::cout << jobs::notify();
+        std::string line {linereader.sh_read_line(prompt)};
         if (line.empty())
             continue;
-        args_container args {tokenizer::tokenize(line, DELIMETER)};
         std::cout << "\n";
-        int status {run_compound_command(args)};
-        std::cout << "\nProcess " << args[0] << " exited with code " << status << '\n';
+        try {
+            auto prog {std::make_shared<const ast::program>(parser::parse(std::move(line), DELIMETER))};
+            if (prog->words.empty())
+                continue;
+            int status {run_compound_command(prog)};
+            std::cout << "\nProcess " << prog->text(prog->words[0]) << " exited with code " << status << '\n';
+        } catch (const parse_error& err) {
+            std::cerr << "stush: " << err.what() << '\n';
+        }
     }
 }
 
 [[nodiscard]]
 int run_command(std::string_view command) {
-    args_container args {tokenizer::tokenize(command, DELIMETER)};
-    return run_compound_command(args);
+    try {
+        return run_compound_command(std::make_shared<const ast::program>(
+            parser::parse(std::string(command), DELIMETER)));
+    } catch (const parse_error& err) {
+        std::cerr << "stush: " << err.what() << '\n';
+        return PARSE_ERROR;
+    }
 }
 
 int main(int argc, char** argv) {
+    trace::init();
+    // Builtins running inside of a pipeline must survive their reader exiting
+    signal(SIGPIPE, SIG_IGN);
+
     int opt {};
     while ((opt = getopt(argc, argv, "c:")) != -1) {
         switch (opt) {
@@ -63,12 +86,15 @@ int main(int argc, char** argv) {
                 exit(EXIT_FAILURE);
             }
 
-            std::ifstream ifs {filename};
-            std::string line {};
             int status {};
-            while (std::getline(ifs, line)) {
-                if (!line.empty() && line.front() != sep::COMMENT_CHAR)
-                    status = run_command(line);
+            try {
+                var::push_positional({argv + optind + 1, argv + argc});
+                status = run_compound_command(std::make_shared<const ast::program>(
+                    script_cache::load(filename, DELIMETER)));
+            } catch (const parse_error& err) {
+                std::cerr << "stush: " << argv[optind] << ':' << err.location.line << ':'
+                    << err.location.column << ": " << err.what() << '\n';
+                status = PARSE_ERROR;
             }
             exit(status);
         } catch (const fs::filesystem_error& err) {
@@ -78,5 +104,6 @@ int main(int argc, char** argv) {
     }
 
     signal(SIGINT, SIG_IGN);
+    jobs::init_job_control();
     sh_main_loop(argc, (const char**) argv);
 }
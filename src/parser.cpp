@@ -1,47 +1,79 @@
 #include "parser.h"
 #include "cmd/cmd.h"
 #include "stringsep.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <iterator>
 #include <string_view>
+#include <utility>
+
+// Characters with a meaning of their own, apart from delimeters. Glob and
+// brace characters only have to be noted in the flags of the word
+static constexpr scan::char_set REGULAR_SPECIAL {"'\"\\\n#;|&$*?[{"};
+static constexpr scan::char_set QUOTED_SPECIAL {"'\"\\$"};
+static constexpr scan::char_set PARAMETER_SPECIAL {"'\"\\$}"};
+static constexpr scan::char_set ARITHMETIC_SPECIAL {"()$"};
+static constexpr std::string_view LINE_CONTINUATION {"\\\n"};
 
 tokenizer::tokenizer(std::string_view line, std::string_view delimeter) :
-    states({state::REGULAR}),
+    states(),
+    line(line),
+    delimeter(delimeter),
+    regular_special(REGULAR_SPECIAL),
+    delimeters(delimeter),
     token_start(0),
     token_end(0),
-    line(line),
-    delimeter(delimeter)
-{}
+    token_op(ast::op_kind::NONE),
+    token_flags(0)
+{
+    for (char c : delimeter) {
+        regular_special.add(c);
+    }
+}
 
-args_container tokenizer::tokenize_impl() {
-    do {
+std::optional<token> tokenizer::next() {
+    while (true) {
         find_start();
-        if (token_start == std::string::npos)
-            break;
+        if (token_start == std::string::npos || token_start >= line.size())
+            return std::nullopt;
 
-        while (token_end < line.size() && !handle_char(line[token_end]));
+        token_op = ast::op_kind::NONE;
+        token_flags = line[token_start] == '~' ? ast::word_flags::TILDE : 0;
+        while (token_end < line.size()) {
+            skip_ordinary();
+            if (token_end >= line.size() || handle_char(line[token_end]))
+                break;
+        }
 
-        push_token();
-    } while (token_start <= line.size() && token_end <= line.size());
+        // Nothing was consumed, so the token starts with a comment
+        if (token_end == token_start) {
+            skip_comment();
+            continue;
+        }
 
-    return tokens;
+        const token tok {token_op, {(uint32_t) token_start, (uint32_t) token_end}, token_flags};
+        token_start = token_end;
+        return tok;
+    }
 }
 
 void tokenizer::find_start() {
     token_start = line.find_first_not_of(delimeter, token_start);
+    // a line continuation between words is just another delimeter
+    while (token_start != std::string::npos && line.substr(token_start, 2) == LINE_CONTINUATION) {
+        token_start = line.find_first_not_of(delimeter, token_start + 2);
+    }
     token_end = token_start;
 }
 
-void tokenizer::push_token() {
-    assert(token_end <= line.size());
-
-    if (token_start < token_end) {
-        tokens.push_back(std::string(line.substr(token_start, token_end - token_start)));
-        token_start = token_end;
-        token_end++;
-    }
+void tokenizer::skip_comment() {
+    token_start = line.find(sep::NEWLINE, token_end);
 }
 
 bool tokenizer::handle_char(char c) {
-    assert(!states.empty());
     switch (states.top()) {
         case state::ESCAPED: {
             advance();
@@ -54,44 +86,72 @@ bool tokenizer::handle_char(char c) {
 
             switch (c) {
                 case '\'': {
-                    states.push(state::SINGLE_QUOTES);
+                    push_state(state::SINGLE_QUOTES);
                     advance();
                     break;
                 }
                 case '"': {
-                    states.push(state::DOUBLE_QUOTES);
+                    push_state(state::DOUBLE_QUOTES);
                     advance();
                     break;
                 }
                 case sep::ESCAPE_CHAR: {
-                    states.push(state::ESCAPED);
+                    push_state(state::ESCAPED);
                     advance();
                     break;
                 }
-                case '\n':
+                case '\n': {
+                    advance_operator(ast::op_kind::NEWLINE);
+                    return true;
+                }
                 case sep::COMMAND_CHAR: {
-                    // token parsing just begun
-                    if (token_end == token_start) {
-                        advance();
-                    }
+                    advance_operator(ast::op_kind::COMMAND);
                     return true;
                 }
                 case sep::OR_CHAR: {
-                    if (token_end == token_start) {
-                        advance((is_next(sep::OR_CHAR) || is_next(sep::AND_CHAR)) ? 2 : 1);
+                    if (is_next(sep::OR_CHAR)) {
+                        advance_operator(ast::op_kind::LIST_OR, 2);
+                    } else if (is_next(sep::AND_CHAR)) {
+                        advance_operator(ast::op_kind::PIPE_BOTH, 2);
+                    } else {
+                        advance_operator(ast::op_kind::PIPE_OUT);
                     }
                     return true;
                 }
                 case sep::AND_CHAR: {
-                    if (token_end == token_start) {
-                        advance(is_next(sep::AND_CHAR) ? 2 : 1);
+                    if (is_next(sep::AND_CHAR)) {
+                        advance_operator(ast::op_kind::LIST_AND, 2);
+                    } else {
+                        advance_operator(ast::op_kind::BACKGROUND);
                     }
                     return true;
                 }
                 case sep::COMMENT_CHAR: {
-                    push_token();
-                    token_start = std::string::npos; //HACK: invalidate position
-                    return true;
+                    // only starts a comment at the beginning of a word, so
+                    // that $# stays a word. The comment is skipped once the
+                    // current token is pushed
+                    if (token_end == token_start)
+                        return true;
+                    advance();
+                    break;
+                }
+                case sep::VAR_PREFIX: {
+                    token_flags |= ast::word_flags::VARIABLE;
+                    if (!enter_expansion())
+                        advance();
+                    break;
+                }
+                case '*':
+                case '?':
+                case '[': {
+                    token_flags |= ast::word_flags::GLOB;
+                    advance();
+                    break;
+                }
+                case '{': {
+                    token_flags |= ast::word_flags::BRACES;
+                    advance();
+                    break;
                 }
                 default: {
                     advance();
@@ -107,12 +167,12 @@ bool tokenizer::handle_char(char c) {
                     break;
                 }
                 case '"': {
-                    states.push(state::DOUBLE_QUOTES);
+                    push_state(state::DOUBLE_QUOTES);
                     advance();
                     break;
                 }
                 case sep::ESCAPE_CHAR: {
-                    states.push(state::ESCAPED);
+                    push_state(state::ESCAPED);
                     advance();
                     break;
                 }
@@ -125,7 +185,7 @@ bool tokenizer::handle_char(char c) {
         case state::DOUBLE_QUOTES: {
             switch (c) {
                 case '\'': {
-                    states.push(state::SINGLE_QUOTES);
+                    push_state(state::SINGLE_QUOTES);
                     advance();
                     break;
                 }
@@ -135,10 +195,75 @@ bool tokenizer::handle_char(char c) {
                     break;
                 }
                 case sep::ESCAPE_CHAR: {
-                    states.push(state::ESCAPED);
+                    push_state(state::ESCAPED);
+                    advance();
+                    break;
+                }
+                case sep::VAR_PREFIX: {
+                    token_flags |= ast::word_flags::VARIABLE;
+                    if (!enter_expansion())
+                        advance();
+                    break;
+                }
+                default: {
+                    advance();
+                }
+            }
+            break;
+        }
+        case state::PARAMETER: {
+            switch (c) {
+                case '}': {
+                    states.pop();
+                    advance();
+                    break;
+                }
+                case '\'': {
+                    push_state(state::SINGLE_QUOTES);
+                    advance();
+                    break;
+                }
+                case '"': {
+                    push_state(state::DOUBLE_QUOTES);
+                    advance();
+                    break;
+                }
+                case sep::ESCAPE_CHAR: {
+                    push_state(state::ESCAPED);
+                    advance();
+                    break;
+                }
+                case sep::VAR_PREFIX: {
+                    token_flags |= ast::word_flags::VARIABLE;
+                    if (!enter_expansion())
+                        advance();
+                    break;
+                }
+                default: {
+                    advance();
+                }
+            }
+            break;
+        }
+        case state::ARITHMETIC: {
+            switch (c) {
+                case '(': {
+                    push_state(state::ARITHMETIC);
                     advance();
                     break;
                 }
+                case ')': {
+                    // the second ) of $(( )) is left to the enclosing state
+                    states.pop();
+                    advance();
+                    break;
+                }
+                case sep::VAR_PREFIX: {
+                    token_flags |= ast::word_flags::VARIABLE;
+                    if (!enter_expansion())
+                        advance();
+                    break;
+                }
                 default: {
                     advance();
                 }
@@ -149,17 +274,673 @@ bool tokenizer::handle_char(char c) {
     return false;
 }
 
+bool tokenizer::enter_expansion() {
+    if (is_next('{')) {
+        push_state(state::PARAMETER);
+        advance(2);
+        return true;
+    }
+    if (line.substr(token_end + 1, 2) == "((") {
+        push_state(state::ARITHMETIC);
+        advance(3);
+        return true;
+    }
+    return false;
+}
+
 bool tokenizer::is_delimeter(char c) const {
-    return delimeter.find(c) != std::string::npos;
+    return delimeters.contains(c);
+}
+
+void tokenizer::skip_ordinary() {
+    switch (states.top()) {
+        case state::REGULAR: {
+            token_end = scan::find_first_of(line, token_end, regular_special);
+            break;
+        }
+        case state::SINGLE_QUOTES:
+        case state::DOUBLE_QUOTES: {
+            token_end = scan::find_first_of(line, token_end, QUOTED_SPECIAL);
+            break;
+        }
+        case state::PARAMETER: {
+            token_end = scan::find_first_of(line, token_end, PARAMETER_SPECIAL);
+            break;
+        }
+        case state::ARITHMETIC: {
+            token_end = scan::find_first_of(line, token_end, ARITHMETIC_SPECIAL);
+            break;
+        }
+        case state::ESCAPED: {
+            break;
+        }
+    }
+}
+
+void tokenizer::push_state(state s) {
+    states.push(s, token_end);
+    if (s == state::ESCAPED)
+        token_flags |= ast::word_flags::ESCAPES;
+    else if (s == state::SINGLE_QUOTES || s == state::DOUBLE_QUOTES)
+        token_flags |= ast::word_flags::QUOTES;
 }
 
 void tokenizer::advance(int n) {
     token_end += n;
 }
 
+void tokenizer::advance_operator(ast::op_kind op, int n) {
+    // operators only start a token of their own
+    if (token_end == token_start) {
+        token_op = op;
+        advance(n);
+    }
+}
+
 bool tokenizer::is_next(char c) const {
     const auto next {token_end + 1};
     if (next >= line.size())
         return false;
     return line[next] == c;
 }
+
+/* Words that end a compound command and can't start a simple one. */
+static constexpr std::array<std::string_view, 8> CLOSING_KEYWORDS {
+    "then", "elif", "else", "fi", "do", "done", "esac", "}",
+};
+static constexpr std::string_view CASE_END {";;"};
+static constexpr std::string_view FUNCTION_PARENS {"()"};
+
+static bool is_name(std::string_view str) {
+    if (str.empty() || std::isdigit(static_cast<unsigned char>(str.front())))
+        return false;
+    return std::ranges::all_of(str, [](unsigned char c) { return std::isalnum(c) || c == '_'; });
+}
+
+static bool is_function_name(std::string_view str) {
+    return !str.empty() && std::ranges::all_of(str, [](unsigned char c) {
+        return std::isalnum(c) || c == '_' || c == '-' || c == '.' || c == ':';
+    });
+}
+
+/* Returns the code address an instruction may jump to, if it has one. */
+static uint32_t* jump_target(ast::instruction& ins) {
+    switch (ins.op) {
+        case ast::opcode::JUMP:
+        case ast::opcode::JUMP_IF_FAILURE:
+        case ast::opcode::JUMP_IF_SUCCESS:
+            return &ins.a;
+        case ast::opcode::FOR_NEXT:
+        case ast::opcode::CASE_MATCH:
+        case ast::opcode::DEFINE_FUNCTION:
+            return &ins.b;
+        default:
+            return nullptr;
+    }
+}
+
+parser::parser(ast::program& prog, std::string_view delimeter) :
+    tokens(prog.source, delimeter),
+    prog(prog),
+    current(std::nullopt),
+    lookahead(std::nullopt),
+    loops()
+{}
+
+void parser::advance() {
+    current = lookahead ? std::exchange(lookahead, std::nullopt) : tokens.next();
+}
+
+const std::optional<token>& parser::peek() {
+    if (!lookahead)
+        lookahead = tokens.next();
+    return lookahead;
+}
+
+bool parser::at_end() const {
+    return !current.has_value();
+}
+
+bool parser::at(ast::op_kind op) const {
+    return current && current->op == op;
+}
+
+bool parser::at_word() const {
+    return at(ast::op_kind::NONE);
+}
+
+bool parser::at_keyword(std::string_view keyword) const {
+    return at_word() && current_text() == keyword;
+}
+
+bool parser::at_case_end() const {
+    return at(ast::op_kind::COMMAND) && current->span.end < prog.source.size() &&
+        prog.source.view()[current->span.end] == sep::COMMAND_CHAR;
+}
+
+std::string_view parser::current_text() const {
+    assert(current);
+    return prog.source.view().substr(current->span.start, current->span.end - current->span.start);
+}
+
+size_t parser::current_position() const {
+    return current ? current->span.start : prog.source.size();
+}
+
+void parser::skip_newlines() {
+    while (at(ast::op_kind::NEWLINE)) {
+        advance();
+    }
+}
+
+void parser::skip_separators(bool stop_at_case_end) {
+    while (at(ast::op_kind::COMMAND) || at(ast::op_kind::NEWLINE)) {
+        if (stop_at_case_end && at_case_end())
+            return;
+        advance();
+    }
+}
+
+void parser::expect_command(std::string_view what) const {
+    if (!at_word()) {
+        throw parse_error("Missing command in " + std::string(what) + ".", current_position());
+    }
+}
+
+void parser::expect_keyword(std::string_view keyword) {
+    if (!at_keyword(keyword))
+        throw parse_error("Expected '" + std::string(keyword) + "'.", current_position());
+    advance();
+}
+
+uint32_t parser::push_word(ast::source_span span, uint8_t flags) {
+    prog.words.push_back({span, flags});
+    return prog.words.size() - 1;
+}
+
+uint32_t parser::emit(ast::opcode op, uint32_t a, uint32_t b) {
+    prog.code.push_back({op, a, b});
+    return prog.code.size() - 1;
+}
+
+uint32_t parser::here() const {
+    return prog.code.size();
+}
+
+void parser::patch(uint32_t address) {
+    *jump_target(prog.code[address]) = here();
+}
+
+uint32_t parser::make_stage_body(uint32_t start) {
+    auto& code {prog.code};
+    const uint32_t end {here()};
+    // every jump is shifted by the instruction inserted in front of the body
+    for (uint32_t i = start; i < end; i++) {
+        uint32_t* target {jump_target(code[i])};
+        if (!target)
+            continue;
+        if (*target < start || *target > end)
+            throw parse_error("break and continue can't leave a pipeline.", current_position());
+        (*target)++;
+    }
+    // and so are the bodies of compound stages inside of it
+    for (auto& command : prog.commands) {
+        if (command.body != ast::NO_INDEX && command.body >= start && command.body < end)
+            command.body++;
+    }
+    code.insert(code.begin() + start, ast::instruction {ast::opcode::JUMP, ast::NO_INDEX, ast::NO_INDEX});
+    emit(ast::opcode::RETURN);
+    patch(start);
+    return start + 1;
+}
+
+void parser::close_loop() {
+    for (const uint32_t jump : loops.back().breaks) {
+        patch(jump);
+    }
+    loops.pop_back();
+}
+
+void parser::parse_program() {
+    advance();
+    parse_compound_list({});
+    terminate_words();
+}
+
+void parser::terminate_words() {
+    // Whatever follows a word is a delimiter or an operator that has already
+    // been turned into a node, so it can be overwritten
+    for (const auto& word : prog.words) {
+        if (word.span.end < prog.source.size())
+            prog.source.data()[word.span.end] = '\0';
+    }
+}
+
+std::string_view parser::parse_compound_list(std::initializer_list<std::string_view> terminators,
+    bool in_case)
+{
+    while (true) {
+        skip_separators(in_case);
+        if (at_end()) {
+            if (terminators.size() == 0)
+                return {};
+            const std::string last {*std::prev(terminators.end())};
+            throw parse_error("Expected '" + last + "'.", prog.source.size());
+        }
+        if (in_case && at_case_end())
+            return CASE_END;
+        for (const auto& keyword : terminators) {
+            if (at_keyword(keyword))
+                return keyword;
+        }
+        parse_and_or();
+    }
+}
+
+void parser::parse_and_or() {
+    if (at(ast::op_kind::LIST_AND) || at(ast::op_kind::LIST_OR))
+        expect_command("list");
+    const uint32_t start {here()};
+    const uint32_t first_word {(uint32_t) prog.words.size()};
+    parse_pipeline();
+
+    // The status left by everything before an operator decides whether the
+    // pipeline after it runs, so a && b || c runs c when either a or b fails.
+    while (at(ast::op_kind::LIST_AND) || at(ast::op_kind::LIST_OR)) {
+        const auto op {current->op};
+        advance();
+        skip_newlines();
+        // a dangling operator at the end of the list is ignored
+        if (at_end() || at(ast::op_kind::COMMAND))
+            break;
+        if (at(ast::op_kind::LIST_AND) || at(ast::op_kind::LIST_OR))
+            expect_command("list");
+        const uint32_t skip {emit(op == ast::op_kind::LIST_AND ?
+            ast::opcode::JUMP_IF_FAILURE : ast::opcode::JUMP_IF_SUCCESS)};
+        parse_pipeline();
+        patch(skip);
+    }
+
+    // A list followed by & is compiled like a pipeline stage, to be run by
+    // a copy of the shell that isn't waited for
+    if (at(ast::op_kind::BACKGROUND)) {
+        prog.commands.push_back({
+            .first_word = first_word,
+            .nwords = (uint32_t) prog.words.size() - first_word,
+            .pipe = ast::op_kind::NONE,
+            .body = make_stage_body(start),
+        });
+        emit(ast::opcode::RUN_BACKGROUND, prog.commands.size() - 1);
+        advance();
+    }
+}
+
+void parser::parse_pipeline() {
+    expect_command("pipeline");
+    // time [-j] reports how long the whole pipeline took
+    std::optional<ast::time_format> time {};
+    if (at_keyword("time")) {
+        advance();
+        time = ast::time_format::HUMAN;
+        if (at_keyword("-j")) {
+            advance();
+            time = ast::time_format::JSON;
+        }
+        if (at(ast::op_kind::PIPE_OUT) || at(ast::op_kind::PIPE_BOTH))
+            expect_command("time");
+        // a bare time times an empty pipeline
+        if (!at_word()) {
+            prog.pipelines.push_back({.first_command = (uint32_t) prog.commands.size(), .ncommands = 0});
+            emit(ast::opcode::RUN_TIMED_PIPELINE, prog.pipelines.size() - 1, static_cast<uint32_t>(*time));
+            return;
+        }
+    }
+
+    uint32_t start {here()};
+    std::optional<ast::simple_command> command {parse_command()};
+    const bool is_pipe {at(ast::op_kind::PIPE_OUT) || at(ast::op_kind::PIPE_BOTH)};
+    // a lone compound command runs in place, unless it's timed
+    if (!command && !is_pipe && !time)
+        return;
+
+    // Commands of compound stages are added while the stages are parsed, so
+    // the stages are only added once they're all known to keep them together.
+    std::vector<ast::simple_command> stages {};
+    const auto add_stage {[&] {
+        if (command) {
+            stages.push_back(*command);
+        } else {
+            stages.push_back({
+                .first_word = (uint32_t) prog.words.size(),
+                .nwords = 0,
+                .pipe = ast::op_kind::NONE,
+                .body = make_stage_body(start),
+            });
+        }
+    }};
+    add_stage();
+
+    while (at(ast::op_kind::PIPE_OUT) || at(ast::op_kind::PIPE_BOTH)) {
+        stages.back().pipe = current->op;
+        advance();
+        skip_newlines();
+        if (!at_word()) {
+            if (at(ast::op_kind::PIPE_OUT) || at(ast::op_kind::PIPE_BOTH))
+                expect_command("pipeline");
+            // a dangling pipe at the end of the pipeline is ignored
+            stages.back().pipe = ast::op_kind::NONE;
+            break;
+        }
+        start = here();
+        command = parse_command();
+        add_stage();
+    }
+
+    const ast::pipeline pl {
+        .first_command = (uint32_t) prog.commands.size(),
+        .ncommands = (uint32_t) stages.size(),
+    };
+    prog.commands.insert(prog.commands.end(), stages.begin(), stages.end());
+    prog.pipelines.push_back(pl);
+    if (time)
+        emit(ast::opcode::RUN_TIMED_PIPELINE, prog.pipelines.size() - 1, static_cast<uint32_t>(*time));
+    else
+        emit(ast::opcode::RUN_PIPELINE, prog.pipelines.size() - 1);
+}
+
+std::optional<ast::simple_command> parser::parse_command() {
+    const std::string_view text {current_text()};
+    if (std::ranges::find(CLOSING_KEYWORDS, text) != CLOSING_KEYWORDS.end())
+        throw parse_error("Unexpected '" + std::string(text) + "'.", current_position());
+
+    if (text == "break" || text == "continue") {
+        parse_loop_jump(text == "break");
+        return std::nullopt;
+    }
+    if (text == "return") {
+        parse_return();
+        return std::nullopt;
+    }
+
+    if (!parse_compound_command()) {
+        auto name {current->span};
+        if (text == "function") {
+            advance();
+            if (!at_word())
+                throw parse_error("Expected a function name.", current_position());
+            name = current->span;
+        }
+        // name() and name () both define a function
+        const std::string_view name_text {prog.source.view().substr(name.start, name.end - name.start)};
+        if (name_text.ends_with(FUNCTION_PARENS)) {
+            name.end -= FUNCTION_PARENS.size();
+            advance();
+        } else if (const auto& next {peek()}; next && next->op == ast::op_kind::NONE &&
+            next->span.end - next->span.start == FUNCTION_PARENS.size() &&
+            prog.source.view().substr(next->span.start, FUNCTION_PARENS.size()) == FUNCTION_PARENS)
+        {
+            advance();
+            advance();
+        } else if (text == "function") {
+            advance();
+        } else {
+            return parse_simple_command();
+        }
+        const std::string_view function_name {prog.source.view().substr(name.start, name.end - name.start)};
+        if (!is_function_name(function_name))
+            throw parse_error("Invalid function name '" + std::string(function_name) + "'.", name.start);
+        parse_function(name);
+    }
+
+    // compound commands are followed by an operator or a separator
+    if (at_word())
+        throw parse_error("Unexpected '" + std::string(current_text()) + "'.", current_position());
+    return std::nullopt;
+}
+
+bool parser::parse_compound_command() {
+    if (!at_word())
+        return false;
+    const std::string_view text {current_text()};
+    if (text == "if") {
+        parse_if();
+    } else if (text == "while" || text == "until") {
+        parse_while(text == "until");
+    } else if (text == "for") {
+        parse_for();
+    } else if (text == "case") {
+        parse_case();
+    } else if (text == "{") {
+        parse_brace_group();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void parser::parse_if() {
+    advance();
+    std::vector<uint32_t> ends {};
+    std::string_view keyword {};
+    do {
+        parse_compound_list({"then"});
+        advance();
+        const uint32_t next_branch {emit(ast::opcode::JUMP_IF_FAILURE)};
+        keyword = parse_compound_list({"elif", "else", "fi"});
+        advance();
+        ends.push_back(emit(ast::opcode::JUMP));
+        patch(next_branch);
+    } while (keyword == "elif");
+
+    if (keyword == "else") {
+        parse_compound_list({"fi"});
+        advance();
+    } else {
+        // no branch was taken
+        emit(ast::opcode::SET_STATUS, EXIT_SUCCESS);
+    }
+    for (const uint32_t jump : ends) {
+        patch(jump);
+    }
+}
+
+void parser::parse_while(bool until) {
+    advance();
+    const uint32_t condition {here()};
+    parse_compound_list({"do"});
+    advance();
+    const uint32_t exit {emit(until ? ast::opcode::JUMP_IF_SUCCESS : ast::opcode::JUMP_IF_FAILURE)};
+
+    loops.push_back({.has_items = false, .continue_address = condition});
+    parse_compound_list({"done"});
+    advance();
+    emit(ast::opcode::JUMP, condition);
+    patch(exit);
+    close_loop();
+    emit(ast::opcode::SET_STATUS, EXIT_SUCCESS);
+}
+
+void parser::parse_for() {
+    advance();
+    if (!at_word() || !is_name(current_text()))
+        throw parse_error("Expected a variable name after 'for'.", current_position());
+    const uint32_t name {push_word(current->span, current->flags)};
+    advance();
+    skip_newlines();
+
+    uint32_t items {ast::NO_INDEX};
+    if (at_keyword("in")) {
+        advance();
+        items = prog.commands.size();
+        prog.commands.push_back(parse_simple_command());
+        if (!at_end() && !at(ast::op_kind::COMMAND) && !at(ast::op_kind::NEWLINE))
+            throw parse_error("Expected ';' or a newline after the items of 'for'.", current_position());
+    }
+    skip_separators(false);
+    expect_keyword("do");
+
+    emit(ast::opcode::FOR_BEGIN, items, name);
+    const uint32_t next {emit(ast::opcode::FOR_NEXT)};
+    loops.push_back({.has_items = true, .continue_address = next});
+    parse_compound_list({"done"});
+    advance();
+    emit(ast::opcode::JUMP, next);
+    patch(next);
+    close_loop();
+}
+
+void parser::parse_case() {
+    advance();
+    if (!at_word())
+        throw parse_error("Expected a word after 'case'.", current_position());
+    emit(ast::opcode::CASE_BEGIN, push_word(current->span, current->flags));
+    advance();
+    skip_newlines();
+    expect_keyword("in");
+
+    // Every item tries its patterns and jumps to the next item if none
+    // matches. A match drops the subject, so that it's never left behind
+    // by break or return inside of the body.
+    std::vector<uint32_t> ends {};
+    std::vector<uint32_t> matches {};
+    uint32_t next_item {ast::NO_INDEX};
+    while (true) {
+        skip_separators(false);
+        if (at_end())
+            throw parse_error("Expected 'esac'.", prog.source.size());
+        if (at_keyword("esac"))
+            break;
+        if (next_item != ast::NO_INDEX)
+            patch(next_item);
+
+        if (at_keyword("("))
+            advance();
+        matches.clear();
+        while (true) {
+            if (!at_word())
+                throw parse_error("Expected a pattern.", current_position());
+            auto pattern {current->span};
+            const uint8_t pattern_flags {current->flags};
+            const std::string_view text {current_text()};
+            if (matches.empty() && text.size() > 1 && text.front() == '(')
+                pattern.start++;
+            const bool closed {text.back() == ')'};
+            if (closed)
+                pattern.end--;
+            matches.push_back(emit(ast::opcode::CASE_MATCH, push_word(pattern, pattern_flags)));
+            advance();
+            if (closed)
+                break;
+            if (at_keyword(")")) {
+                advance();
+                break;
+            }
+            if (!at(ast::op_kind::PIPE_OUT))
+                throw parse_error("Expected ')' after a pattern.", current_position());
+            advance();
+        }
+        next_item = emit(ast::opcode::JUMP);
+
+        for (const uint32_t match : matches) {
+            patch(match);
+        }
+        const std::string_view end {parse_compound_list({"esac"}, true)};
+        ends.push_back(emit(ast::opcode::JUMP));
+        if (end != CASE_END)
+            break;
+        advance();
+        advance();
+    }
+
+    if (next_item != ast::NO_INDEX)
+        patch(next_item);
+    emit(ast::opcode::CASE_END);
+    for (const uint32_t jump : ends) {
+        patch(jump);
+    }
+    expect_keyword("esac");
+}
+
+void parser::parse_brace_group() {
+    advance();
+    parse_compound_list({"}"});
+    advance();
+}
+
+void parser::parse_function(ast::source_span name) {
+    // function names are checked to be plain names
+    const uint32_t name_word {push_word(name, 0)};
+    skip_newlines();
+    const size_t body_position {current_position()};
+
+    const uint32_t define {emit(ast::opcode::DEFINE_FUNCTION, name_word)};
+    const uint32_t skip {emit(ast::opcode::JUMP)};
+    patch(define);
+    // break and continue can't leave the body
+    auto outer_loops {std::exchange(loops, {})};
+    if (!parse_compound_command())
+        throw parse_error("Expected a compound command as the function body.", body_position);
+    loops = std::move(outer_loops);
+    emit(ast::opcode::RETURN);
+    patch(skip);
+}
+
+void parser::parse_loop_jump(bool is_break) {
+    const std::string keyword {current_text()};
+    const size_t position {current_position()};
+    advance();
+
+    size_t levels {1};
+    if (at_word()) {
+        const std::string_view count {current_text()};
+        const auto [end, err] {std::from_chars(count.data(), count.data() + count.size(), levels)};
+        if (err != std::errc {} || end != count.data() + count.size() || levels == 0)
+            throw parse_error(keyword + ": loop count must be a positive number.", current_position());
+        advance();
+    }
+    if (at_word())
+        throw parse_error(keyword + ": too many arguments.", current_position());
+    if (loops.empty())
+        throw parse_error(keyword + ": only meaningful in a loop.", position);
+
+    const size_t target {loops.size() - std::min(levels, loops.size())};
+    // items of every loop that is left have to be dropped
+    const size_t keep {is_break ? target : target + 1};
+    for (size_t i = loops.size(); i-- > keep;) {
+        if (loops[i].has_items)
+            emit(ast::opcode::POP_LOOP);
+    }
+    emit(ast::opcode::SET_STATUS, EXIT_SUCCESS);
+    if (is_break) {
+        loops[target].breaks.push_back(emit(ast::opcode::JUMP));
+    } else {
+        emit(ast::opcode::JUMP, loops[target].continue_address);
+    }
+}
+
+void parser::parse_return() {
+    advance();
+    uint32_t status {ast::NO_INDEX};
+    if (at_word()) {
+        status = push_word(current->span, current->flags);
+        advance();
+    }
+    if (at_word())
+        throw parse_error("return: too many arguments.", current_position());
+    emit(ast::opcode::RETURN, status);
+}
+
+ast::simple_command parser::parse_simple_command() {
+    ast::simple_command command {
+        .first_word = (uint32_t) prog.words.size(),
+        .nwords = 0,
+        .pipe = ast::op_kind::NONE,
+        .body = ast::NO_INDEX,
+    };
+    while (at_word()) {
+        prog.words.push_back({current->span, current->flags});
+        advance();
+    }
+    command.nwords = prog.words.size() - command.first_word;
+    return command;
+}
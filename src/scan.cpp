@@ -0,0 +1,97 @@
+#include "scan.h"
+#include <bit>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define STUSH_SCAN_SSE2
+#if defined(__GNUC__) && defined(__x86_64__)
+#define STUSH_SCAN_AVX2
+#endif
+#endif
+
+size_t scan::find_first_of_scalar(std::string_view str, size_t pos, const char_set& set) noexcept {
+    for (; pos < str.size(); pos++) {
+        if (set.contains(str[pos]))
+            return pos;
+    }
+    return str.size();
+}
+
+#ifdef STUSH_SCAN_SSE2
+
+static size_t find_first_of_sse2(std::string_view str, size_t pos, const scan::char_set& set) noexcept {
+    const std::string_view chars {set.chars()};
+    __m128i needles[scan::char_set::MAX_VECTOR_CHARS];
+    for (size_t i = 0; i < chars.size(); i++) {
+        needles[i] = _mm_set1_epi8(chars[i]);
+    }
+
+    constexpr size_t WIDTH {sizeof(__m128i)};
+    for (; pos + WIDTH <= str.size(); pos += WIDTH) {
+        const __m128i chunk {_mm_loadu_si128(reinterpret_cast<const __m128i*>(str.data() + pos))};
+        __m128i found {_mm_setzero_si128()};
+        for (size_t i = 0; i < chars.size(); i++) {
+            found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, needles[i]));
+        }
+        const uint32_t mask = _mm_movemask_epi8(found);
+        if (mask)
+            return pos + std::countr_zero(mask);
+    }
+    return scan::find_first_of_scalar(str, pos, set);
+}
+
+#endif
+
+#ifdef STUSH_SCAN_AVX2
+
+__attribute__((target("avx2")))
+static size_t find_first_of_avx2(std::string_view str, size_t pos, const scan::char_set& set) noexcept {
+    const std::string_view chars {set.chars()};
+    __m256i needles[scan::char_set::MAX_VECTOR_CHARS];
+    for (size_t i = 0; i < chars.size(); i++) {
+        needles[i] = _mm256_set1_epi8(chars[i]);
+    }
+
+    constexpr size_t WIDTH {sizeof(__m256i)};
+    for (; pos + WIDTH <= str.size(); pos += WIDTH) {
+        const __m256i chunk {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(str.data() + pos))};
+        __m256i found {_mm256_setzero_si256()};
+        for (size_t i = 0; i < chars.size(); i++) {
+            found = _mm256_or_si256(found, _mm256_cmpeq_epi8(chunk, needles[i]));
+        }
+        const uint32_t mask = _mm256_movemask_epi8(found);
+        if (mask)
+            return pos + std::countr_zero(mask);
+    }
+    // The compiler doesn't clear the upper halves of the registers before a
+    // tail call, and legacy SSE code running with them dirty is several
+    // times slower on some CPUs.
+    _mm256_zeroupper();
+    return find_first_of_sse2(str, pos, set);
+}
+
+#endif
+
+using find_function = size_t (*)(std::string_view, size_t, const scan::char_set&) noexcept;
+
+static find_function select_implementation() {
+#if defined(STUSH_SCAN_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return find_first_of_avx2;
+#endif
+#if defined(STUSH_SCAN_SSE2)
+    return find_first_of_sse2;
+#else
+    return scan::find_first_of_scalar;
+#endif
+}
+
+static const find_function find_impl {select_implementation()};
+
+size_t scan::find_first_of(std::string_view str, size_t pos, const char_set& set) noexcept {
+    if (!set.vectorizable())
+        return find_first_of_scalar(str, pos, set);
+    return find_impl(str, pos, set);
+}
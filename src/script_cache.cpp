@@ -0,0 +1,382 @@
+#include "script_cache.h"
+#include "cmd/variable.h"
+#include "parser.h"
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <span>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static constexpr std::array<char, 8> MAGIC {'S', 'T', 'U', 'S', 'H', 'C', 'C', '\0'};
+static constexpr uint32_t VERSION {8};
+static constexpr size_t ALIGNMENT {8};
+
+enum section_id {
+    SOURCE,
+    LINES,
+    WORDS,
+    COMMANDS,
+    PIPELINES,
+    CODE,
+    SECTION_COUNT,
+};
+
+struct section {
+    uint64_t offset;
+    uint64_t count;
+};
+
+/* Layout of an entry: the header, the script path, then every section
+ * aligned to ALIGNMENT bytes. */
+struct cache_header {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t path_size;
+    script_cache::script_stamp stamp;
+    /* Hash of the script as it was read, before parsing changed it */
+    uint64_t content_hash;
+    std::array<section, SECTION_COUNT> sections;
+};
+
+static_assert(std::has_unique_object_representations_v<cache_header>,
+    "The header is written as it is and must not have padding.");
+
+/* Writes an item into its slot of an entry, which starts out zeroed. Types
+ * with padding are written a member at a time, so that no uninitialized
+ * bytes end up in the file. */
+template <typename T>
+    requires std::has_unique_object_representations_v<T>
+static void encode(const T& item, char* out) {
+    memcpy(out, &item, sizeof(item));
+}
+
+static void encode(const ast::word& w, char* out) {
+    encode(w.span, out + offsetof(ast::word, span));
+    encode(w.flags, out + offsetof(ast::word, flags));
+}
+
+static void encode(const ast::simple_command& c, char* out) {
+    encode(c.first_word, out + offsetof(ast::simple_command, first_word));
+    encode(c.nwords, out + offsetof(ast::simple_command, nwords));
+    encode(c.pipe, out + offsetof(ast::simple_command, pipe));
+    encode(c.body, out + offsetof(ast::simple_command, body));
+}
+
+static void encode(const ast::instruction& ins, char* out) {
+    encode(ins.op, out + offsetof(ast::instruction, op));
+    encode(ins.a, out + offsetof(ast::instruction, a));
+    encode(ins.b, out + offsetof(ast::instruction, b));
+}
+
+uint64_t script_cache::hash_bytes(std::string_view bytes) noexcept {
+    // Every word is multiplied in and the high bits of the product are
+    // folded back down, so that each byte reaches all bits of the hash.
+    static constexpr uint64_t MULTIPLIER {0x9e3779b97f4a7c15};
+    uint64_t hash {0xcbf29ce484222325 ^ bytes.size()};
+    size_t i {0};
+    for (; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes.data() + i, sizeof(word));
+        hash = (hash ^ word) * MULTIPLIER;
+        hash ^= hash >> 32;
+    }
+    for (; i < bytes.size(); i++) {
+        hash = (hash ^ static_cast<unsigned char>(bytes[i])) * MULTIPLIER;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+fs::path script_cache::cache_dir() {
+    if (const auto xdg {var::find("XDG_CACHE_HOME")}; xdg && !xdg->empty())
+        return fs::path {*xdg} / "stush";
+    if (const auto home {var::find("HOME")}; home && !home->empty())
+        return fs::path {*home} / ".cache" / "stush";
+    return {};
+}
+
+fs::path script_cache::entry_path(const fs::path& script) {
+    const fs::path dir {cache_dir()};
+    if (dir.empty())
+        return {};
+    std::ostringstream name {};
+    name << std::hex << std::setw(16) << std::setfill('0') << hash_bytes(script.native()) << ".stc";
+    return dir / name.str();
+}
+
+static bool operator==(const script_cache::script_stamp& a, const script_cache::script_stamp& b) {
+    return a.mtime_sec == b.mtime_sec && a.mtime_nsec == b.mtime_nsec &&
+        a.size == b.size && a.inode == b.inode;
+}
+
+/* Memory mapping that is unmapped unless released. */
+class mapping_guard {
+    char* data;
+    size_t size;
+
+public:
+    mapping_guard(char* data, size_t size) : data(data), size(size) {}
+
+    ~mapping_guard() {
+        if (data)
+            munmap(data, size);
+    }
+
+    mapping_guard(const mapping_guard&) = delete;
+    mapping_guard& operator=(const mapping_guard&) = delete;
+
+    char* release() {
+        return std::exchange(data, nullptr);
+    }
+};
+
+template <typename T>
+static std::optional<std::span<const T>> get_section(const char* base, size_t file_size,
+    const section& s)
+{
+    if (s.offset % alignof(T) || s.offset > file_size || s.count > (file_size - s.offset) / sizeof(T))
+        return std::nullopt;
+    return std::span {reinterpret_cast<const T*>(base + s.offset), s.count};
+}
+
+/* Checks that an instruction only refers to nodes and code that exist. */
+static bool is_consistent(const ast::program& prog, const ast::instruction& ins) {
+    const auto is_word {[&](uint32_t i) { return i < prog.words.size(); }};
+    const auto is_address {[&](uint32_t i) { return i <= prog.code.size(); }};
+    switch (ins.op) {
+        case ast::opcode::RUN_PIPELINE:
+            return ins.a < prog.pipelines.size();
+        case ast::opcode::RUN_TIMED_PIPELINE:
+            return ins.a < prog.pipelines.size() && ins.b <= static_cast<uint32_t>(ast::time_format::JSON);
+        case ast::opcode::RUN_BACKGROUND:
+            return ins.a < prog.commands.size() && prog.commands[ins.a].body != ast::NO_INDEX;
+        case ast::opcode::JUMP:
+        case ast::opcode::JUMP_IF_FAILURE:
+        case ast::opcode::JUMP_IF_SUCCESS:
+            return is_address(ins.a);
+        case ast::opcode::SET_STATUS:
+        case ast::opcode::POP_LOOP:
+        case ast::opcode::CASE_END:
+            return true;
+        case ast::opcode::FOR_BEGIN:
+            return (ins.a == ast::NO_INDEX || ins.a < prog.commands.size()) && is_word(ins.b);
+        case ast::opcode::FOR_NEXT:
+            return is_address(ins.b);
+        case ast::opcode::CASE_BEGIN:
+            return is_word(ins.a);
+        case ast::opcode::CASE_MATCH:
+        case ast::opcode::DEFINE_FUNCTION:
+            return is_word(ins.a) && is_address(ins.b);
+        case ast::opcode::RETURN:
+            return ins.a == ast::NO_INDEX || is_word(ins.a);
+    }
+    return false;
+}
+
+/* Checks that every node only refers to nodes and text that exist. */
+static bool is_consistent(const ast::program& prog) {
+    const size_t source_size {prog.source.size()};
+    for (const auto& w : prog.words) {
+        if (w.span.start > w.span.end || w.span.end > source_size)
+            return false;
+    }
+    for (const auto& c : prog.commands) {
+        if (c.first_word > prog.words.size() || c.nwords > prog.words.size() - c.first_word)
+            return false;
+        if (c.body != ast::NO_INDEX && c.body >= prog.code.size())
+            return false;
+    }
+    for (const auto& p : prog.pipelines) {
+        if (p.first_command > prog.commands.size() ||
+            p.ncommands > prog.commands.size() - p.first_command)
+            return false;
+    }
+    for (const auto& ins : prog.code) {
+        if (!is_consistent(prog, ins))
+            return false;
+    }
+    for (const auto& start : prog.lines.starts()) {
+        if (start > source_size)
+            return false;
+    }
+    return true;
+}
+
+std::optional<ast::program> script_cache::read(const fs::path& entry, const fs::path& script,
+    const script_stamp& stamp, std::string_view source)
+{
+    const int fd {open(entry.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (fd == -1)
+        return std::nullopt;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(cache_header)) {
+        close(fd);
+        return std::nullopt;
+    }
+    const size_t file_size = st.st_size;
+    void* region {mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)};
+    close(fd);
+    if (region == MAP_FAILED)
+        return std::nullopt;
+
+    char* const base {static_cast<char*>(region)};
+    mapping_guard guard {base, file_size};
+
+    cache_header header;
+    memcpy(&header, base, sizeof(header));
+    if (header.magic != MAGIC || header.version != VERSION || !(header.stamp == stamp))
+        return std::nullopt;
+    // a script can change without its stamp changing within one tick of the clock
+    if (hash_bytes(source) != header.content_hash)
+        return std::nullopt;
+
+    const std::string_view payload {base + sizeof(header), file_size - sizeof(header)};
+    if (payload.substr(0, header.path_size) != script.native())
+        return std::nullopt;
+
+    const section& src {header.sections[SOURCE]};
+    // the source has to be followed by its NUL terminator
+    if (src.offset > file_size || src.count >= file_size - src.offset || base[src.offset + src.count])
+        return std::nullopt;
+
+    const auto lines {get_section<uint32_t>(base, file_size, header.sections[LINES])};
+    const auto words {get_section<ast::word>(base, file_size, header.sections[WORDS])};
+    const auto commands {get_section<ast::simple_command>(base, file_size, header.sections[COMMANDS])};
+    const auto pipelines {get_section<ast::pipeline>(base, file_size, header.sections[PIPELINES])};
+    const auto code {get_section<ast::instruction>(base, file_size, header.sections[CODE])};
+    if (!lines || !words || !commands || !pipelines || !code)
+        return std::nullopt;
+
+    // The nodes are copied out of the mapping: the parser builds them in
+    // growable vectors that the rest of the shell indexes, and they are
+    // small next to the source, which is used in place.
+    ast::program prog {};
+    prog.lines = line_index {std::vector<uint32_t>(lines->begin(), lines->end())};
+    prog.words.assign(words->begin(), words->end());
+    prog.commands.assign(commands->begin(), commands->end());
+    prog.pipelines.assign(pipelines->begin(), pipelines->end());
+    prog.code.assign(code->begin(), code->end());
+    prog.source = source_text::adopt_mapping(guard.release(), file_size, src.offset, src.count);
+
+    if (!is_consistent(prog))
+        return std::nullopt;
+    return prog;
+}
+
+/* Accumulates the sections of an entry in memory. */
+class entry_writer {
+    std::string payload {};
+
+    void align() {
+        const size_t offset {sizeof(cache_header) + payload.size()};
+        payload.append((ALIGNMENT - offset % ALIGNMENT) % ALIGNMENT, '\0');
+    }
+
+public:
+    cache_header header {
+        .magic = MAGIC,
+        .version = VERSION,
+        .path_size = 0,
+        .stamp = {},
+        .content_hash = 0,
+        .sections = {},
+    };
+
+    void append_path(std::string_view path) {
+        header.path_size = path.size();
+        payload.append(path);
+    }
+
+    template <typename T>
+    void append_section(section_id id, std::span<const T> items, size_t extra_bytes = 0) {
+        align();
+        const size_t start {payload.size()};
+        header.sections[id] = {sizeof(cache_header) + start, items.size()};
+        if constexpr (std::has_unique_object_representations_v<T>) {
+            payload.append(reinterpret_cast<const char*>(items.data()), items.size_bytes());
+            payload.append(extra_bytes, '\0');
+        } else {
+            payload.append(items.size_bytes() + extra_bytes, '\0');
+            for (size_t i = 0; i < items.size(); i++) {
+                encode(items[i], payload.data() + start + i * sizeof(T));
+            }
+        }
+    }
+
+    bool write_to(const fs::path& path) {
+        std::ofstream ofs {path, std::ios::binary | std::ios::trunc};
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ofs.write(payload.data(), payload.size());
+        return ofs.good();
+    }
+};
+
+void script_cache::write(const fs::path& entry, const fs::path& script, const script_stamp& stamp,
+    uint64_t content_hash, const ast::program& prog) noexcept
+{
+    try {
+        entry_writer writer {};
+        writer.header.stamp = stamp;
+        writer.header.content_hash = content_hash;
+        writer.append_path(script.native());
+        writer.append_section(SOURCE, std::span {prog.source.data(), prog.source.size()}, 1);
+        writer.append_section(LINES, std::span {prog.lines.starts()});
+        writer.append_section(WORDS, std::span {prog.words});
+        writer.append_section(COMMANDS, std::span {prog.commands});
+        writer.append_section(PIPELINES, std::span {prog.pipelines});
+        writer.append_section(CODE, std::span {prog.code});
+
+        // write to a temporary file first, so that readers never see a partial entry
+        fs::create_directories(entry.parent_path());
+        fs::path tmp {entry};
+        tmp += "." + std::to_string(getpid()) + ".tmp";
+        if (writer.write_to(tmp)) {
+            fs::rename(tmp, entry);
+        } else {
+            fs::remove(tmp);
+        }
+    } catch (...) {
+        // the cache is best effort only
+    }
+}
+
+ast::program script_cache::load(const fs::path& script, std::string_view delimeter) {
+    struct stat st;
+    if (stat(script.c_str(), &st) == -1)
+        throw fs::filesystem_error("Cannot read script", script, std::error_code(errno, std::generic_category()));
+
+    source_text source {source_text::map_file(script)};
+    const script_stamp stamp {
+        .mtime_sec = st.st_mtim.tv_sec,
+        .mtime_nsec = st.st_mtim.tv_nsec,
+        .size = (uint64_t) st.st_size,
+        .inode = (uint64_t) st.st_ino,
+    };
+
+    const fs::path entry {entry_path(script)};
+    if (entry.empty())
+        return parser::parse(std::move(source), delimeter);
+
+    if (auto cached {read(entry, script, stamp, source.view())})
+        return std::move(*cached);
+
+    // parsing ends words with NUL characters in place
+    const uint64_t content_hash {hash_bytes(source)};
+    ast::program prog {parser::parse(std::move(source), delimeter)};
+    write(entry, script, stamp, content_hash, prog);
+    return prog;
+}
@@ -0,0 +1,125 @@
+#include "source.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <utility>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+source_text::source_text(std::string text) :
+    owned(std::move(text)),
+    text_size(owned.size())
+{}
+
+source_text::~source_text() {
+    unmap();
+}
+
+source_text::source_text(source_text&& other) noexcept :
+    owned(std::move(other.owned)),
+    mapping(std::exchange(other.mapping, nullptr)),
+    mapping_size(std::exchange(other.mapping_size, 0)),
+    text(std::exchange(other.text, nullptr)),
+    text_size(std::exchange(other.text_size, 0))
+{}
+
+source_text& source_text::operator=(source_text&& other) noexcept {
+    if (this != &other) {
+        unmap();
+        owned = std::move(other.owned);
+        mapping = std::exchange(other.mapping, nullptr);
+        mapping_size = std::exchange(other.mapping_size, 0);
+        text = std::exchange(other.text, nullptr);
+        text_size = std::exchange(other.text_size, 0);
+    }
+    return *this;
+}
+
+void source_text::unmap() noexcept {
+    if (mapping) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+    }
+}
+
+source_text source_text::map_file(const fs::path& path) {
+    const auto fail {[&](int err) {
+        return fs::filesystem_error("Cannot read script", path, std::error_code(err, std::generic_category()));
+    }};
+
+    const int fd {open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (fd == -1)
+        throw fail(errno);
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        const int err {errno};
+        close(fd);
+        throw fail(err);
+    }
+
+    const size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return {};
+    }
+
+    // Reserve one byte more than the file has, so that the text is followed
+    // by a zeroed byte even if it ends exactly on a page boundary.
+    const size_t reserved {size + 1};
+    void* region {mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)};
+    if (region == MAP_FAILED) {
+        const int err {errno};
+        close(fd);
+        throw fail(err);
+    }
+    if (mmap(region, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        const int err {errno};
+        munmap(region, reserved);
+        close(fd);
+        throw fail(err);
+    }
+    close(fd);
+    madvise(region, size, MADV_SEQUENTIAL);
+
+    return adopt_mapping(static_cast<char*>(region), reserved, 0, size);
+}
+
+source_text source_text::adopt_mapping(char* mapping, size_t mapping_size, size_t offset, size_t size) {
+    source_text result {};
+    result.mapping = mapping;
+    result.mapping_size = mapping_size;
+    result.text = mapping + offset;
+    result.text_size = size;
+    return result;
+}
+
+line_index::line_index(std::string_view text) {
+    line_starts.push_back(0);
+    const char* const begin {text.data()};
+    const char* const end {begin + text.size()};
+    for (const char* p = begin; p < end;) {
+        const void* nl {memchr(p, '\n', end - p)};
+        if (!nl)
+            break;
+        p = static_cast<const char*>(nl) + 1;
+        line_starts.push_back(p - begin);
+    }
+}
+
+line_index::line_index(std::vector<uint32_t> line_starts) :
+    line_starts(std::move(line_starts))
+{}
+
+source_location line_index::locate(size_t position) const {
+    if (line_starts.empty())
+        return {1, position + 1};
+    const auto it {std::upper_bound(line_starts.begin(), line_starts.end(), position)};
+    const size_t line = it - line_starts.begin();
+    return {line, position - line_starts[line - 1] + 1};
+}
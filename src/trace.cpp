@@ -0,0 +1,130 @@
+#include "trace.h"
+#include "cmd/variable.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+/* Events are written once this much of them is buffered. */
+static const size_t FLUSH_SIZE = 64 * 1024;
+
+static int trace_fd {-1};
+/* Process that opened the trace and closes its array at exit */
+static pid_t owner {-1};
+static pid_t self {-1};
+static std::string buffer {};
+
+static void write_all(std::string_view data) noexcept {
+    while (!data.empty()) {
+        const ssize_t written {write(trace_fd, data.data(), data.size())};
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data.remove_prefix(written);
+    }
+}
+
+static void finish() {
+    if (trace_fd == -1)
+        return;
+    if (getpid() == owner)
+        buffer += "\n]\n";
+    trace::flush();
+}
+
+void trace::init() {
+    const auto path {var::find("STUSH_TRACE")};
+    if (trace_fd != -1 || !path || path->empty())
+        return;
+    // Copies of the shell write to the same file, O_APPEND keeps their chunks whole
+    trace_fd = open(std::string {*path}.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (trace_fd == -1) {
+        perror("stush: STUSH_TRACE");
+        return;
+    }
+    owner = self = getpid();
+    buffer.reserve(FLUSH_SIZE * 2);
+    // Every event after this one starts with a comma
+    buffer += "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":";
+    buffer += std::to_string(self);
+    buffer += ",\"args\":{\"name\":\"stush\"}}";
+    flush();
+    atexit(finish);
+}
+
+bool trace::enabled() noexcept {
+    return trace_fd != -1;
+}
+
+static void append_string(std::string_view text) {
+    buffer += '"';
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            buffer += '\\';
+            buffer += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            buffer += escaped;
+        } else {
+            buffer += c;
+        }
+    }
+    buffer += '"';
+}
+
+static std::string microseconds(trace::clock::duration d) {
+    return std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+}
+
+void trace::event(std::string_view name, clock::time_point start, clock::time_point end,
+    const details& args, pid_t thread)
+{
+    if (trace_fd == -1)
+        return;
+    buffer += ",\n{\"name\":";
+    append_string(name);
+    buffer += ",\"cat\":\"stush\",\"ph\":\"X\",\"ts\":";
+    buffer += microseconds(start.time_since_epoch());
+    buffer += ",\"dur\":";
+    buffer += microseconds(end - start);
+    buffer += ",\"pid\":";
+    buffer += std::to_string(self);
+    buffer += ",\"tid\":";
+    buffer += std::to_string(thread == -1 ? self : thread);
+    buffer += ",\"args\":{";
+    const char* separator {""};
+    if (args.pid != -1) {
+        buffer += "\"pid\":" + std::to_string(args.pid);
+        separator = ",";
+    }
+    if (!args.command.empty()) {
+        buffer += separator;
+        buffer += "\"argv0\":";
+        append_string(args.command);
+        separator = ",";
+    }
+    if (args.status) {
+        buffer += separator;
+        buffer += "\"status\":" + std::to_string(*args.status);
+    }
+    buffer += "}}";
+    if (buffer.size() >= FLUSH_SIZE)
+        flush();
+}
+
+void trace::flush() noexcept {
+    if (trace_fd == -1)
+        return;
+    write_all(buffer);
+    buffer.clear();
+}
+
+void trace::reset_after_fork() noexcept {
+    buffer.clear();
+    self = getpid();
+}
@@ -0,0 +1,151 @@
+#include "cmd/glob.h"
+#include "cmd/walk.h"
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <memory_resource>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+TEST(GlobMatcher, matchesWildcards) {
+    const glob::matcher m {"*.t?t"};
+    EXPECT_TRUE(m.magic());
+    EXPECT_TRUE(m.matches("a.txt"));
+    EXPECT_TRUE(m.matches(".tat"));
+    EXPECT_TRUE(m.matches("a.txt.txt"));
+    EXPECT_FALSE(m.matches("a.txt.bak"));
+    EXPECT_FALSE(m.matches("a.tt"));
+
+    EXPECT_TRUE(glob::matcher {"a*b*c"}.matches("aXbYbZc"));
+    EXPECT_FALSE(glob::matcher {"a*b*c"}.matches("aXcYb"));
+    EXPECT_TRUE(glob::matcher {"**"}.matches(""));
+}
+
+TEST(GlobMatcher, matchesBracketExpressions) {
+    EXPECT_TRUE(glob::matcher {"[a-c]x"}.matches("bx"));
+    EXPECT_FALSE(glob::matcher {"[a-c]x"}.matches("dx"));
+    EXPECT_TRUE(glob::matcher {"[!a-c]x"}.matches("dx"));
+    EXPECT_TRUE(glob::matcher {"[^a-c]x"}.matches("dx"));
+    EXPECT_TRUE(glob::matcher {"[]]"}.matches("]"));
+    EXPECT_TRUE(glob::matcher {"[[:digit:]]*"}.matches("1st"));
+    EXPECT_FALSE(glob::matcher {"[[:digit:]]*"}.matches("first"));
+    EXPECT_TRUE(glob::matcher {"[a-]"}.matches("-"));
+}
+
+TEST(GlobMatcher, unterminatedBracketIsLiteral) {
+    const glob::matcher m {"[ab"};
+    EXPECT_FALSE(m.magic());
+    EXPECT_TRUE(m.matches("[ab"));
+    EXPECT_FALSE(glob::matcher {"["}.magic());
+}
+
+TEST(GlobMatcher, hiddenNamesNeedLeadingDot) {
+    EXPECT_FALSE(glob::matcher {"*"}.matches_hidden());
+    EXPECT_TRUE(glob::matcher {".*"}.matches_hidden());
+}
+
+class GlobExpansionTest : public testing::Test {
+protected:
+    fs::path dir {fs::temp_directory_path() / ("stush_glob_test." + std::to_string(getpid()))};
+    std::pmr::monotonic_buffer_resource arena {};
+    glob::dir_cache dirs {};
+
+    void touch(const fs::path& path) {
+        fs::create_directories(path.parent_path());
+        std::ofstream {path};
+    }
+
+    std::vector<std::string> expand(const std::string& pattern) {
+        arg_list args {&arena};
+        glob::expand((dir / pattern).string(), dirs, args, &arena);
+        std::vector<std::string> result {};
+        for (const auto arg : args) {
+            result.emplace_back(fs::path {arg}.lexically_relative(dir).string());
+        }
+        return result;
+    }
+
+    void SetUp() override {
+        for (const char* name : {"c.txt", "a.txt", "b.log", ".hidden.txt", "sub/x.txt", "sub/y.log", "sub2/x.txt",
+            "sub/deep/z.txt", ".cache/w.txt"}) {
+            touch(dir / name);
+        }
+    }
+
+    void TearDown() override {
+        fs::remove_all(dir);
+    }
+};
+
+TEST_F(GlobExpansionTest, matchesSorted) {
+    EXPECT_EQ(expand("*.txt"), (std::vector<std::string> {"a.txt", "c.txt"}));
+    EXPECT_EQ(expand("?.*"), (std::vector<std::string> {"a.txt", "b.log", "c.txt"}));
+    EXPECT_EQ(expand("[ab].*"), (std::vector<std::string> {"a.txt", "b.log"}));
+}
+
+TEST_F(GlobExpansionTest, skipsHiddenUnlessAsked) {
+    EXPECT_EQ(expand(".*"), (std::vector<std::string> {".cache", ".hidden.txt"}));
+}
+
+TEST_F(GlobExpansionTest, descendsIntoDirectories) {
+    EXPECT_EQ(expand("*/x.txt"), (std::vector<std::string> {"sub/x.txt", "sub2/x.txt"}));
+    EXPECT_EQ(expand("sub*/*.txt"), (std::vector<std::string> {"sub/x.txt", "sub2/x.txt"}));
+    EXPECT_EQ(expand("*/"), (std::vector<std::string> {"sub/", "sub2/"}));
+}
+
+TEST_F(GlobExpansionTest, noMatchesAddNothing) {
+    EXPECT_TRUE(expand("*.c").empty());
+    EXPECT_TRUE(expand("missing/*").empty());
+    EXPECT_TRUE(expand("a.txt").empty());
+}
+
+TEST_F(GlobExpansionTest, listingsAreCached) {
+    const auto& listing {dirs.list(dir.string() + '/')};
+    touch(dir / "d.txt");
+    EXPECT_EQ(&dirs.list(dir.string() + '/'), &listing);
+    EXPECT_EQ(expand("*.txt"), (std::vector<std::string> {"a.txt", "c.txt"}));
+}
+
+TEST_F(GlobExpansionTest, doubleStarMatchesAnyDepth) {
+    EXPECT_EQ(expand("**/*.txt"),
+        (std::vector<std::string> {"a.txt", "c.txt", "sub/deep/z.txt", "sub/x.txt", "sub2/x.txt"}));
+    EXPECT_EQ(expand("sub/**/*.txt"), (std::vector<std::string> {"sub/deep/z.txt", "sub/x.txt"}));
+    EXPECT_EQ(expand("**/"), (std::vector<std::string> {"sub/", "sub/deep/", "sub2/"}));
+    EXPECT_EQ(expand("**/**/z.txt"), (std::vector<std::string> {"sub/deep/z.txt"}));
+}
+
+TEST_F(GlobExpansionTest, doubleStarAloneMatchesEverything) {
+    EXPECT_EQ(expand("sub/**"),
+        (std::vector<std::string> {"sub/deep", "sub/deep/z.txt", "sub/x.txt", "sub/y.log"}));
+}
+
+TEST_F(GlobExpansionTest, walksAreIndependentOfThreadCount) {
+    const auto paths {[](const std::vector<walk::directory>& dirs) {
+        std::vector<std::string> result {};
+        for (const auto& dir : dirs) {
+            result.push_back(dir.path);
+        }
+        return result;
+    }};
+    const std::string root {dir.string() + '/'};
+    const auto sequential {walk::tree(root, 1)};
+    const auto parallel {walk::tree(root, 4)};
+    EXPECT_EQ(paths(sequential), paths(parallel));
+    EXPECT_EQ(paths(sequential),
+        (std::vector<std::string> {root, root + "sub/", root + "sub/deep/", root + "sub2/"}));
+    EXPECT_EQ(sequential[1].contents.entries.size(), 3);
+
+    // large enough for the workers to start
+    for (int i = 0; i < 10; i++) {
+        for (int j = 0; j < 10; j++) {
+            touch(dir / "wide" / std::to_string(i) / std::to_string(j) / "f");
+        }
+    }
+    const auto wide_sequential {walk::tree(root, 1)};
+    const auto wide_parallel {walk::tree(root, 4)};
+    EXPECT_EQ(wide_sequential.size(), 4 + 111);
+    EXPECT_EQ(paths(wide_sequential), paths(wide_parallel));
+}
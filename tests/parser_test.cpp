@@ -127,3 +127,292 @@ TEST(ParserTest, ignoresComments) {
     res = tokenizer::tokenize("#    echo", " ");
     EXPECT_EQ(exp, res);
 }
+
+TEST(ParserTest, ParameterExpressionsStayOneWord) {
+    args_container exp {"echo", "${x:-a b;c}", "${y#\"}\"}z", "$a;"};
+    auto res = tokenizer::tokenize("echo ${x:-a b;c} ${y#\"}\"}z $a;", " ");
+    exp.back() = "$a";
+    exp.push_back(";");
+    EXPECT_EQ(exp, res);
+
+    exp = {"'${a b}'", "\"${a ${b c}}\""};
+    res = tokenizer::tokenize("'${a b}' \"${a ${b c}}\"", " ");
+    EXPECT_EQ(exp, res);
+}
+
+TEST(ParserTest, ArithmeticExpressionsStayOneWord) {
+    args_container exp {"echo", "$(( a + (b) ))x", "\"$(( (1) ))\"", "$((${c:-1}*2))"};
+    auto res = tokenizer::tokenize("echo $(( a + (b) ))x \"$(( (1) ))\" $((${c:-1}*2))", " ");
+    EXPECT_EQ(exp, res);
+}
+
+/* Opcodes of a program's code, for comparing its shape. */
+static std::vector<ast::opcode> opcodes(const ast::program& prog) {
+    std::vector<ast::opcode> ops {};
+    for (const auto& ins : prog.code) {
+        ops.push_back(ins.op);
+    }
+    return ops;
+}
+
+TEST(AstParserTest, BuildsListsPipelinesAndCommands) {
+    const auto prog = parser::parse("echo a | wc -l && ls; exit", " ");
+
+    ASSERT_EQ(prog.pipelines.size(), 3);
+    ASSERT_EQ(prog.commands.size(), 4);
+    ASSERT_EQ(prog.words.size(), 6);
+
+    using enum ast::opcode;
+    EXPECT_EQ(opcodes(prog), (std::vector {RUN_PIPELINE, JUMP_IF_FAILURE, RUN_PIPELINE, RUN_PIPELINE}));
+    EXPECT_EQ(prog.code[1].a, 3);
+
+    const auto stages {prog.commands_of(prog.pipelines[0])};
+    ASSERT_EQ(stages.size(), 2);
+    EXPECT_EQ(stages[0].pipe, ast::op_kind::PIPE_OUT);
+    EXPECT_EQ(stages[1].pipe, ast::op_kind::NONE);
+
+    const auto words {prog.words_of(stages[1])};
+    ASSERT_EQ(words.size(), 2);
+    EXPECT_EQ(prog.text(words[0]), "wc");
+    EXPECT_EQ(prog.text(words[1]), "-l");
+    EXPECT_EQ(words[1].span.start, 12);
+    EXPECT_EQ(words[1].span.end, 14);
+}
+
+TEST(AstParserTest, RecordsWhatWordsContain) {
+    const auto prog = parser::parse(
+        R"(cp -r a#b $x '*' *.c {a,b} ~/x a\ b "${y:-[}" $((2*3)) x~)", " ");
+    using namespace ast::word_flags;
+    std::vector<uint8_t> flags {};
+    for (const auto& w : prog.words) {
+        flags.push_back(w.flags);
+    }
+    EXPECT_EQ(flags, (std::vector<uint8_t> {
+        0, 0, 0, VARIABLE, QUOTES, GLOB, BRACES, TILDE, ESCAPES, QUOTES | VARIABLE, VARIABLE, 0
+    }));
+}
+
+TEST(AstParserTest, DistinguishesPipeKinds) {
+    const auto prog = parser::parse("make |& grep error | wc", " ");
+    ASSERT_EQ(prog.commands.size(), 3);
+    EXPECT_EQ(prog.commands[0].pipe, ast::op_kind::PIPE_BOTH);
+    EXPECT_EQ(prog.commands[1].pipe, ast::op_kind::PIPE_OUT);
+}
+
+TEST(AstParserTest, QuotedOperatorsAreWords) {
+    const auto prog = parser::parse(R"(echo '|' "&&" \;)", " ");
+    ASSERT_EQ(prog.commands.size(), 1);
+    EXPECT_EQ(prog.commands[0].nwords, 4);
+}
+
+TEST(AstParserTest, SkipsEmptyCommandsAndComments) {
+    const auto prog = parser::parse(" ;; echo a ;\n# comment\n", " ");
+    ASSERT_EQ(prog.pipelines.size(), 1);
+    ASSERT_EQ(prog.words.size(), 2);
+}
+
+TEST(AstParserTest, ContinuesAfterCommentOnNextLine) {
+    const auto prog = parser::parse("echo a # comment\necho b", " ");
+    ASSERT_EQ(prog.pipelines.size(), 2);
+    ASSERT_EQ(prog.words.size(), 4);
+    EXPECT_EQ(prog.text(prog.words[3]), "b");
+}
+
+TEST(AstParserTest, ThrowsOnMissingCommands) {
+    EXPECT_THROW(parser::parse("| wc", " "), parse_error);
+    EXPECT_THROW(parser::parse("ls | | wc", " "), parse_error);
+    EXPECT_THROW(parser::parse("&& ls", " "), parse_error);
+    EXPECT_THROW(parser::parse("ls && || ls", " "), parse_error);
+}
+
+TEST(AstParserTest, TerminatesWordsInSource) {
+    const auto prog = parser::parse("echo a|wc -l;ls", " ");
+    for (const auto& word : prog.words) {
+        const auto text {prog.text(word)};
+        EXPECT_EQ(text.data()[text.size()], '\0');
+    }
+    EXPECT_EQ(prog.text(prog.words[1]), "a");
+}
+
+TEST(AstParserTest, LineContinuationsSeparateWords) {
+    const auto prog = parser::parse("echo a \\\n  b\\\n", " ");
+    ASSERT_EQ(prog.words.size(), 3);
+    EXPECT_EQ(prog.text(prog.words[2]), "b\\\n");
+    ASSERT_EQ(prog.pipelines.size(), 1);
+}
+
+TEST(AstParserTest, OperatorsContinueOnNextLine) {
+    const auto prog = parser::parse("echo a |\n\n  wc -l &&\n  ls\nexit", " ");
+    ASSERT_EQ(prog.pipelines.size(), 3);
+    EXPECT_EQ(prog.code[1].op, ast::opcode::JUMP_IF_FAILURE);
+    EXPECT_EQ(prog.commands[0].pipe, ast::op_kind::PIPE_OUT);
+}
+
+TEST(AstParserTest, QuotesSpanLines) {
+    const auto prog = parser::parse("echo 'a\nb'\nls", " ");
+    ASSERT_EQ(prog.pipelines.size(), 2);
+    EXPECT_EQ(prog.text(prog.words[1]), "'a\nb'");
+}
+
+TEST(AstParserTest, ReportsErrorLocation) {
+    try {
+        auto prog = parser::parse("echo a\n\necho b |\n  | wc", " ");
+        FAIL() << "Expected parse_error";
+    } catch (const parse_error& err) {
+        EXPECT_EQ(err.location.line, 4);
+        EXPECT_EQ(err.location.column, 3);
+    }
+}
+
+TEST(LineIndexTest, LocatesPositions) {
+    const line_index lines {"ab\ncd\n\nef"};
+    EXPECT_EQ(lines.lines(), 4);
+    EXPECT_EQ(lines.locate(0).line, 1);
+    EXPECT_EQ(lines.locate(2).column, 3);
+    EXPECT_EQ(lines.locate(3).line, 2);
+    EXPECT_EQ(lines.locate(6).line, 3);
+    EXPECT_EQ(lines.locate(8).line, 4);
+    EXPECT_EQ(lines.locate(8).column, 2);
+}
+
+TEST(ControlFlowParserTest, CompilesIfToJumps) {
+    const auto prog = parser::parse("if a; then b; elif c; then d; else e; fi", " ");
+    using enum ast::opcode;
+    EXPECT_EQ(opcodes(prog), (std::vector {
+        RUN_PIPELINE, JUMP_IF_FAILURE, RUN_PIPELINE, JUMP,
+        RUN_PIPELINE, JUMP_IF_FAILURE, RUN_PIPELINE, JUMP,
+        RUN_PIPELINE,
+    }));
+    EXPECT_EQ(prog.code[1].a, 4);
+    EXPECT_EQ(prog.code[3].a, 9);
+    EXPECT_EQ(prog.code[5].a, 8);
+}
+
+TEST(ControlFlowParserTest, CompilesLoops) {
+    const auto prog = parser::parse("for i in a b\ndo\n  x $i\ndone\nwhile c; do break; done", " ");
+    using enum ast::opcode;
+    EXPECT_EQ(opcodes(prog), (std::vector {
+        FOR_BEGIN, FOR_NEXT, RUN_PIPELINE, JUMP,
+        RUN_PIPELINE, JUMP_IF_FAILURE, SET_STATUS, JUMP, JUMP, SET_STATUS,
+    }));
+    EXPECT_EQ(prog.text(prog.words[prog.code[0].b]), "i");
+    EXPECT_EQ(prog.commands[prog.code[0].a].nwords, 2);
+    EXPECT_EQ(prog.code[1].b, 4);
+    EXPECT_EQ(prog.code[3].a, 1);
+    EXPECT_EQ(prog.code[7].a, 9);
+}
+
+TEST(ControlFlowParserTest, ContinueDropsInnerLoops) {
+    const auto prog = parser::parse("for i in a; do for j in b; do continue 2; done; done", " ");
+    using enum ast::opcode;
+    EXPECT_EQ(opcodes(prog), (std::vector {
+        FOR_BEGIN, FOR_NEXT, FOR_BEGIN, FOR_NEXT, POP_LOOP, SET_STATUS, JUMP, JUMP, JUMP,
+    }));
+    EXPECT_EQ(prog.code[6].a, 1);
+}
+
+TEST(ControlFlowParserTest, CompilesCase) {
+    const auto prog = parser::parse("case $x in\n  a|(b) y;;\n  *) ;;\nesac", " ");
+    using enum ast::opcode;
+    EXPECT_EQ(opcodes(prog), (std::vector {
+        CASE_BEGIN, CASE_MATCH, CASE_MATCH, JUMP, RUN_PIPELINE, JUMP,
+        CASE_MATCH, JUMP, JUMP, CASE_END,
+    }));
+    EXPECT_EQ(prog.text(prog.words[prog.code[1].a]), "a");
+    EXPECT_EQ(prog.text(prog.words[prog.code[2].a]), "(b");
+    EXPECT_EQ(prog.text(prog.words[prog.code[6].a]), "*");
+    EXPECT_EQ(prog.code[3].a, 6);
+    EXPECT_EQ(prog.code[7].a, 9);
+    EXPECT_EQ(prog.code[8].a, 10);
+}
+
+TEST(ControlFlowParserTest, DefinesFunctions) {
+    for (const auto* source : {"f() { a; }", "f () { a; }", "function f { a; }", "function f() {\n a\n}"}) {
+        const auto prog = parser::parse(source, " ");
+        using enum ast::opcode;
+        ASSERT_EQ(opcodes(prog), (std::vector {DEFINE_FUNCTION, JUMP, RUN_PIPELINE, RETURN})) << source;
+        EXPECT_EQ(prog.text(prog.words[prog.code[0].a]), "f");
+        EXPECT_EQ(prog.code[0].b, 2);
+        EXPECT_EQ(prog.code[1].a, 4);
+    }
+}
+
+TEST(ControlFlowParserTest, CompoundStagesGetBodies) {
+    const auto prog = parser::parse("a | if b; then c; fi | d", " ");
+    using enum ast::opcode;
+    EXPECT_EQ(opcodes(prog), (std::vector {
+        JUMP, RUN_PIPELINE, JUMP_IF_FAILURE, RUN_PIPELINE, JUMP, SET_STATUS, RETURN, RUN_PIPELINE,
+    }));
+    EXPECT_EQ(prog.code[0].a, 7);
+    EXPECT_EQ(prog.code[2].a, 5);
+    EXPECT_EQ(prog.code[4].a, 6);
+
+    const auto stages {prog.commands_of(prog.pipelines[prog.code.back().a])};
+    ASSERT_EQ(stages.size(), 3);
+    EXPECT_EQ(stages[1].body, 1);
+    EXPECT_EQ(stages[1].nwords, 0);
+    EXPECT_EQ(stages[2].body, ast::NO_INDEX);
+}
+
+TEST(ControlFlowParserTest, CompilesTimedPipelines) {
+    const auto prog = parser::parse("time -j a | b && time { c; }\necho time", " ");
+    using enum ast::opcode;
+    EXPECT_EQ(opcodes(prog), (std::vector {
+        RUN_TIMED_PIPELINE, JUMP_IF_FAILURE, JUMP, RUN_PIPELINE, RETURN, RUN_TIMED_PIPELINE, RUN_PIPELINE,
+    }));
+    EXPECT_EQ(prog.code[0].b, static_cast<uint32_t>(ast::time_format::JSON));
+    EXPECT_EQ(prog.commands_of(prog.pipelines[prog.code[0].a]).size(), 2);
+    EXPECT_EQ(prog.code[1].a, 6);
+
+    // a timed compound command is a pipeline of its own
+    EXPECT_EQ(prog.code[5].b, static_cast<uint32_t>(ast::time_format::HUMAN));
+    EXPECT_EQ(prog.commands_of(prog.pipelines[prog.code[5].a])[0].body, 3);
+    EXPECT_EQ(prog.commands_of(prog.pipelines[prog.code[6].a])[0].nwords, 2);
+    EXPECT_THROW(parser::parse("time -j | a", " "), parse_error);
+
+    // a bare time is an empty pipeline
+    for (const auto* source : {"time", "time; a", "time -j\na"}) {
+        const auto bare = parser::parse(source, " ");
+        EXPECT_EQ(bare.code[0].op, RUN_TIMED_PIPELINE) << source;
+        EXPECT_TRUE(bare.commands_of(bare.pipelines[bare.code[0].a]).empty()) << source;
+    }
+}
+
+TEST(ControlFlowParserTest, CompilesBackgroundLists) {
+    const auto prog = parser::parse("a && { b; } | c &\nd&e", " ");
+    using enum ast::opcode;
+    EXPECT_EQ(opcodes(prog), (std::vector {
+        JUMP, RUN_PIPELINE, JUMP_IF_FAILURE, JUMP, RUN_PIPELINE, RETURN, RUN_PIPELINE, RETURN,
+        RUN_BACKGROUND, JUMP, RUN_PIPELINE, RETURN, RUN_BACKGROUND, RUN_PIPELINE,
+    }));
+    EXPECT_EQ(prog.code[0].a, 8);
+    EXPECT_EQ(prog.code[2].a, 7);
+
+    // the stage inside the list moved along with it
+    const auto& stage {prog.commands_of(prog.pipelines[prog.code[6].a])[0]};
+    EXPECT_EQ(stage.body, 4);
+    const auto& list {prog.commands[prog.code[8].a]};
+    EXPECT_EQ(list.body, 1);
+    EXPECT_EQ(list.nwords, 3);
+    EXPECT_EQ(prog.text(prog.words_of(prog.commands[prog.code[12].a])[0]), "d");
+    EXPECT_THROW(parser::parse("& a", " "), parse_error);
+    EXPECT_THROW(parser::parse("a && & b", " "), parse_error);
+}
+
+TEST(ControlFlowParserTest, KeywordsOnlyStartCommands) {
+    const auto prog = parser::parse("echo if then fi; 'if' x", " ");
+    EXPECT_EQ(prog.pipelines.size(), 2);
+    EXPECT_EQ(prog.words.size(), 6);
+}
+
+TEST(ControlFlowParserTest, ThrowsOnInvalidControlFlow) {
+    EXPECT_THROW(parser::parse("if a; then b", " "), parse_error);
+    EXPECT_THROW(parser::parse("while a; b; done", " "), parse_error);
+    EXPECT_THROW(parser::parse("fi", " "), parse_error);
+    EXPECT_THROW(parser::parse("break", " "), parse_error);
+    EXPECT_THROW(parser::parse("for i in a; do f() { break; }; done", " "), parse_error);
+    EXPECT_THROW(parser::parse("for i in a; do { break; } | b; done", " "), parse_error);
+    EXPECT_THROW(parser::parse("case a in b c) d;; esac", " "), parse_error);
+    EXPECT_THROW(parser::parse("if a; then b; fi c", " "), parse_error);
+    EXPECT_THROW(parser::parse("f() g", " "), parse_error);
+}
@@ -0,0 +1,60 @@
+#include "cmd/reaper.h"
+#include "cmd/spawn.h"
+#include <array>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <initializer_list>
+#include <string_view>
+#include <sys/wait.h>
+
+using namespace std::chrono_literals;
+
+static pid_t start(std::initializer_list<std::string_view> args) {
+    int status {};
+    const pid_t pid {spawn_command({args.begin(), args.size()}, {}, status)};
+    EXPECT_NE(pid, -1);
+    return pid;
+}
+
+TEST(Reaper, reportsStatusAndUsage) {
+    const pid_t pid {start({"sh", "-c", "exit 3"})};
+    const auto child {reaper::wait(pid)};
+    ASSERT_TRUE(child.has_value());
+    EXPECT_EQ(child->pid, pid);
+    ASSERT_TRUE(WIFEXITED(child->status));
+    EXPECT_EQ(WEXITSTATUS(child->status), 3);
+    EXPECT_GT(child->usage.ru_maxrss, 0);
+    EXPECT_GT(child->elapsed.count(), 0);
+}
+
+TEST(Reaper, collectsChildrenInCompletionOrder) {
+    const std::array pids {start({"sleep", "0.3"}), start({"true"})};
+    const auto first {reaper::wait_any(pids)};
+    ASSERT_TRUE(first.has_value());
+    EXPECT_EQ(first->pid, pids[1]);
+    const auto second {reaper::wait_any(pids)};
+    ASSERT_TRUE(second.has_value());
+    EXPECT_EQ(second->pid, pids[0]);
+    EXPECT_GE(second->elapsed, 300ms);
+}
+
+TEST(Reaper, givesUpAtTheDeadline) {
+    const pid_t pid {start({"sleep", "0.3"})};
+    EXPECT_FALSE(reaper::wait(pid, reaper::clock::now() + 50ms).has_value());
+    EXPECT_TRUE(reaper::wait(pid).has_value());
+    // a child that is gone can't be waited for
+    EXPECT_FALSE(reaper::wait(pid).has_value());
+}
+
+TEST(Reaper, chargesAccountsOpenWhenChildrenStarted) {
+    const pid_t before {start({"true"})};
+    const reaper::account outer {};
+    const pid_t inside {start({"true"})};
+    {
+        const reaper::account inner {};
+        ASSERT_TRUE(reaper::wait(before).has_value());
+        ASSERT_TRUE(reaper::wait(inside).has_value());
+        EXPECT_EQ(inner.max_rss, 0);
+    }
+    EXPECT_GT(outer.max_rss, 0);
+}
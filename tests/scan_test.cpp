@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <scan.h>
+#include <string>
+
+TEST(ScanTest, FindsNothingInEmptyString) {
+    const scan::char_set set {"|;"};
+    EXPECT_EQ(scan::find_first_of("", 0, set), 0);
+}
+
+TEST(ScanTest, FindsCharsInEveryPositionOfAChunk) {
+    const scan::char_set set {"\"'\\ \t"};
+    for (size_t len = 1; len < 100; len++) {
+        for (size_t at = 0; at < len; at++) {
+            std::string str(len, 'x');
+            str[at] = '\\';
+            EXPECT_EQ(scan::find_first_of(str, 0, set), at);
+        }
+    }
+}
+
+TEST(ScanTest, StartsSearchingAtPosition) {
+    const scan::char_set set {";"};
+    const std::string str {"a;bcdefghijklmnopqrstuvwxyzabcdefghijklmnop;q"};
+    EXPECT_EQ(scan::find_first_of(str, 0, set), 1);
+    EXPECT_EQ(scan::find_first_of(str, 2, set), 43);
+    EXPECT_EQ(scan::find_first_of(str, 44, set), str.size());
+}
+
+TEST(ScanTest, MatchesScalarVersion) {
+    const scan::char_set set {" \t'\"\\\n#;|&"};
+    std::mt19937 gen {42};
+    std::uniform_int_distribution<int> byte {0, 255};
+    std::string str(4096, 'a');
+    for (auto& c : str) {
+        // keep special bytes sparse so that long chunks are skipped
+        c = byte(gen) < 8 ? ';' : static_cast<char>(byte(gen) | 0x80);
+    }
+    for (size_t pos = 0; pos < str.size(); pos++) {
+        ASSERT_EQ(scan::find_first_of(str, pos, set), scan::find_first_of_scalar(str, pos, set));
+    }
+}
+
+TEST(ScanTest, LargeSetsFallBackToScalar) {
+    const scan::char_set set {"abcdefghijklmnopqrstuvwxyz"};
+    EXPECT_FALSE(set.vectorizable());
+    EXPECT_EQ(scan::find_first_of("0123456789012345678901234567890123z", 0, set), 34);
+}
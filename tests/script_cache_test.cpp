@@ -0,0 +1,139 @@
+#include "cmd/variable.h"
+#include "parser.h"
+#include "script_cache.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+class ScriptCacheTest : public testing::Test {
+protected:
+    fs::path dir {fs::temp_directory_path() / ("stush_cache_test." + std::to_string(getpid()))};
+    fs::path script {dir / "script.sh"};
+    fs::path entry {dir / "entry.stc"};
+    script_cache::script_stamp stamp {.mtime_sec = 1, .mtime_nsec = 2, .size = 3, .inode = 4};
+
+    void SetUp() override {
+        fs::create_directories(dir);
+    }
+
+    void TearDown() override {
+        fs::remove_all(dir);
+    }
+};
+
+TEST_F(ScriptCacheTest, RoundTripsPrograms) {
+    const std::string source {"echo a | wc -l && ls 'x y'\nexit"};
+    const auto prog = parser::parse(source, " ");
+    script_cache::write(entry, script, stamp, script_cache::hash_bytes(source), prog);
+
+    const auto cached {script_cache::read(entry, script, stamp, source)};
+    ASSERT_TRUE(cached.has_value());
+    ASSERT_EQ(cached->words.size(), prog.words.size());
+    for (size_t i = 0; i < prog.words.size(); i++) {
+        EXPECT_EQ(cached->text(cached->words[i]), prog.text(prog.words[i]));
+    }
+    EXPECT_EQ(cached->commands.size(), prog.commands.size());
+    EXPECT_EQ(cached->pipelines.size(), prog.pipelines.size());
+    ASSERT_EQ(cached->code.size(), prog.code.size());
+    EXPECT_EQ(cached->code[1].op, ast::opcode::JUMP_IF_FAILURE);
+    EXPECT_EQ(cached->lines.lines(), 2);
+    const auto last {cached->text(cached->words.back())};
+    EXPECT_EQ(last.data()[last.size()], '\0');
+}
+
+TEST_F(ScriptCacheTest, KeepsEmptyPipelines) {
+    // a bare time times an empty pipeline
+    script_cache::write(entry, script, stamp, script_cache::hash_bytes("time"), parser::parse("time", " "));
+    EXPECT_TRUE(script_cache::read(entry, script, stamp, "time").has_value());
+}
+
+TEST_F(ScriptCacheTest, RejectsStaleEntries) {
+    const auto prog = parser::parse("echo a", " ");
+    script_cache::write(entry, script, stamp, script_cache::hash_bytes("echo a"), prog);
+
+    auto changed {stamp};
+    changed.inode++;
+    EXPECT_FALSE(script_cache::read(entry, script, changed, "echo a").has_value());
+    EXPECT_FALSE(script_cache::read(entry, dir / "other.sh", stamp, "echo a").has_value());
+    // the same stamp with other contents
+    EXPECT_FALSE(script_cache::read(entry, script, stamp, "echo b").has_value());
+    EXPECT_TRUE(script_cache::read(entry, script, stamp, "echo a").has_value());
+}
+
+TEST_F(ScriptCacheTest, RejectsCorruptEntries) {
+    const std::string source {"echo a; echo b"};
+    const auto prog = parser::parse(source, " ");
+    script_cache::write(entry, script, stamp, script_cache::hash_bytes(source), prog);
+    ASSERT_TRUE(script_cache::read(entry, script, stamp, source).has_value());
+
+    {
+        // the operand of the last instruction
+        std::fstream fs {entry, std::ios::in | std::ios::out | std::ios::binary};
+        fs.seekp(-8, std::ios::end);
+        fs.write("\x7f\x7f\x7f\x7f", 4);
+    }
+    EXPECT_FALSE(script_cache::read(entry, script, stamp, source).has_value());
+
+    fs::resize_file(entry, 16);
+    EXPECT_FALSE(script_cache::read(entry, script, stamp, source).has_value());
+}
+
+/* Parses source into nodes whose padding is filled with fill. */
+static ast::program parse_padded(std::string_view source, int fill) {
+    auto prog {parser::parse(std::string {source}, " ")};
+    for (auto& w : prog.words) {
+        const ast::word copy {w};
+        std::memset(&w, fill, sizeof(w));
+        w.span = copy.span;
+        w.flags = copy.flags;
+    }
+    for (auto& ins : prog.code) {
+        const ast::instruction copy {ins};
+        std::memset(&ins, fill, sizeof(ins));
+        ins.op = copy.op;
+        ins.a = copy.a;
+        ins.b = copy.b;
+    }
+    return prog;
+}
+
+static std::string read_file(const fs::path& path) {
+    std::ifstream file {path, std::ios::binary};
+    return {std::istreambuf_iterator<char> {file}, {}};
+}
+
+TEST_F(ScriptCacheTest, WritesNoPadding) {
+    const std::string_view source {"for i in a b; do echo $i | cat; done"};
+    script_cache::write(entry, script, stamp, script_cache::hash_bytes(source), parse_padded(source, 0x55));
+    const std::string first {read_file(entry)};
+    script_cache::write(entry, script, stamp, script_cache::hash_bytes(source), parse_padded(source, 0xaa));
+    EXPECT_EQ(read_file(entry), first);
+}
+
+TEST_F(ScriptCacheTest, LoadRefreshesCache) {
+    var::set_var("XDG_CACHE_HOME", dir.native());
+    {
+        std::ofstream ofs {script};
+        ofs << "echo first\n";
+    }
+    const auto parsed {script_cache::load(script, " ")};
+    EXPECT_TRUE(fs::exists(script_cache::entry_path(script)));
+
+    const auto cached {script_cache::load(script, " ")};
+    ASSERT_EQ(cached.words.size(), 2);
+    EXPECT_EQ(cached.text(cached.words[1]), "first");
+
+    {
+        std::ofstream ofs {script};
+        ofs << "echo second one\n";
+    }
+    const auto reparsed {script_cache::load(script, " ")};
+    ASSERT_EQ(reparsed.words.size(), 3);
+    EXPECT_EQ(reparsed.text(reparsed.words[1]), "second");
+}
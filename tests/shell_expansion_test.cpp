@@ -1,10 +1,14 @@
+#include "cmd/brace.h"
 #include "cmd/cmd.h"
 #include "cmd/expansion.h"
+#include "cmd/tilde.h"
 #include "cmd/variable.h"
 #include "parser.h"
 #include <cstdlib>
+#include <memory_resource>
 #include <gtest/gtest.h>
 #include <string>
+#include <vector>
 
 TEST(VarExpansion, expandsSingleShellVars) {
     var::set_var("USERHOME", "/home/user1");
@@ -49,6 +53,51 @@ TEST(VarExpansion, doesntExpandEscapedVars) {
     EXPECT_EQ(varstr, exp);
 }
 
+TEST(VarExpansion, expandsAdjacentVarsOnce) {
+    var::set_var("EMPTY", "");
+    var::set_var("NAME", "bar");
+    var::set_var("REF", "$NAME");
+
+    std::string varstr {"$EMPTY$NAME $REF"};
+    const std::string exp {"bar $NAME"};
+
+    expand_word(varstr);
+
+    EXPECT_EQ(varstr, exp);
+}
+
+TEST(VarExpansion, expandsSpecialParameters) {
+    var::set_last_status(3);
+    var::push_positional({"a", "b"});
+
+    std::string varstr {"$?:$#:$1$2x:$3"};
+    const std::string exp {"3:2:abx:"};
+
+    expand_word(varstr);
+    var::pop_positional();
+
+    EXPECT_EQ(varstr, exp);
+}
+
+TEST(VarExpansion, unchangedWordsAreNotCopied) {
+    std::string out {"previous"};
+    const std::string_view word {"plain/word"};
+
+    const auto expanded {expand_word(word, out)};
+
+    EXPECT_EQ(expanded.data(), word.data());
+    EXPECT_EQ(out, "previous");
+}
+
+TEST(VarExpansion, reusesOutputBuffer) {
+    var::set_var("NAME", "bar");
+    std::string out {};
+
+    EXPECT_EQ(expand_word("a\\ $NAME\\$NAME\\", out), "a bar$NAME");
+    EXPECT_EQ(expand_word("$NAME", out), "bar");
+    EXPECT_EQ(expand_word("$NAME", out).data(), out.data());
+}
+
 TEST(TildeExpansion, expandsDefaultHome) {
     const char* home {getenv("HOME")};
     std::string tildestr {"~"};
@@ -86,6 +135,36 @@ TEST(TildeExpansion, doesntExpandEscaped) {
     EXPECT_EQ(tildestr, exp);
 }
 
+TEST(TildeExpansion, memoizesUserHomes) {
+    const auto first {tilde::home_of("root")};
+    ASSERT_TRUE(first.has_value());
+    EXPECT_EQ(*first, "/root");
+    EXPECT_EQ(tilde::home_of("root")->data(), first->data());
+
+    EXPECT_FALSE(tilde::home_of("no such user").has_value());
+    EXPECT_FALSE(tilde::home_of("no such user").has_value());
+}
+
+TEST(TildeExpansion, readsHomeUntilItChanges) {
+    const std::string saved {var::get_var("HOME")};
+    var::set_var("HOME", "/first");
+    const auto first {tilde::home()};
+    EXPECT_EQ(first, "/first");
+    EXPECT_EQ(tilde::home()->data(), first->data());
+
+    var::set_var("HOME", "/second");
+    EXPECT_EQ(tilde::home(), "/second");
+    var::push_scope();
+    var::set_local("HOME", "/local");
+    EXPECT_EQ(tilde::home(), "/local");
+    var::pop_scope();
+    EXPECT_EQ(tilde::home(), "/second");
+    var::unset("HOME");
+    EXPECT_FALSE(tilde::home().has_value());
+
+    var::set_var("HOME", saved);
+}
+
 TEST(ExpansionIntegrationTest, preservesTextInQuotes) {
     var::set_var("DIR", "location");
     const std::string input {"ls $DIR   ' enclosed args   ' some/~/location     \"enclosed '2'\" "};
@@ -118,3 +197,241 @@ TEST(ExpansionIntegrationTest, emptyQuotesGiveEmptyArgs) {
     }
     EXPECT_EQ(act, exp);
 }
+
+TEST(ArgumentExpansion, literalWordsAreNotCopied) {
+    std::pmr::monotonic_buffer_resource arena {};
+    arg_list args {&arena};
+    const std::string word {"literal"};
+
+    expand_argument(word, args, &arena);
+
+    ASSERT_EQ(args.size(), 1);
+    EXPECT_EQ(args[0].data(), word.data());
+}
+
+TEST(ArgumentExpansion, changedWordsAreTerminatedCopies) {
+    var::set_var("DIR", "location");
+    std::pmr::monotonic_buffer_resource arena {};
+    arg_list args {&arena};
+    const std::string source {"'quoted'$DIR"};
+    const std::string_view quoted {std::string_view {source}.substr(0, 8)};
+
+    expand_argument(quoted, args, &arena);
+    expand_argument("$DIR", args, &arena);
+
+    ASSERT_EQ(args.size(), 2);
+    EXPECT_EQ(args[0], "quoted");
+    EXPECT_EQ(args[0].data()[args[0].size()], '\0');
+    EXPECT_EQ(args[1], "location");
+    EXPECT_EQ(args[1].data()[args[1].size()], '\0');
+}
+
+TEST(ArgumentExpansion, wordsWithoutTerminatorAreCopied) {
+    std::pmr::monotonic_buffer_resource arena {};
+    arg_list args {&arena};
+    const std::string source {"a&b"};
+
+    expand_argument(std::string_view {source}.substr(0, 1), args, &arena);
+
+    ASSERT_EQ(args.size(), 1);
+    EXPECT_EQ(args[0], "a");
+    EXPECT_NE(args[0].data(), source.data());
+    EXPECT_EQ(args[0].data()[1], '\0');
+}
+
+static std::vector<std::string> generate(std::string_view word) {
+    brace::generator words {word};
+    std::vector<std::string> result {};
+    std::string out {};
+    while (words.next(out)) {
+        result.push_back(out);
+    }
+    return result;
+}
+
+TEST(BraceExpansion, expandsLists) {
+    EXPECT_EQ(generate("a{b,c}d"), (std::vector<std::string> {"abd", "acd"}));
+    EXPECT_EQ(generate("{a,b}{c,d}"), (std::vector<std::string> {"ac", "ad", "bc", "bd"}));
+    EXPECT_EQ(generate("{a,b{c,d}}e"), (std::vector<std::string> {"ae", "bce", "bde"}));
+    EXPECT_EQ(generate("x{a,}"), (std::vector<std::string> {"xa", "x"}));
+}
+
+TEST(BraceExpansion, expandsSequences) {
+    EXPECT_EQ(generate("{1..4}"), (std::vector<std::string> {"1", "2", "3", "4"}));
+    EXPECT_EQ(generate("{3..-1..2}"), (std::vector<std::string> {"3", "1", "-1"}));
+    EXPECT_EQ(generate("{08..11}"), (std::vector<std::string> {"08", "09", "10", "11"}));
+    EXPECT_EQ(generate("{a..e..2}"), (std::vector<std::string> {"a", "c", "e"}));
+}
+
+TEST(BraceExpansion, leavesOtherBracesAlone) {
+    for (const char* word : {"{a}", "{}", "{a,b", "\\{a,b}", "'{a,b}'", "${a,b}", "{1..x}"}) {
+        EXPECT_FALSE(brace::has_braces(word)) << word;
+        EXPECT_EQ(generate(word), (std::vector<std::string> {word}));
+    }
+    EXPECT_EQ(generate("{a}{b,c}"), (std::vector<std::string> {"{a}b", "{a}c"}));
+}
+
+TEST(BraceExpansion, generatesHugeSequencesLazily) {
+    brace::generator words {"{1..9223372036854775807}"};
+    std::string out {};
+    for (int i = 1; i <= 3; i++) {
+        ASSERT_TRUE(words.next(out));
+        EXPECT_EQ(out, std::to_string(i));
+    }
+}
+
+TEST(BraceExpansion, expandsArgumentsFurther) {
+    var::set_var("X", "x");
+    std::pmr::monotonic_buffer_resource arena {};
+    arg_list args {&arena};
+
+    expand_argument("z{y,$X}", args, &arena);
+
+    ASSERT_EQ(args.size(), 2);
+    EXPECT_EQ(args[0], "zy");
+    EXPECT_EQ(args[1], "zx");
+    EXPECT_EQ(args[1].data()[2], '\0');
+}
+
+TEST(BraceExpansion, refusesArgumentListsOverTheLimit) {
+    std::pmr::monotonic_buffer_resource arena {};
+    arg_list args {&arena};
+    EXPECT_THROW(expand_argument("{1..100000000}", args, &arena), expansion_error);
+    // more words than can be counted
+    args.clear();
+    EXPECT_THROW(expand_argument("{-9223372036854775808..9223372036854775807}", args, &arena),
+        expansion_error);
+    EXPECT_TRUE(args.empty());
+}
+
+static std::string expand(std::string_view word) {
+    std::string out {};
+    return std::string {expand_word(word, out)};
+}
+
+TEST(ParameterExpansion, expandsDefaultsAndLengths) {
+    var::set_var("FULL", "value");
+    var::set_var("EMPTY", "");
+    EXPECT_EQ(expand("${FULL}s"), "values");
+    EXPECT_EQ(expand("${#FULL}"), "5");
+    EXPECT_EQ(expand("${#UNSET_PARAM}"), "0");
+    EXPECT_EQ(expand("${FULL:-other}"), "value");
+    EXPECT_EQ(expand("${EMPTY:-other}"), "other");
+    EXPECT_EQ(expand("${EMPTY-other}"), "");
+    EXPECT_EQ(expand("${UNSET_PARAM-$FULL}"), "value");
+    EXPECT_EQ(expand("${UNSET_PARAM:-\"a b\"}"), "a b");
+}
+
+TEST(ParameterExpansion, removesPrefixesAndSuffixes) {
+    var::set_var("PATHNAME", "/usr/lib/libfoo.so.1");
+    EXPECT_EQ(expand("${PATHNAME##*/}"), "libfoo.so.1");
+    EXPECT_EQ(expand("${PATHNAME#*/}"), "usr/lib/libfoo.so.1");
+    EXPECT_EQ(expand("${PATHNAME%/*}"), "/usr/lib");
+    EXPECT_EQ(expand("${PATHNAME%%.*}"), "/usr/lib/libfoo");
+    EXPECT_EQ(expand("${PATHNAME%.1}"), "/usr/lib/libfoo.so");
+    EXPECT_EQ(expand("${PATHNAME#/usr}"), "/lib/libfoo.so.1");
+    EXPECT_EQ(expand("${PATHNAME#nothing}"), "/usr/lib/libfoo.so.1");
+}
+
+TEST(ParameterExpansion, replacesMatches) {
+    var::set_var("TEXT", "a-b-c");
+    EXPECT_EQ(expand("${TEXT/-/+}"), "a+b-c");
+    EXPECT_EQ(expand("${TEXT//-/+}"), "a+b+c");
+    EXPECT_EQ(expand("${TEXT//-}"), "abc");
+    EXPECT_EQ(expand("${TEXT/#a/x}"), "x-b-c");
+    EXPECT_EQ(expand("${TEXT/#b/x}"), "a-b-c");
+    EXPECT_EQ(expand("${TEXT/%c/x}"), "a-b-x");
+    EXPECT_EQ(expand("${TEXT/-*-/=}"), "a=c");
+    EXPECT_EQ(expand("${TEXT//[ab]/x}"), "x-x-c");
+}
+
+TEST(ParameterExpansion, takesSubstrings) {
+    var::set_var("TEXT", "abcdef");
+    EXPECT_EQ(expand("${TEXT:2}"), "cdef");
+    EXPECT_EQ(expand("${TEXT:1:3}"), "bcd");
+    EXPECT_EQ(expand("${TEXT: -2}"), "ef");
+    EXPECT_EQ(expand("${TEXT:1:-1}"), "bcde");
+    EXPECT_EQ(expand("${TEXT:10}"), "");
+}
+
+TEST(ParameterExpansion, rejectsBadSubstitutions) {
+    EXPECT_THROW(expand("${}"), expansion_error);
+    EXPECT_THROW(expand("${TEXT"), expansion_error);
+    EXPECT_THROW(expand("${TEXT:x}"), expansion_error);
+    EXPECT_THROW(expand("${TEXT!}"), expansion_error);
+}
+
+TEST(ArithmeticExpansion, followsPrecedence) {
+    EXPECT_EQ(expand("$((1 + 2 * 3))"), "7");
+    EXPECT_EQ(expand("$(( (1 + 2) * 3 ))"), "9");
+    EXPECT_EQ(expand("$((2 ** 3 ** 2))"), "512");
+    EXPECT_EQ(expand("$((-2 ** 2))"), "4");
+    EXPECT_EQ(expand("$((7 / 2 + 7 % 2 - 10))"), "-6");
+    EXPECT_EQ(expand("$((1 << 4 | 1 & 3 ^ 2))"), "19");
+    EXPECT_EQ(expand("$((0x10 + 010 + ~0 + !5))"), "23");
+    EXPECT_EQ(expand("x$((3 > 2 == 1))y"), "x1y");
+    EXPECT_EQ(expand("$(( ))"), "0");
+}
+
+TEST(ArithmeticExpansion, wrapsAround) {
+    EXPECT_EQ(expand("$((9223372036854775807 + 1))"), "-9223372036854775808");
+    EXPECT_EQ(expand("$(( (-9223372036854775807 - 1) / -1 ))"), "-9223372036854775808");
+    EXPECT_EQ(expand("$((1 << 65))"), "2");
+}
+
+TEST(ArithmeticExpansion, assignsVariables) {
+    var::set_var("COUNTER", "5");
+    EXPECT_EQ(expand("$((COUNTER += 2))"), "7");
+    EXPECT_EQ(expand("$((COUNTER++))"), "7");
+    EXPECT_EQ(expand("$((--COUNTER))"), "7");
+    EXPECT_EQ(expand("$((COUNTER *= COUNTER, COUNTER))"), "49");
+    EXPECT_EQ(var::get_var("COUNTER"), "49");
+    EXPECT_EQ(expand("$((FRESH_A = FRESH_B = 3))"), "3");
+    EXPECT_EQ(var::get_var("FRESH_A"), "3");
+    EXPECT_EQ(expand("$((UNSET_PARAM + 1))"), "1");
+    var::set_var("STEP", "4");
+    EXPECT_EQ(expand("$(($STEP * STEP))"), "16");
+}
+
+TEST(ArithmeticExpansion, assignmentsReachCachedValues) {
+    const std::string saved {var::get_var("HOME")};
+    var::set_var("HOME", "/first");
+    EXPECT_EQ(tilde::home(), "/first");
+    EXPECT_EQ(expand("$((HOME = 7))"), "7");
+    EXPECT_EQ(tilde::home(), "7");
+    var::set_var("HOME", saved);
+}
+
+TEST(ArithmeticExpansion, shortCircuits) {
+    var::set_var("SIDE", "0");
+    EXPECT_EQ(expand("$((0 && (SIDE = 1)))"), "0");
+    EXPECT_EQ(expand("$((5 || (SIDE = 1)))"), "1");
+    EXPECT_EQ(expand("$((1 ? 10 : (SIDE = 1)))"), "10");
+    EXPECT_EQ(expand("$((0 ? 10 : 0 ? 20 : 30))"), "30");
+    EXPECT_EQ(var::get_var("SIDE"), "0");
+    EXPECT_EQ(expand("$((2 && 3))"), "1");
+}
+
+TEST(ArithmeticExpansion, rejectsBadExpressions) {
+    EXPECT_THROW(expand("$((1 / 0))"), expansion_error);
+    EXPECT_THROW(expand("$((1 % 0))"), expansion_error);
+    EXPECT_THROW(expand("$((2 ** -1))"), expansion_error);
+    EXPECT_THROW(expand("$((1 +))"), expansion_error);
+    EXPECT_THROW(expand("$((1 = 2))"), expansion_error);
+    EXPECT_THROW(expand("$((09))"), expansion_error);
+    EXPECT_THROW(expand("$((1 + 2)"), expansion_error);
+    var::set_var("WORDS", "a b");
+    EXPECT_THROW(expand("$((WORDS))"), expansion_error);
+}
+
+TEST(ExpansionIntegrationTest, keepsLiteralWordsAsTheyAre) {
+    std::pmr::monotonic_buffer_resource arena {};
+    arg_list args {&arena};
+    glob::dir_cache dirs {};
+    const std::string word {"plain-*-word"};
+    expand_argument(word, 0, args, &arena, dirs);
+    expand_argument("'quoted'", ast::word_flags::QUOTES, args, &arena, dirs);
+    ASSERT_EQ(args.size(), 2);
+    EXPECT_EQ(args[0].data(), word.data());
+    EXPECT_EQ(args[1], "quoted");
+}
@@ -0,0 +1,31 @@
+#include "trace.h"
+#include "cmd/variable.h"
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <string>
+
+TEST(Trace, writesSpansAsTraceEvents) {
+    const std::string path {testing::TempDir() + "stush_trace_test.json"};
+    EXPECT_FALSE(trace::enabled());
+    var::set_var("STUSH_TRACE", path);
+    trace::init();
+    ASSERT_TRUE(trace::enabled());
+
+    {
+        trace::span span {"spawn"};
+        span.args = {.pid = 42, .command = "say \"hi\"", .status = 3};
+    }
+    const auto start {trace::clock::time_point {std::chrono::microseconds {1000}}};
+    trace::event("exec", start, start + std::chrono::microseconds {250}, {.pid = 42}, 42);
+    trace::flush();
+
+    std::ifstream file {path};
+    const std::string text {std::istreambuf_iterator<char> {file}, {}};
+    EXPECT_TRUE(text.starts_with("[\n{\"name\":\"process_name\",\"ph\":\"M\""));
+    EXPECT_NE(text.find(R"(,"args":{"pid":42,"argv0":"say \"hi\"","status":3}})"), std::string::npos);
+    EXPECT_NE(text.find(R"({"name":"exec","cat":"stush","ph":"X","ts":1000,"dur":250,)"), std::string::npos);
+    EXPECT_NE(text.find(R"(,"tid":42,"args":{"pid":42}})"), std::string::npos);
+    std::remove(path.c_str());
+}
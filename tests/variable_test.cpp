@@ -0,0 +1,89 @@
+#include "cmd/variable.h"
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/* Returns the NAME=value entry of var::environment() for name, if any. */
+static std::optional<std::string_view> find_exported(std::string_view name) {
+    for (char* const* entry = var::environment(); *entry; entry++) {
+        const std::string_view str {*entry};
+        if (str.starts_with(name) && str.size() > name.size() && str[name.size()] == '=')
+            return str.substr(name.size() + 1);
+    }
+    return std::nullopt;
+}
+
+TEST(Variables, setsFindsAndUnsets) {
+    EXPECT_FALSE(var::find("STORE_A").has_value());
+    var::set_var("STORE_A", "1");
+    EXPECT_EQ(var::find("STORE_A"), "1");
+    var::set_var("STORE_A", "");
+    EXPECT_EQ(var::find("STORE_A"), "");
+    EXPECT_TRUE(var::is_set("STORE_A"));
+
+    var::unset("STORE_A");
+    EXPECT_FALSE(var::find("STORE_A").has_value());
+    EXPECT_THROW(var::get_var("STORE_A"), std::out_of_range);
+    var::set_var("STORE_A", "again");
+    EXPECT_EQ(var::get_var("STORE_A"), "again");
+}
+
+TEST(Variables, keepsReferencesWhileGrowing) {
+    var::set_var("STORE_STABLE", "value");
+    const std::string& value {var::get_var("STORE_STABLE")};
+    for (int i = 0; i < 5000; i++) {
+        var::set_var("STORE_GROWN_" + std::to_string(i), std::to_string(i));
+    }
+    EXPECT_EQ(&var::get_var("STORE_STABLE"), &value);
+    for (int i = 0; i < 5000; i += 499) {
+        EXPECT_EQ(var::find("STORE_GROWN_" + std::to_string(i)), std::to_string(i));
+    }
+}
+
+TEST(Variables, startsWithTheEnvironment) {
+    const char* path {getenv("PATH")};
+    ASSERT_NE(path, nullptr);
+    EXPECT_EQ(var::find("PATH"), path);
+    EXPECT_TRUE(var::is_exported("PATH"));
+}
+
+TEST(Variables, exportsIntoTheEnvironment) {
+    var::set_var("STORE_EXPORTED", "a");
+    EXPECT_FALSE(find_exported("STORE_EXPORTED").has_value());
+    var::export_var("STORE_EXPORTED");
+    EXPECT_EQ(find_exported("STORE_EXPORTED"), "a");
+
+    char* const* env {var::environment()};
+    var::set_var("STORE_NOT_EXPORTED", "b");
+    EXPECT_EQ(var::environment(), env);
+    var::set_var("STORE_EXPORTED", "c");
+    EXPECT_EQ(find_exported("STORE_EXPORTED"), "c");
+
+    var::unset("STORE_EXPORTED");
+    EXPECT_FALSE(find_exported("STORE_EXPORTED").has_value());
+    var::set_var("STORE_EXPORTED", "d");
+    EXPECT_FALSE(var::is_exported("STORE_EXPORTED"));
+}
+
+TEST(Variables, restoresLocalsWhenScopesEnd) {
+    var::set_var("STORE_OUTER", "global");
+    var::unset("STORE_INNER");
+    var::push_scope();
+    var::set_local("STORE_OUTER", "local");
+    var::set_local("STORE_INNER", "1");
+    var::push_scope();
+    var::set_local("STORE_OUTER", "nested");
+    var::set_var("STORE_INNER", "2");
+    EXPECT_EQ(var::find("STORE_OUTER"), "nested");
+    var::pop_scope();
+
+    EXPECT_EQ(var::find("STORE_OUTER"), "local");
+    EXPECT_EQ(var::find("STORE_INNER"), "2");
+    var::set_local("STORE_OUTER", "changed");
+    var::pop_scope();
+    EXPECT_EQ(var::find("STORE_OUTER"), "global");
+    EXPECT_FALSE(var::find("STORE_INNER").has_value());
+}
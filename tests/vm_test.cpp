@@ -0,0 +1,299 @@
+#include "builtins/builtins.h"
+#include "cmd/cmd.h"
+#include "cmd/cmdhash.h"
+#include "cmd/jobs.h"
+#include "cmd/reaper.h"
+#include "cmd/spawn.h"
+#include "cmd/variable.h"
+#include "parser.h"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static int run(std::string source) {
+    return run_compound_command(std::make_shared<const ast::program>(
+        parser::parse(std::move(source), " \t")));
+}
+
+TEST(VmTest, RunsAndOrListsLeftToRight) {
+    EXPECT_EQ(run("false && set a 1 || set b 1"), 0);
+    EXPECT_FALSE(var::is_set("a"));
+    EXPECT_TRUE(var::is_set("b"));
+    EXPECT_EQ(run("true || false"), 0);
+    EXPECT_EQ(run("false || false"), 1);
+}
+
+TEST(VmTest, TakesFirstMatchingBranch) {
+    run("if false; then set branch 1; elif [ x = x ]; then set branch 2; else set branch 3; fi");
+    EXPECT_EQ(var::get_var("branch"), "2");
+    EXPECT_EQ(run("if false; then true; fi"), 0);
+}
+
+TEST(VmTest, LoopsOverItems) {
+    run("set acc ''\nfor i in a b c; do\n  set acc $acc$i\ndone");
+    EXPECT_EQ(var::get_var("acc"), "abc");
+    EXPECT_EQ(var::get_var("i"), "c");
+}
+
+TEST(VmTest, LoopsWhileConditionHolds) {
+    run("set go yes; set runs ''; while [ $go = yes ]; do set go no; set runs x$runs; done");
+    EXPECT_EQ(var::get_var("runs"), "x");
+    run("set runs ''; until [ $runs = xx ]; do set runs x$runs; done");
+    EXPECT_EQ(var::get_var("runs"), "xx");
+}
+
+TEST(VmTest, BreaksAndContinuesNestedLoops) {
+    run("set acc ''; for i in 1 2 3; do for j in a b; do "
+        "if [ $j = b ]; then continue 2; fi; if [ $i = 3 ]; then break 2; fi; set acc $acc$i$j; "
+        "done; done");
+    EXPECT_EQ(var::get_var("acc"), "1a2a");
+}
+
+TEST(VmTest, MatchesCasePatterns) {
+    run("case file.txt in *.c) set kind c;; *.md|*.txt) set kind text;; *) set kind other;; esac");
+    EXPECT_EQ(var::get_var("kind"), "text");
+    run("case x in y) set kind y;; esac");
+    EXPECT_EQ(var::get_var("kind"), "text");
+}
+
+TEST(VmTest, MatchesQuotedCasePatternsLiterally) {
+    run("case abc in \"*\") set kind quoted;; '?bc') set kind single;; a\\*) set kind escaped;; *) set kind glob;; esac");
+    EXPECT_EQ(var::get_var("kind"), "glob");
+    run("case 'a*' in \"a[*]\") set kind quoted;; a\\*) set kind escaped;; esac");
+    EXPECT_EQ(var::get_var("kind"), "escaped");
+    run("set pat '[ab]*'; case b1 in \"$pat\") set kind quoted;; $pat) set kind glob;; esac");
+    EXPECT_EQ(var::get_var("kind"), "glob");
+    run("case '[ab]*' in \"$pat\") set kind quoted;; esac");
+    EXPECT_EQ(var::get_var("kind"), "quoted");
+}
+
+TEST(VmTest, CallsFunctionsWithPositionalParameters) {
+    const int status {run("greet() {\n  set greeting \"$1 $2 $#\"\n  return 3\n  set greeting no\n}\ngreet a b")};
+    EXPECT_EQ(status, 3);
+    EXPECT_EQ(var::get_var("greeting"), "a b 2");
+    EXPECT_TRUE(var::positional().empty());
+}
+
+TEST(VmTest, FunctionsOutliveTheirProgram) {
+    run("twice() { $1; $1; }");
+    run("set n ''; inc() { set n x$n; }");
+    run("twice inc");
+    EXPECT_EQ(var::get_var("n"), "xx");
+}
+
+TEST(VmTest, LimitsRecursion) {
+    EXPECT_EQ(run("forever() { forever; }; forever"), 1);
+}
+
+TEST(VmTest, LoopsOverBraceExpansions) {
+    run("set acc ''; for i in {a,b}{1..2} c; do set acc $acc$i; done");
+    EXPECT_EQ(var::get_var("acc"), "a1a2b1b2c");
+    run("set n 0; for i in {1..100000000}; do if [ $i = 3 ]; then break; fi; done");
+    EXPECT_EQ(var::get_var("i"), "3");
+    run("set runs 0; for i in {-9223372036854775808..9223372036854775807}; do set runs 1; done");
+    EXPECT_EQ(var::get_var("runs"), "0");
+}
+
+TEST(VmTest, TildeFollowsHomeWhoeverSetsIt) {
+    const std::string saved {var::get_var("HOME")};
+    run("set homes ''; for HOME in /x /y; do set home ~; set homes $homes$home; done");
+    EXPECT_EQ(var::get_var("homes"), "/x/y");
+    var::set_var("HOME", saved);
+}
+
+TEST(VmTest, FindsBuiltinsByName) {
+    for (std::string_view name : {"cd", "[", ":", "export", "false"}) {
+        const Command* builtin {find_builtin(name)};
+        ASSERT_NE(builtin, nullptr);
+        EXPECT_EQ(builtin->name, name);
+    }
+    for (std::string_view name : {"", "ls", "tru", "true ", "/usr/bin/true"}) {
+        EXPECT_EQ(find_builtin(name), nullptr);
+    }
+}
+
+TEST(VmTest, FeedsStagesBetweenBuiltins) {
+    // the stage in the middle has to get through its input and write
+    // before it can tell whether the builtin after it is still there
+    const std::string path {testing::TempDir() + "stush_between_builtins"};
+    EXPECT_EQ(run("help | sh -c 'read line; echo \"$line\"; echo \"$line\" > " + path + "' | true"), 0);
+    std::ifstream file {path};
+    const std::string output {std::istreambuf_iterator<char> {file}, {}};
+    EXPECT_TRUE(output.starts_with("cd: ")) << output;
+    std::remove(path.c_str());
+}
+
+TEST(VmTest, PassesExportedVariables) {
+    run("set STUSH_SHARED one; export STUSH_SHARED; set STUSH_PRIVATE two");
+    EXPECT_TRUE(var::is_exported("STUSH_SHARED"));
+    EXPECT_FALSE(var::is_exported("STUSH_PRIVATE"));
+    EXPECT_EQ(run("sh -c 'test \"$STUSH_SHARED\" = one -a -z \"$STUSH_PRIVATE\"'"), 0);
+
+    char* const* env {var::environment()};
+    EXPECT_EQ(var::environment(), env);
+    run("set STUSH_SHARED three");
+    EXPECT_EQ(run("sh -c 'test \"$STUSH_SHARED\" = three'"), 0);
+    run("unset STUSH_SHARED");
+    EXPECT_EQ(run("sh -c 'test -z \"$STUSH_SHARED\"'"), 0);
+}
+
+/* Directory holding a tool that exits with status. */
+static std::string tool_dir(std::string_view name, int status) {
+    const std::filesystem::path dir {testing::TempDir() + std::string(name)};
+    std::filesystem::create_directories(dir);
+    std::ofstream {dir / "stush_tool"} << "#!/bin/sh\nexit " << status << '\n';
+    std::filesystem::permissions(dir / "stush_tool", std::filesystem::perms::owner_all);
+    return dir;
+}
+
+TEST(VmTest, CommandsFollowPathWhoeverSetsIt) {
+    const std::string saved {var::get_var("PATH")};
+    const std::string first {tool_dir("stush_path_a", 3)};
+    const std::string second {tool_dir("stush_path_b", 4)};
+    EXPECT_EQ(run("for PATH in " + first + " " + second + "; do stush_tool; done"), 4);
+
+    // what an empty entry finds depends on the working directory
+    const auto cwd {std::filesystem::current_path()};
+    std::filesystem::current_path(first);
+    var::set_var("PATH", ":/bin");
+    EXPECT_EQ(run("stush_tool"), 3);
+    EXPECT_FALSE(cmdhash::entries().contains("stush_tool"));
+    std::filesystem::current_path(cwd);
+
+    var::set_var("PATH", saved);
+    std::filesystem::remove_all(first);
+    std::filesystem::remove_all(second);
+}
+
+TEST(VmTest, ArithmeticAssignmentsChangeThePath) {
+    const std::string saved {var::get_var("PATH")};
+    const std::string dir {tool_dir("stush_path_arith", 3)};
+    var::set_var("PATH", dir);
+    EXPECT_EQ(run("stush_tool"), 3);
+    EXPECT_EQ(run("true $((PATH = 0)); stush_tool"), 127);
+    var::set_var("PATH", saved);
+    std::filesystem::remove_all(dir);
+}
+
+TEST(VmTest, RunsFilesWithoutAnInterpreterWithSh) {
+    const std::filesystem::path dir {testing::TempDir() + "stush_script"};
+    std::filesystem::create_directories(dir);
+    std::ofstream {dir / "script"} << "exit $(($1 + $2))\n";
+    std::filesystem::permissions(dir / "script", std::filesystem::perms::owner_all);
+    EXPECT_EQ(run((dir / "script").string() + " 2 3"), 5);
+    std::filesystem::remove_all(dir);
+}
+
+TEST(VmTest, CountsWithArithmetic) {
+    run("set n 0; set sum 0; while [ $((n < 5)) = 1 ]; do true $((sum += n++)); done");
+    EXPECT_EQ(var::get_var("n"), "5");
+    EXPECT_EQ(var::get_var("sum"), "10");
+}
+
+TEST(VmTest, RunsBackgroundListsConcurrently) {
+    const auto start {std::chrono::steady_clock::now()};
+    EXPECT_EQ(run("sleep 0.3 & sleep 0.3 & wait"), 0);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds {550});
+    EXPECT_TRUE(jobs::table().empty());
+}
+
+TEST(VmTest, BackgroundListsRunInACopyOfTheShell) {
+    EXPECT_EQ(run("set copied no; { set copied yes; exit 3; } & wait $!"), 3);
+    EXPECT_EQ(var::get_var("copied"), "no");
+    EXPECT_EQ(run("false && true & wait %%"), 1);
+    EXPECT_EQ(run("wait 1"), 127);
+}
+
+TEST(VmTest, StopsPipelinesEndingInABuiltin) {
+    // job control needs a terminal, which a shell in a session of its own gets
+    const pid_t shell {spawn_subshell({}, [] {
+        setsid();
+        const int terminal {posix_openpt(O_RDWR | O_NOCTTY)};
+        if (terminal == -1 || grantpt(terminal) != 0 || unlockpt(terminal) != 0)
+            return 2;
+        dup2(open(ptsname(terminal), O_RDWR), STDIN_FILENO);
+        jobs::init_job_control();
+        run("sh -c 'kill -TSTP $$' | true");
+        const auto& table {jobs::table()};
+        if (table.size() != 1 || table[0].state != jobs::job_state::STOPPED)
+            return 3;
+        kill(-table[0].pgid, SIGKILL);
+        return table[0].pids == std::vector {table[0].last} ? 0 : 1;
+    })};
+    const auto child {reaper::wait(shell)};
+    ASSERT_TRUE(child.has_value());
+    EXPECT_EQ(reaper::exit_status(child->status), 0);
+}
+
+TEST(VmTest, WaitsForTheNextJob) {
+    const auto start {std::chrono::steady_clock::now()};
+    EXPECT_EQ(run("sleep 0.3 & false & wait -n"), 1);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds {250});
+    EXPECT_EQ(run("wait -n; wait -n"), 127);
+}
+
+TEST(VmTest, RunsParallelTasksAFewAtATime) {
+    const auto start {std::chrono::steady_clock::now()};
+    EXPECT_EQ(run("parallel -j 2 sleep ::: 0.2 0.2 0.2 0.2"), 0);
+    const auto elapsed {std::chrono::steady_clock::now() - start};
+    EXPECT_GE(elapsed, std::chrono::milliseconds {400});
+    EXPECT_LT(elapsed, std::chrono::milliseconds {750});
+
+    // builtins run in a copy of the shell, the status counts the failures
+    EXPECT_EQ(run("parallel -j 3 test {} = 2 ::: 1 2 3"), 2);
+    EXPECT_EQ(run("parallel sleep"), 255);
+    EXPECT_EQ(run("parallel -j 0 sleep ::: 1"), 255);
+}
+
+TEST(VmTest, KeepsParallelOutputInOrder) {
+    const std::string path {testing::TempDir() + "stush_parallel_test"};
+    EXPECT_EQ(run("parallel -k -j 3 sh -c 'sleep $0; echo $0' ::: 0.3 0.1 0.2 | sh -c 'cat > " + path + "'"), 0);
+    std::ifstream file {path};
+    const std::string output {std::istreambuf_iterator<char> {file}, {}};
+    EXPECT_EQ(output, "0.3\n0.1\n0.2\n");
+    std::remove(path.c_str());
+}
+
+TEST(VmTest, TimesPipelinesByStage) {
+    testing::internal::CaptureStderr();
+    EXPECT_EQ(run("time sleep 0.2 | true | sh -c 'exit 3'"), 3);
+    const std::string report {testing::internal::GetCapturedStderr()};
+    EXPECT_TRUE(report.starts_with("real\t0.2")) << report;
+    EXPECT_NE(report.find("\nstage  pid"), std::string::npos) << report;
+    EXPECT_NE(report.find("3       "), std::string::npos) << report;
+    EXPECT_NE(report.find("sh -c 'exit 3'\n"), std::string::npos) << report;
+
+    testing::internal::CaptureStderr();
+    EXPECT_EQ(run("time -j { true; }"), 0);
+    const std::string json {testing::internal::GetCapturedStderr()};
+    EXPECT_TRUE(json.starts_with("{\"status\":0,\"real\":")) << json;
+    EXPECT_NE(json.find("\"stages\":[{\"command\":\"...\",\"pid\":null,\"status\":0,"), std::string::npos) << json;
+
+    testing::internal::CaptureStderr();
+    EXPECT_EQ(run("false; time"), 0);
+    EXPECT_TRUE(testing::internal::GetCapturedStderr().starts_with("real\t0.0"));
+}
+
+TEST(VmTest, TimesOnlyWhatThePipelineStarted) {
+    // the shell's own size is the least a pipeline can take
+    testing::internal::CaptureStderr();
+    run("time -j stush_missing_command");
+    const std::string missing {testing::internal::GetCapturedStderr()};
+    EXPECT_EQ(missing.find("\"max_rss_kib\":0,"), std::string::npos) << missing;
+
+    // a job that is reaped while the pipeline runs isn't part of it
+    testing::internal::CaptureStderr();
+    run("sh -c 'i=0; while [ $i -lt 100000 ]; do i=$((i + 1)); done' & time -j sleep 0.6; wait");
+    const std::string busy {testing::internal::GetCapturedStderr()};
+    EXPECT_NE(busy.find("\"user\":0.0"), std::string::npos) << busy;
+}